@@ -2,6 +2,12 @@
 // The swift-tools-version declares the minimum version of Swift required to build this package.
 
 import PackageDescription
+import Foundation
+
+// `LUASWIFT_ASSERT=1 swift test` builds Lua with its internal assertions (`LUAI_ASSERT`)
+let luaAssertSettings: [CSetting] = ProcessInfo.processInfo.environment["LUASWIFT_ASSERT"] != nil ? [
+    .define("LUAI_ASSERT"),
+] : []
 
 let package = Package(
     name: "LuaSwift",
@@ -33,6 +39,7 @@ let package = Package(
         .target(
             name: "CLua",
             path: "Sources/lua-5.4.8/src",
+            cSettings: luaAssertSettings,
             cxxSettings: [
                 .define("LUA_USE_IOS", .when(platforms: [.iOS])),
             ]
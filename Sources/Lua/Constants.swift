@@ -5,3 +5,10 @@ public let LUA_REGISTRYINDEX: Int32 = -LUAI_MAXSTACK - 1000
 
 @inline(__always)
 public let LUA_EXTRASPACE: Int = LUA_EXTRASPACE_SIZE()
+
+/// Returns the pseudo-index of the i-th upvalue of the running C function (the `lua_upvalueindex` macro).
+@inlinable
+@inline(__always)
+public func lua_upvalueindex(_ i: Int32) -> Int32 {
+    return LUA_REGISTRYINDEX - i
+}
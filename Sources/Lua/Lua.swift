@@ -30,10 +30,52 @@ public struct LuaState: @unchecked Sendable {
         return LuaState(state: lua_newthread(state))
     }
     
+    /// Exchange values between different threads of the same state.
+    /// This function pops n values from the stack from, and pushes them onto the stack to.
+    @inlinable
+    @inline(__always)
+    public func xmove(to: LuaState, n: Int32) {
+        lua_xmove(state, to.state, n)
+    }
+    
     @inlinable
     @inline(__always)
     public func loadBufferX(buffer: String, name: String, mode: String = "bt") -> LuaThreadStatus {
-        return LuaThreadStatus(rawValue: luaL_loadbufferx(state, buffer, buffer.count, name, mode))
+        var buffer = buffer
+        return buffer.withUTF8 { utf8 in
+            LuaThreadStatus(rawValue: luaL_loadbufferx(state, UnsafeRawPointer(utf8.baseAddress)?.assumingMemoryBound(to: CChar.self), utf8.count, name, mode))
+        }
+    }
+    
+    /// Loads a buffer as a Lua chunk, like `loadBufferX(buffer:name:mode:)` but from raw bytes, which may hold a binary chunk (see `dump(writer:data:strip:)`).
+    @inlinable
+    @inline(__always)
+    public func loadBufferX(bytes: UnsafeRawBufferPointer, name: String, mode: String = "bt") -> LuaThreadStatus {
+        return LuaThreadStatus(rawValue: luaL_loadbufferx(state, bytes.baseAddress?.assumingMemoryBound(to: CChar.self), bytes.count, name, mode))
+    }
+    
+    /// Dumps a function as a binary chunk. Receives a Lua function on the top of the stack and produces a binary chunk that, if loaded again, results in a function equivalent to the one dumped. As it produces parts of the chunk, lua_dump calls function writer (see lua_Writer) with the given data to write them.
+    /// If strip is true, the binary representation may not include all debug information about the function, to save space.
+    /// The value returned is the error code returned by the last call to the writer; 0 means no errors.
+    /// This function does not pop the Lua function from the stack.
+    @inlinable
+    @inline(__always)
+    public func dump(writer: lua_Writer, data: UnsafeMutableRawPointer?, strip: Bool) -> Int32 {
+        return lua_dump(state, writer, data, strip ? 1 : 0)
+    }
+    
+    /// Like `dump(writer:data:strip:)`, but pads the chunk so that its code arrays are aligned relative to its start (`LUAC_FORMAT_ALIGNED`). Such chunks load anywhere, and `loadMapped(bytes:name:release:ud:)` can use their code in place.
+    @inlinable
+    @inline(__always)
+    public func dumpAligned(writer: lua_Writer, data: UnsafeMutableRawPointer?, strip: Bool) -> Int32 {
+        return lua_dumpaligned(state, writer, data, strip ? 1 : 0)
+    }
+    
+    /// Loads a binary chunk in place: the code and line information of its functions point into `bytes` instead of being copied (code arrays only when aligned, see `dumpAligned(writer:data:strip:)`). `bytes` must stay valid and unchanged until `release` is called, exactly once, when no function uses them anymore. That is usually from a garbage collection, also after a failed load that had already made functions pointing into `bytes`; only when none came to use them is it called before returning. `release` must not call Lua; pass nil when `bytes` outlive the state.
+    @inlinable
+    @inline(__always)
+    public func loadMapped(bytes: UnsafeRawBufferPointer, name: String, release: lua_Release?, ud: UnsafeMutableRawPointer? = nil) -> LuaThreadStatus {
+        return LuaThreadStatus(rawValue: lua_loadmapped(state, bytes.baseAddress?.assumingMemoryBound(to: CChar.self), bytes.count, name, release, ud))
     }
     
     @inlinable
@@ -93,12 +135,30 @@ public struct LuaState: @unchecked Sendable {
     @inlinable
     @inline(__always)
     public func toString(_ idx: Int32 = -1) -> String? {
+        return withUnsafeLString(idx) { bytes in
+            String(decoding: bytes, as: UTF8.self)
+        }
+    }
+    
+    /// Returns a copy of the bytes of the string at the given index, including any embedded zeros. Like `lua_tolstring`, a number is converted to a string in place.
+    @inlinable
+    @inline(__always)
+    public func toBytes(_ idx: Int32 = -1) -> [UInt8]? {
+        return withUnsafeLString(idx) { bytes in
+            Array(bytes)
+        }
+    }
+    
+    /// Calls `body` with the bytes of the string at the given index without copying them, or returns nil if the value is neither a string nor a number.
+    /// The buffer points straight into the Lua string, so it is only valid inside `body` and only while that value stays on the stack. Like `lua_tolstring`, a number is converted to a string in place.
+    @inlinable
+    @inline(__always)
+    public func withUnsafeLString<R>(_ idx: Int32 = -1, _ body: (UnsafeRawBufferPointer) throws -> R) rethrows -> R? {
         var len: Int = 0
-        if let res = lua_tolstring(state, idx, &len) {
-            return String(cString: res)
-        } else {
+        guard let res = lua_tolstring(state, idx, &len) else {
             return nil
         }
+        return try body(UnsafeRawBufferPointer(start: res, count: len))
     }
     
     /// Creates and pushes a traceback of the stack L1. If msg is not NULL, it is appended at the beginning of the traceback. The level parameter tells at which level to start the traceback.
@@ -138,6 +198,27 @@ public struct LuaState: @unchecked Sendable {
         return LuaType(rawValue: lua_type(state, idx))
     }
     
+    /// Converts the acceptable index idx into an equivalent absolute index (that is, one that does not depend on the stack size).
+    @inlinable
+    @inline(__always)
+    public func absIndex(_ idx: Int32) -> Int32 {
+        return lua_absindex(state, idx)
+    }
+    
+    /// Ensures that the stack has space for at least n extra elements, that is, that you can safely push up to n values into it. It returns false if it cannot fulfill the request, either because it would cause the stack to be greater than a fixed maximum size (typically at least several thousand elements) or because it cannot allocate memory for the extra space. This function never shrinks the stack; if the stack already has space for the extra elements, it is left unchanged.
+    @inlinable
+    @inline(__always)
+    public func checkStack(_ n: Int32) -> Bool {
+        return lua_checkstack(state, n) != 0
+    }
+    
+    /// Returns the raw "length" of the value at the given index: for strings, this is the string length; for tables, this is the result of the length operator ('#') with no metamethods; for userdata, this is the size of the block of memory allocated for the userdata. For other values, this call returns 0.
+    @inlinable
+    @inline(__always)
+    public func rawLen(_ idx: Int32 = -1) -> lua_Unsigned {
+        return lua_rawlen(state, idx)
+    }
+    
     @inlinable
     @inline(__always)
     public func pop(_ n: Int32 = 1) {
@@ -178,7 +259,45 @@ public struct LuaState: @unchecked Sendable {
     @inlinable
     @inline(__always)
     public func pushString(_ s: String) {
-        lua_pushstring(state, s)
+        pushLString(s)
+    }
+    
+    /// Pushes the given bytes onto the stack as a string. Lua makes its own copy, and the bytes can contain embedded zeros.
+    @inlinable
+    @inline(__always)
+    public func pushLString(_ bytes: UnsafeRawBufferPointer) {
+        lua_pushlstring(state, bytes.baseAddress?.assumingMemoryBound(to: CChar.self), bytes.count)
+    }
+    
+    @inlinable
+    @inline(__always)
+    public func pushLString(_ bytes: [UInt8]) {
+        bytes.withUnsafeBytes { bytes in
+            pushLString(bytes)
+        }
+    }
+    
+    /// Pushes the UTF-8 bytes of the string without going through a null terminated copy, so no `strlen` is needed and embedded zeros are kept.
+    @inlinable
+    @inline(__always)
+    public func pushLString(_ s: String) {
+        var s = s
+        s.withUTF8 { utf8 in
+            pushLString(UnsafeRawBufferPointer(utf8))
+        }
+    }
+    
+    /// Pushes a string of `count` bytes that `body` writes, all of them. Long strings are written in place, so the bytes are not copied (see `lua_pushbuffstring`); short strings, which Lua interns by their contents, are written to a temporary buffer first.
+    @inlinable
+    public func pushLString(count: Int, _ body: (UnsafeMutableRawBufferPointer) throws -> Void) rethrows {
+        if let p = lua_pushbuffstring(state, count) {
+            try body(UnsafeMutableRawBufferPointer(start: p, count: count))
+        } else {
+            try withUnsafeTemporaryAllocation(byteCount: count, alignment: 1) { bytes in
+                try body(bytes)
+                pushLString(UnsafeRawBufferPointer(bytes))
+            }
+        }
     }
     
     @inlinable
@@ -245,10 +364,37 @@ public struct LuaState: @unchecked Sendable {
         lua_rawset(state, idx)
     }
     
+    /// Similar to lua_gettable, but does a raw access (i.e., without metamethods). The value at index must be a table.
+    /// Pops the key from the stack and pushes t[k] in its place. Returns the type of the pushed value.
+    @inlinable
+    @inline(__always)
+    @discardableResult
+    public func rawGet(_ idx: Int32) -> LuaType {
+        return LuaType(rawValue: lua_rawget(state, idx))
+    }
+    
+    /// Pushes onto the stack the value t[k], where t is the table at the given index and k is the pointer p represented as a light userdata. The access is raw; that is, it does not use the __index metavalue.
+    /// Returns the type of the pushed value.
+    @inlinable
+    @inline(__always)
+    @discardableResult
+    public func rawGetP(_ idx: Int32, p: UnsafeRawPointer) -> LuaType {
+        return LuaType(rawValue: lua_rawgetp(state, idx, p))
+    }
+    
+    /// Does the equivalent of t[p] = v, where t is the table at the given index, p is encoded as a light userdata, and v is the value on the top of the stack.
+    /// This function pops the value from the stack. The assignment is raw, that is, it does not use the __newindex metavalue.
+    @inlinable
+    @inline(__always)
+    public func rawSetP(_ idx: Int32, p: UnsafeRawPointer) {
+        lua_rawsetp(state, idx, p)
+    }
+    
+    /// Closes the state, then releases the allocator it was created with (see `LuaAllocator`).
     @inlinable
     @inline(__always)
     public func close() {
-        lua_close(state)
+        lua_close_allocator(state)
     }
 
     /// Compares two Lua values. Returns true if the value at index index1 satisfies op when compared with the value at index index2, following the semantics of the corresponding Lua operator (that is, it may call metamethods). Otherwise returns false. Also returns false if any of the indices is not valid.
@@ -513,6 +659,13 @@ public struct LuaState: @unchecked Sendable {
         lua_pushcclosure(state, f, 0)
     }
 
+    /// Pushes a new C closure onto the stack. The n values on the top of the stack are popped and become the closure's upvalues, reachable from the function through `lua_upvalueindex`.
+    @inlinable
+    @inline(__always)
+    public func pushLuaCClosure(_ f: lua_CFunction, n: Int32) {
+        lua_pushcclosure(state, f, n)
+    }
+
     /// Pops a value from the stack and sets it as the new value of global name.
     @inlinable
     @inline(__always)
@@ -533,7 +686,10 @@ public struct LuaState: @unchecked Sendable {
     @inlinable
     @inline(__always)
     public func checkLString(_ arg: Int32, l: UnsafeMutablePointer<size_t>?) -> String {
-        return String(cString: luaL_checklstring(state, arg, l))
+        var len: size_t = 0
+        let res = luaL_checklstring(state, arg, &len)
+        l?.pointee = len
+        return String(decoding: UnsafeRawBufferPointer(start: res, count: len), as: UTF8.self)
     }
     
     /// void luaL_newlib (lua_State *L, const luaL_Reg l[]);
@@ -0,0 +1,113 @@
+import CLua
+
+/// Where a `LuaState` gets its memory from.
+public enum LuaAllocator: Sendable {
+    /// `realloc`/`free`, as used by `luaL_newstate`.
+    case system
+    /// A size-class slab allocator owned by the state. Blocks of up to `LUA_SLAB_MAXSIZE` bytes are carved out of large chunks and recycled through per-class free lists instead of going back to `malloc`. The chunks are released by `close()`.
+    case slab
+}
+
+/// Allocation statistics of a state using `LuaAllocator.slab`.
+public struct LuaSlabAllocatorStats: Sendable {
+    /// Bytes currently allocated by Lua.
+    public let totalBytes: Int
+    /// Highest value `totalBytes` reached.
+    public let peakBytes: Int
+    /// Part of `totalBytes` in blocks too big for a size class.
+    public let largeBytes: Int
+    /// Bytes reserved from the system for slab chunks.
+    public let chunkBytes: Int
+    /// Bytes in use per size class. Class `i` holds blocks of up to `(i + 1) * LUA_SLAB_GRANULE` bytes.
+    public let classBytes: [Int]
+    /// Blocks in use per size class.
+    public let classBlocks: [Int]
+    /// Number of blocks waiting in each size class's free list.
+    public let freeListLengths: [Int]
+    
+    @inlinable
+    public init(_ stats: lua_SlabStats) {
+        self.totalBytes = stats.totalbytes
+        self.peakBytes = stats.peakbytes
+        self.largeBytes = stats.largebytes
+        self.chunkBytes = stats.chunkbytes
+        self.classBytes = withUnsafeBytes(of: stats.classbytes) { Array($0.bindMemory(to: Int.self)) }
+        self.classBlocks = withUnsafeBytes(of: stats.classblocks) { Array($0.bindMemory(to: Int.self)) }
+        self.freeListLengths = withUnsafeBytes(of: stats.freeblocks) { Array($0.bindMemory(to: Int.self)) }
+    }
+}
+
+extension LuaState {
+    
+    /// Creates a new state using the given allocator, with the same panic and warning setup as `luaL_newstate`.
+    @inlinable
+    @inline(__always)
+    public static func newLuaState(allocator: LuaAllocator) -> LuaState {
+        switch allocator {
+        case .system:
+            return newLuaState()
+        case .slab:
+            return LuaState(state: lua_newstate_slab())
+        }
+    }
+    
+    /// Returns the allocation statistics of a state created with `LuaAllocator.slab`, or nil for any other state.
+    @inlinable
+    @inline(__always)
+    public func slabAllocatorStats() -> LuaSlabAllocatorStats? {
+        var stats = lua_SlabStats()
+        guard lua_slab_getstats(state, &stats) != 0 else {
+            return nil
+        }
+        return LuaSlabAllocatorStats(stats)
+    }
+}
+
+/// Live memory counters of a state with a memory limit (see `LuaState.setMemoryLimit(soft:hard:)`).
+public struct LuaMemoryUsage: Sendable {
+    /// Bytes currently allocated by Lua.
+    public let bytesInUse: Int
+    /// Highest value `bytesInUse` reached since the limit was installed.
+    public let peakBytes: Int
+    /// Usage that triggers an emergency collection, or nil for none.
+    public let softLimit: Int?
+    /// Usage past which allocations fail with `LUA_ERRMEM`, or nil for none.
+    public let hardLimit: Int?
+    /// Number of emergency collections run because of the soft limit.
+    public let softCollections: Int
+    /// Number of allocations refused because of the hard limit.
+    public let failedAllocations: Int
+    
+    @inlinable
+    public init(_ stats: lua_MemStats) {
+        self.bytesInUse = stats.totalbytes
+        self.peakBytes = stats.peakbytes
+        self.softLimit = stats.softlimit == 0 ? nil : stats.softlimit
+        self.hardLimit = stats.hardlimit == 0 ? nil : stats.hardlimit
+        self.softCollections = stats.softcollections
+        self.failedAllocations = stats.failedallocs
+    }
+}
+
+extension LuaState {
+    
+    /// Caps the memory of the state. When usage would pass `soft`, Lua runs an emergency full collection first; an allocation that would pass `hard` fails, so the script sees a `LUA_ERRMEM` error ("not enough memory") instead of the process running out of memory. nil means no limit.
+    ///
+    /// The first call wraps the state's allocator with per-state counters (no locks, like the state itself); later calls only change the limits. Works with any `LuaAllocator`.
+    @inlinable
+    @inline(__always)
+    public func setMemoryLimit(soft: Int? = nil, hard: Int? = nil) {
+        lua_setmemlimit(state, soft.map { max($0, 1) } ?? 0, hard.map { max($0, 1) } ?? 0)
+    }
+    
+    /// Returns the memory counters of a state with a memory limit, or nil if `setMemoryLimit(soft:hard:)` was never called.
+    @inlinable
+    @inline(__always)
+    public func memoryUsage() -> LuaMemoryUsage? {
+        var stats = lua_MemStats()
+        guard lua_getmemstats(state, &stats) != 0 else {
+            return nil
+        }
+        return LuaMemoryUsage(stats)
+    }
+}
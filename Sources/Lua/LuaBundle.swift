@@ -0,0 +1,71 @@
+import CLua
+
+/// Counters of a module bundle (see `LuaState.bundleStats(_:)`).
+public struct LuaBundleStats: Sendable {
+    /// Modules in the bundle.
+    public let modules: Int
+    /// Modules loaded from the bundle.
+    public let loads: Int
+    /// Loads of binary chunks that used the bundle's bytes in place.
+    public let mappedLoads: Int
+    /// Bytes produced by decompressing modules.
+    public let decompressedBytes: Int
+    
+    @inlinable
+    public init(_ stats: lua_BundleStats) {
+        self.modules = stats.modules
+        self.loads = stats.loads
+        self.mappedLoads = stats.mapped
+        self.decompressedBytes = stats.decompressed
+    }
+}
+
+extension LuaState {
+    
+    /// Writes the modules of the table at `idx` (module name to source or binary chunk) as a bundle through `writer`, like `dump(writer:data:strip:)`: a table of contents sorted by name followed by the modules, each compressed if `compress` is true and that makes it smaller. Returns 0, the error code of the writer, or -1 with an error message on the stack. `writer` must not leave values on the stack (e.g. a `luaL_Buffer`).
+    @inlinable
+    @inline(__always)
+    public func writeBundle(_ idx: Int32, writer: lua_Writer, data: UnsafeMutableRawPointer?, compress: Bool) -> Int32 {
+        return luaL_writebundle(state, idx, writer, data, compress ? LUA_BUNDLE_COMPRESS : 0)
+    }
+    
+    /// Reads the bundle file at `path` and pushes a bundle userdata for it, or an error message.
+    @inlinable
+    @inline(__always)
+    public func openBundle(path: String) -> LuaThreadStatus {
+        return LuaThreadStatus(rawValue: luaL_openbundlefile(state, path))
+    }
+    
+    /// Checks the bundle in `bytes` and pushes a bundle userdata for it, or an error message. `bytes` must stay valid until `release` is called, once the userdata and every function loaded in place from it are collected (or before returning, on errors). `release` must not call Lua; pass nil when `bytes` outlive the state.
+    @inlinable
+    @inline(__always)
+    public func openBundle(bytes: UnsafeRawBufferPointer, name: String, release: lua_Release?, ud: UnsafeMutableRawPointer? = nil) -> LuaThreadStatus {
+        return LuaThreadStatus(rawValue: lua_openbundle(state, bytes.baseAddress?.assumingMemoryBound(to: CChar.self), bytes.count, name, release, ud))
+    }
+    
+    /// Pops the bundle on the top of the stack and appends it to `package.bundles`, whose modules `require` finds before searching `package.path`. The package library must be open.
+    @inlinable
+    @inline(__always)
+    public func addBundle() {
+        luaL_addbundle(state)
+    }
+    
+    /// Loads module `name` from the bundle at `idx`, pushing its chunk like `loadBufferX(buffer:name:mode:)`. Returns nil, pushing nothing, when the bundle has no such module.
+    @inlinable
+    @inline(__always)
+    public func loadBundled(_ idx: Int32, module name: String) -> LuaThreadStatus? {
+        let status = luaL_loadbundled(state, idx, name)
+        return status == -1 ? nil : LuaThreadStatus(rawValue: status)
+    }
+    
+    /// Returns the counters of the bundle at `idx`, or nil if it is not a bundle.
+    @inlinable
+    @inline(__always)
+    public func bundleStats(_ idx: Int32 = -1) -> LuaBundleStats? {
+        var stats = lua_BundleStats()
+        guard luaL_bundlestats(state, idx, &stats) != 0 else {
+            return nil
+        }
+        return LuaBundleStats(stats)
+    }
+}
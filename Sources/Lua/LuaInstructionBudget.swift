@@ -0,0 +1,39 @@
+import CLua
+
+/// What a coroutine does when it runs out of its instruction budget (see `LuaState.setInstructionBudget(_:quantum:onExhausted:)`).
+public enum LuaBudgetExhaustion: Sendable {
+    /// Yield with no results, giving the coroutine a full budget for its next resume (cooperative time-slicing). Where the coroutine cannot yield (the main thread, or across a C call without a continuation) an error is raised instead.
+    case yield
+    /// Raise an "instruction budget exhausted" error, again on every quantum, until the budget is set again.
+    case error
+}
+
+extension LuaState {
+    
+    /// Gives every coroutine `instructions` VM instructions to run, counted by a `LUA_MASKCOUNT` hook that fires every `quantum` instructions, so the budget is enforced to within one quantum.
+    ///
+    /// The hook replaces any hook set on this thread; coroutines created from it afterwards inherit it and each start with a full budget. Calling this again gives every coroutine a full budget. States without a budget have no hook and pay nothing.
+    @inlinable
+    @inline(__always)
+    public func setInstructionBudget(_ instructions: Int, quantum: Int32 = 1000, onExhausted: LuaBudgetExhaustion) {
+        lua_setbudget(state, lua_Integer(instructions), quantum, onExhausted == .yield ? LUA_BUDGETYIELD : LUA_BUDGETERROR)
+    }
+    
+    /// Removes the instruction budget of the state, and the hook of this thread.
+    @inlinable
+    @inline(__always)
+    public func clearInstructionBudget() {
+        lua_clearbudget(state)
+    }
+    
+    /// Returns the instructions this coroutine has left, in whole quanta, or nil if the state has no instruction budget.
+    @inlinable
+    @inline(__always)
+    public func remainingInstructionBudget() -> Int? {
+        var remaining: lua_Integer = 0
+        guard lua_getbudget(state, &remaining) != 0 else {
+            return nil
+        }
+        return Int(remaining)
+    }
+}
@@ -0,0 +1,64 @@
+import CLua
+
+/// How `require` resolves `package.path` and `package.cpath` (see `LuaState.setPathCache(_:)`).
+public enum LuaPathCacheMode: Sendable {
+    /// Try to open every candidate file, as stock Lua does.
+    case off
+    /// Answer from snapshots of directory listings, checking the mtime of each directory once per search. Directories that do not exist are checked through their parent's snapshot.
+    case check
+    /// Answer from snapshots without any system call until `LuaState.invalidatePathCache()` is called.
+    case trust
+}
+
+/// Counters of the path cache of `require` (see `LuaState.pathCacheStats()`).
+public struct LuaPathCacheStats: Sendable, Equatable {
+    /// File lookups answered by a snapshot.
+    public let hits: Int
+    /// File lookups that had to read a directory or open the file.
+    public let misses: Int
+    /// Directory mtime checks.
+    public let checks: Int
+    /// Snapshots dropped as stale, and calls to `LuaState.invalidatePathCache()`.
+    public let invalidations: Int
+    
+    @inlinable
+    public init(_ stats: luaL_PathCacheStats) {
+        self.hits = stats.hits
+        self.misses = stats.misses
+        self.checks = stats.checks
+        self.invalidations = stats.invalidations
+    }
+}
+
+extension LuaState {
+    
+    /// Sets how `require` (and `package.searchpath`) find files. With a cache, the candidates of `package.path` and `package.cpath` are looked up in snapshots of directory listings, with positive and negative entries, instead of being opened one by one. Turning the cache off drops every snapshot.
+    @inlinable
+    @inline(__always)
+    public func setPathCache(_ mode: LuaPathCacheMode) {
+        switch mode {
+        case .off:
+            luaL_setpathcache(state, LUA_PATHCACHE_OFF)
+        case .check:
+            luaL_setpathcache(state, LUA_PATHCACHE_CHECK)
+        case .trust:
+            luaL_setpathcache(state, LUA_PATHCACHE_TRUST)
+        }
+    }
+    
+    /// Drops every snapshot of the path cache, e.g. after installing modules while it is in `.trust` mode.
+    @inlinable
+    @inline(__always)
+    public func invalidatePathCache() {
+        luaL_invalidatepathcache(state)
+    }
+    
+    /// Returns the counters of the path cache.
+    @inlinable
+    @inline(__always)
+    public func pathCacheStats() -> LuaPathCacheStats {
+        var stats = luaL_PathCacheStats()
+        _ = luaL_getpathcache(state, &stats)
+        return LuaPathCacheStats(stats)
+    }
+}
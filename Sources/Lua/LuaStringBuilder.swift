@@ -0,0 +1,111 @@
+import CLua
+
+/// Builds one Lua string in a `luaL_Buffer`, appending bytes, integers and floats in place, so no intermediate strings are created and interned as with `LuaState.concat(_:)` or repeated `pushString(_:)`.
+///
+/// While building, the builder keeps one slot on the top of the stack (a placeholder, or the box holding its bytes once they outgrow the initial buffer), as with `luaL_Buffer` in C. Anything pushed between appends must be popped before the next append, except for `appendValue()`. `finish()` replaces the slot with the string; a builder dropped without finishing leaves its slot for the caller to pop.
+public struct LuaStringBuilder: ~Copyable {
+    /// The buffer, which must not move while in use: it can hold its own bytes, and the placeholder on the stack is its address.
+    @usableFromInline
+    let buffer: UnsafeMutablePointer<luaL_Buffer>
+    
+    /// Starts a string on `L`, reserving `capacity` bytes up front if given (see `reserve(_:)`).
+    @inlinable
+    public init(_ L: LuaState, capacity: Int = 0) {
+        buffer = UnsafeMutablePointer<luaL_Buffer>.allocate(capacity: 1)
+        luaL_buffinit(L.state, buffer)
+        if capacity > 0 {
+            reserve(capacity)
+        }
+    }
+    
+    /// The number of bytes appended so far.
+    @inlinable
+    public var count: Int {
+        return buffer.pointee.n
+    }
+    
+    /// Grows the buffer to hold at least `capacity` bytes in total, so appending up to that size reallocates nothing. A hint for large outputs: without it the buffer grows by half each time it fills up, copying its bytes.
+    @inlinable
+    public func reserve(_ capacity: Int) {
+        let n = buffer.pointee.n
+        if capacity > n {
+            _ = luaL_prepbuffsize(buffer, capacity - n)
+        }
+    }
+    
+    /// Appends raw bytes, which can contain embedded zeros.
+    @inlinable
+    @inline(__always)
+    public func append(_ bytes: UnsafeRawBufferPointer) {
+        luaL_addlstring(buffer, bytes.baseAddress?.assumingMemoryBound(to: CChar.self), bytes.count)
+    }
+    
+    @inlinable
+    @inline(__always)
+    public func append(_ bytes: [UInt8]) {
+        bytes.withUnsafeBytes { bytes in
+            append(bytes)
+        }
+    }
+    
+    /// Appends the UTF-8 bytes of the string.
+    @inlinable
+    @inline(__always)
+    public func append(_ s: String) {
+        var s = s
+        s.withUTF8 { utf8 in
+            append(UnsafeRawBufferPointer(utf8))
+        }
+    }
+    
+    /// Appends one byte, like `luaL_addchar`.
+    @inlinable
+    @inline(__always)
+    public func append(byte: UInt8) {
+        if buffer.pointee.n >= buffer.pointee.size {
+            _ = luaL_prepbuffsize(buffer, 1)
+        }
+        buffer.pointee.b[buffer.pointee.n] = CChar(bitPattern: byte)
+        buffer.pointee.n += 1
+    }
+    
+    /// Appends the decimal numeral of an integer, as `tostring` would write it.
+    @inlinable
+    @inline(__always)
+    public func append(_ n: Int) {
+        luaL_addinteger(buffer, lua_Integer(n))
+    }
+    
+    /// Appends a float as `tostring` would write it (`%.14g`, with `.0` added to integral values).
+    @inlinable
+    @inline(__always)
+    public func append(_ n: Double) {
+        luaL_addnumber(buffer, n)
+    }
+    
+    /// Lets `body` write up to `count` bytes straight into the buffer and appends the number of bytes it returns.
+    @inlinable
+    public func append(reserving count: Int, _ body: (UnsafeMutableRawBufferPointer) throws -> Int) rethrows {
+        let p = luaL_prepbuffsize(buffer, count)
+        let written = try body(UnsafeMutableRawBufferPointer(start: p, count: count))
+        precondition(written >= 0 && written <= count, "LuaStringBuilder: wrote more bytes than reserved")
+        buffer.pointee.n += written
+    }
+    
+    /// Pops the string or number on the top of the stack, above the builder's slot, and appends it.
+    @inlinable
+    @inline(__always)
+    public func appendValue() {
+        luaL_addvalue(buffer)
+    }
+    
+    /// Pushes the string built, in place of the builder's slot.
+    @inlinable
+    public consuming func finish() {
+        luaL_pushresult(buffer)
+    }
+    
+    deinit {
+        buffer.deallocate()
+    }
+}
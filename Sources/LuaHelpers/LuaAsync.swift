@@ -0,0 +1,112 @@
+import CLua
+import Lua
+
+/// A Swift `async` function callable from Lua (see `LuaState.pushAsyncFunction(_:)`). It receives the Lua arguments and returns the Lua results as values which are not associated with the VM, so the state is free while it is suspended. A thrown error is raised in Lua as a string.
+@available(macOS 10.15, iOS 13.0, watchOS 6.0, tvOS 13.0, *)
+public typealias LuaAsyncFunction = @Sendable ([Value]) async throws -> [Value]
+
+@available(macOS 10.15, iOS 13.0, watchOS 6.0, tvOS 13.0, *)
+final class LuaAsyncFunctionBox {
+    let function: LuaAsyncFunction
+    
+    init(_ function: @escaping LuaAsyncFunction) {
+        self.function = function
+    }
+}
+
+/// What a coroutine yields to `resumeAwaiting` when it calls an async function.
+@available(macOS 10.15, iOS 13.0, watchOS 6.0, tvOS 13.0, *)
+final class LuaAwaitRequest {
+    let function: LuaAsyncFunction
+    let arguments: [Value]
+    
+    init(function: @escaping LuaAsyncFunction, arguments: [Value]) {
+        self.function = function
+        self.arguments = arguments
+    }
+}
+
+@available(macOS 10.15, iOS 13.0, watchOS 6.0, tvOS 13.0, *)
+extension LuaState {
+    
+    /// Pushes a Lua function which calls `function`. Called from a coroutine run by `resumeAwaiting(from:nargs:nresults:)` (or `callAwaiting(nargs:)`), it yields the coroutine with `lua_yieldk`; `resumeAwaiting` then awaits `function` and resumes the coroutine with its results, which the Lua call returns. No thread is blocked while the function is suspended.
+    ///
+    /// Calling it where the coroutine cannot yield (the main thread, or across a C call without a continuation) raises an error. A coroutine started with Lua's `coroutine.resume` passes the await to its Lua resumer rather than to Swift, so the function is not run there.
+    public func pushAsyncFunction(_ function: @escaping LuaAsyncFunction) {
+        self.pushSwiftObject(LuaAsyncFunctionBox(function))
+        self.pushCClosure({ L in
+            guard lua_isyieldable(L.state) != 0 else {
+                L.pushString("attempt to call an async function outside of an awaiting coroutine")
+                L.error()
+            }
+            // Yielding longjmps over this frame, so everything reference counted happens in a call that returns first
+            L.pushAwaitRequest()
+            L.yieldk(nresults: 1) { L, _, _ in
+                guard L.toBoolean(1) else {
+                    L.error()
+                }
+                return L.getTop() - 1
+            }
+        }, n: 1)
+    }
+    
+    /// Sets the global `name` to a Lua function calling `function` (see `pushAsyncFunction(_:)`).
+    public func registerAsyncFunction(_ name: String, _ function: @escaping LuaAsyncFunction) {
+        self.pushAsyncFunction(function)
+        self.setGlobal(name)
+    }
+    
+    /// Replaces the arguments of the running async function with the request `resumeAwaiting` picks up.
+    @inline(never)
+    func pushAwaitRequest() {
+        let box = self.toSwiftObject(lua_upvalueindex(1)) as! LuaAsyncFunctionBox
+        let top = self.getTop()
+        var arguments: [Value] = []
+        arguments.reserveCapacity(Int(top))
+        for i in stride(from: 1, through: top, by: 1) {
+            arguments.append(self.toValue(i) ?? .luaNil)
+        }
+        self.setTop(0)
+        self.pushSwiftObject(LuaAwaitRequest(function: box.function, arguments: arguments))
+    }
+    
+    /// Resumes this coroutine like `resume(from:nargs:nresults:)`, and whenever it yields because it called an async function (see `pushAsyncFunction(_:)`), awaits that function and resumes the coroutine with its results. Returns once the coroutine finishes, fails, or yields for any other reason.
+    ///
+    /// The state must not be used by anything else until this returns; drive each state from one task at a time.
+    public func resumeAwaiting(from: LuaState? = nil, nargs: Int32, nresults: inout Int32) async -> LuaThreadStatus {
+        var status = self.resume(from: from, nargs: nargs, nresults: &nresults)
+        while status == .LUA_YIELD, nresults == 1, let request = self.toSwiftObject(-1) as? LuaAwaitRequest {
+            self.pop()
+            var resumeArgs: Int32
+            do {
+                let results = try await request.function(request.arguments)
+                _ = self.checkStack(Int32(results.count) + 1)
+                self.pushBoolean(true)
+                for result in results {
+                    self.pushValue(result)
+                }
+                resumeArgs = Int32(results.count) + 1
+            } catch {
+                self.pushBoolean(false)
+                self.pushString(String(describing: error))
+                resumeArgs = 2
+            }
+            status = self.resume(from: from, nargs: resumeArgs, nresults: &nresults)
+        }
+        return status
+    }
+    
+    /// Calls the function below the `nargs` values on top of the stack in a new coroutine, awaiting the async functions it calls (see `resumeAwaiting(from:nargs:nresults:)`). The function and its arguments are replaced by all of its results, or by the error object. Like `pcall`, errors are returned as a status; a plain `coroutine.yield` returns `.LUA_YIELD` with the yielded values.
+    public func callAwaiting(nargs: Int32) async -> LuaThreadStatus {
+        let thread = self.newThread()
+        self.insert(-(nargs + 2))
+        self.xmove(to: thread, n: nargs + 1)
+        var nresults: Int32 = 0
+        let status = await thread.resumeAwaiting(from: self, nargs: nargs, nresults: &nresults)
+        let n = status == .LUA_OK || status == .LUA_YIELD ? nresults : 1
+        _ = self.checkStack(n)
+        thread.xmove(to: self, n: n)
+        self.remove(-(n + 1))
+        return status
+    }
+}
@@ -0,0 +1,275 @@
+import CLua
+import Lua
+import Foundation
+
+/// Caches the bytecode of compiled chunks so that loading the same script again skips the lexer, parser and code generator.
+///
+/// Bytecode produced by `lua_dumpaligned` is kept in memory, keyed by a SHA-256 digest of the chunk name and source, the Lua version, the bytecode format and the sizes of `lua_Integer` and `lua_Number`; a hit also compares the name and source kept with it. Nothing is evicted: the bytecode and source of every chunk loaded stay in memory until `clear()`. When a directory is given, the bytecode is also kept in one file per chunk, named after the same digest; later loads (also by other caches and processes) map it with `mmap` and use it in place (see `LuaState.loadMappedFile(path:name:)`) instead of compiling. Lua does not verify bytecode, so only trusted code must be able to write to the directory. A cache can be shared by many states and threads.
+public final class LuaBytecodeCache: @unchecked Sendable {
+    
+    /// How loads were served.
+    public struct Statistics: Sendable, Equatable {
+        /// Loads served from memory.
+        public var memoryHits = 0
+        /// Loads served from a file in the directory.
+        public var diskHits = 0
+        /// Loads which compiled the source.
+        public var misses = 0
+        
+        public var hits: Int {
+            memoryHits + diskHits
+        }
+    }
+    
+    struct Entry {
+        let name: String
+        let source: String
+        let bytecode: [UInt8]
+    }
+    
+    /// Where bytecode is stored across processes, if anywhere.
+    public let directory: URL?
+    /// Whether debug information (line numbers, local names) is left out of cached bytecode.
+    public let strip: Bool
+    
+    private let lock = NSLock()
+    private var entries: [[UInt8]: Entry] = [:]
+    private var stats = Statistics()
+    
+    /// Creates a cache, creating `directory` if needed. A directory which cannot be used only costs the disk tier.
+    public init(directory: URL? = nil, strip: Bool = false) {
+        self.directory = directory
+        self.strip = strip
+        if let directory {
+            try? FileManager.default.createDirectory(at: directory, withIntermediateDirectories: true)
+        }
+    }
+    
+    public var statistics: Statistics {
+        lock.lock()
+        defer { lock.unlock() }
+        return stats
+    }
+    
+    /// Drops the bytecode kept in memory and resets the statistics. Files in the directory are kept.
+    public func clear() {
+        lock.lock()
+        defer { lock.unlock() }
+        entries.removeAll()
+        stats = Statistics()
+    }
+    
+    /// Loads `source` like `LuaState.loadBufferX(buffer:name:mode:)`, from the cache when possible. Only chunks which compile are cached; failures push the error message as usual.
+    public func load(_ L: LuaState, source: String, name: String, mode: String = "bt") -> LuaThreadStatus {
+        let digest = LuaBytecodeCache.digest(source: source, name: name, strip: strip)
+        lock.lock()
+        let cached = entries[digest]
+        lock.unlock()
+        if let cached, cached.name == name, cached.source == source {
+            let status = cached.bytecode.withUnsafeBytes { L.loadBufferX(bytes: $0, name: name, mode: "b") }
+            if status == .LUA_OK {
+                count(\.memoryHits)
+                return status
+            }
+            L.pop()
+        }
+        let fileName = directory.map { _ in LuaBytecodeCache.fileName(digest: digest) }
+        if let directory, let fileName {
+            let url = directory.appendingPathComponent(fileName)
+            if let status = L.loadMappedFile(path: url.path, name: name) {
+                if status == .LUA_OK {
+                    count(\.diskHits)
+                    if let bytecode = L.dumpToBytes(strip: strip, aligned: true) {
+                        store(Entry(name: name, source: source, bytecode: bytecode), digest: digest)
+                    }
+                    return status
+                }
+                L.pop()
+                try? FileManager.default.removeItem(at: url)
+            }
+        }
+        count(\.misses)
+        let status = L.loadBufferX(buffer: source, name: name, mode: mode)
+        guard status == .LUA_OK, let bytecode = L.dumpToBytes(strip: strip, aligned: true) else {
+            return status
+        }
+        store(Entry(name: name, source: source, bytecode: bytecode), digest: digest)
+        if let directory, let fileName {
+            try? Data(bytecode).write(to: directory.appendingPathComponent(fileName), options: .atomic)
+        }
+        return status
+    }
+    
+    private func store(_ entry: Entry, digest: [UInt8]) {
+        lock.lock()
+        entries[digest] = entry
+        lock.unlock()
+    }
+    
+    private func count(_ counter: WritableKeyPath<Statistics, Int>) {
+        lock.lock()
+        stats[keyPath: counter] += 1
+        lock.unlock()
+    }
+    
+    /// The SHA-256 digest of everything that decides which bytecode `source` compiles to.
+    static func digest(source: String, name: String, strip: Bool) -> [UInt8] {
+        var digest = LuaSHA256()
+        var name = name
+        var source = source
+        name.withUTF8 { utf8 in
+            withUnsafeBytes(of: (Int32(LUA_VERSION_NUM), Int32(LUAC_FORMAT_ALIGNED), MemoryLayout<lua_Integer>.size, MemoryLayout<lua_Number>.size, utf8.count, strip)) { digest.update($0) }
+            digest.update(UnsafeRawBufferPointer(utf8))
+        }
+        source.withUTF8 { utf8 in
+            digest.update(UnsafeRawBufferPointer(utf8))
+        }
+        return digest.finalize()
+    }
+    
+    /// The hex digest with the extension of binary chunks.
+    static func fileName(digest: [UInt8]) -> String {
+        return digest.map { byte in
+            (byte < 16 ? "0" : "") + String(byte, radix: 16)
+        }.joined() + ".luac"
+    }
+}
+
+/// SHA-256 (FIPS 180-4), which Foundation does not provide on every platform.
+struct LuaSHA256 {
+    private static let k: [UInt32] = [
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+    ]
+    
+    private var h: [UInt32] = [0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19]
+    /// Bytes of an incomplete block.
+    private var pending: [UInt8] = []
+    private var length: UInt64 = 0
+    
+    mutating func update(_ bytes: UnsafeRawBufferPointer) {
+        length += UInt64(bytes.count)
+        var rest = bytes[...]
+        if !pending.isEmpty {
+            let n = min(64 - pending.count, rest.count)
+            pending.append(contentsOf: rest.prefix(n))
+            rest = rest.dropFirst(n)
+            guard pending.count == 64 else {
+                return
+            }
+            let block = pending
+            pending.removeAll(keepingCapacity: true)
+            block.withUnsafeBytes { compress($0) }
+        }
+        while rest.count >= 64 {
+            compress(UnsafeRawBufferPointer(rebasing: rest.prefix(64)))
+            rest = rest.dropFirst(64)
+        }
+        pending.append(contentsOf: rest)
+    }
+    
+    /// Pads the message and returns its 32-byte digest.
+    mutating func finalize() -> [UInt8] {
+        let bits = length &* 8
+        var tail: [UInt8] = [0x80] + [UInt8](repeating: 0, count: (119 - Int(length % 64)) % 64)
+        for shift in stride(from: 56, through: 0, by: -8) {
+            tail.append(UInt8(truncatingIfNeeded: bits >> UInt64(shift)))
+        }
+        tail.withUnsafeBytes { update($0) }
+        return h.flatMap { word in
+            [UInt8(truncatingIfNeeded: word >> 24), UInt8(truncatingIfNeeded: word >> 16), UInt8(truncatingIfNeeded: word >> 8), UInt8(truncatingIfNeeded: word)]
+        }
+    }
+    
+    private static func rotr(_ x: UInt32, _ n: UInt32) -> UInt32 {
+        return (x >> n) | (x << (32 - n))
+    }
+    
+    private mutating func compress(_ block: UnsafeRawBufferPointer) {
+        var w = [UInt32](repeating: 0, count: 64)
+        for i in 0..<16 {
+            w[i] = UInt32(block[i * 4]) << 24 | UInt32(block[i * 4 + 1]) << 16 | UInt32(block[i * 4 + 2]) << 8 | UInt32(block[i * 4 + 3])
+        }
+        for i in 16..<64 {
+            let s0 = LuaSHA256.rotr(w[i - 15], 7) ^ LuaSHA256.rotr(w[i - 15], 18) ^ (w[i - 15] >> 3)
+            let s1 = LuaSHA256.rotr(w[i - 2], 17) ^ LuaSHA256.rotr(w[i - 2], 19) ^ (w[i - 2] >> 10)
+            w[i] = w[i - 16] &+ s0 &+ w[i - 7] &+ s1
+        }
+        var a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], hh = h[7]
+        for i in 0..<64 {
+            let s1 = LuaSHA256.rotr(e, 6) ^ LuaSHA256.rotr(e, 11) ^ LuaSHA256.rotr(e, 25)
+            let ch = (e & f) ^ (~e & g)
+            let t1 = hh &+ s1 &+ ch &+ LuaSHA256.k[i] &+ w[i]
+            let s0 = LuaSHA256.rotr(a, 2) ^ LuaSHA256.rotr(a, 13) ^ LuaSHA256.rotr(a, 22)
+            let maj = (a & b) ^ (a & c) ^ (b & c)
+            let t2 = s0 &+ maj
+            hh = g
+            g = f
+            f = e
+            e = d &+ t1
+            d = c
+            c = b
+            b = a
+            a = t1 &+ t2
+        }
+        h[0] = h[0] &+ a
+        h[1] = h[1] &+ b
+        h[2] = h[2] &+ c
+        h[3] = h[3] &+ d
+        h[4] = h[4] &+ e
+        h[5] = h[5] &+ f
+        h[6] = h[6] &+ g
+        h[7] = h[7] &+ hh
+    }
+}
+
+extension LuaState {
+    
+    /// Dumps the Lua function on the top of the stack (see `dump(writer:data:strip:)`, or `dumpAligned(writer:data:strip:)` when `aligned`) and returns the binary chunk, or nil if it is not a Lua function. The function is not popped.
+    public func dumpToBytes(strip: Bool = false, aligned: Bool = false) -> [UInt8]? {
+        var bytes: [UInt8] = []
+        let writer: lua_Writer = { _, p, size, ud in
+            if let p {
+                ud!.assumingMemoryBound(to: [UInt8].self).pointee.append(contentsOf: UnsafeRawBufferPointer(start: p, count: size))
+            }
+            return 0
+        }
+        let status = withUnsafeMutablePointer(to: &bytes) { bytes in
+            aligned
+                ? self.dumpAligned(writer: writer, data: UnsafeMutableRawPointer(bytes), strip: strip)
+                : self.dump(writer: writer, data: UnsafeMutableRawPointer(bytes), strip: strip)
+        }
+        return status == 0 ? bytes : nil
+    }
+    
+    /// Maps the binary chunk in the file at `path` read-only and loads it in place (see `loadMapped(bytes:name:release:ud:)`): the code and line information of its functions stay in the mapping, whose pages the system shares with every process mapping the same file. The mapping is removed once no function uses it. Returns nil if the file cannot be mapped.
+    public func loadMappedFile(path: String, name: String) -> LuaThreadStatus? {
+        let fd = open(path, O_RDONLY)
+        guard fd >= 0 else {
+            return nil
+        }
+        defer { _ = Foundation.close(fd) }
+        var info = stat()
+        guard fstat(fd, &info) == 0, info.st_size > 0 else {
+            return nil
+        }
+        let size = Int(info.st_size)
+        guard let mapping = mmap(nil, size, PROT_READ, MAP_PRIVATE, fd, 0), mapping != MAP_FAILED else {
+            return nil
+        }
+        return self.loadMapped(bytes: UnsafeRawBufferPointer(start: mapping, count: size), name: name, release: { _, p, size in
+            _ = munmap(UnsafeMutableRawPointer(mutating: p), size)
+        })
+    }
+    
+    /// Loads `buffer` as a Lua chunk through `cache` (see `LuaBytecodeCache.load(_:source:name:mode:)`).
+    public func loadBufferX(buffer: String, name: String, mode: String = "bt", cache: LuaBytecodeCache) -> LuaThreadStatus {
+        return cache.load(self, source: buffer, name: name, mode: mode)
+    }
+}
@@ -197,6 +197,13 @@ extension LuaState {
         self.pushLuaCFunction(unsafeBitCast(f, to: lua_CFunction.self))
     }
     
+    /// Pushes a C closure with the n values on the top of the stack as its upvalues (see `pushCFunction`).
+    @inlinable
+    @inline(__always)
+    public func pushCClosure(_ f: @convention(thin) (LuaState) -> Int32, n: Int32) {
+        self.pushLuaCClosure(unsafeBitCast(f, to: lua_CFunction.self), n: n)
+    }
+    
     @inlinable
     @inline(__always)
     public func yieldk(nresults: Int32, ctx: lua_KContext = 0, k: @convention(thin) (LuaState, LuaThreadStatus, lua_KContext) -> Int32) -> Never {
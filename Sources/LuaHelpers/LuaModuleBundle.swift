@@ -0,0 +1,74 @@
+import CLua
+import Lua
+import Foundation
+
+extension LuaState {
+    
+    /// Builds a module bundle (see `writeBundle(_:writer:data:compress:)`) from `modules`, mapping module names to sources. With `precompile` the modules are stored as aligned bytecode, which `require` loads in place without compiling; otherwise as sources. Returns nil, leaving the error message on the stack, if a module does not compile.
+    public func makeBundle(modules: [String: String], precompile: Bool = true, strip: Bool = false, compress: Bool = false) -> [UInt8]? {
+        newTable()
+        for (name, source) in modules {
+            if precompile {
+                guard loadBufferX(buffer: source, name: "@" + name) == .LUA_OK else {
+                    remove(-2)
+                    return nil
+                }
+                let bytecode = dumpToBytes(strip: strip, aligned: true)
+                pop()
+                guard let bytecode else {
+                    pop()
+                    pushString("cannot dump module '\(name)'")
+                    return nil
+                }
+                pushLString(bytecode)
+            } else {
+                pushLString(source)
+            }
+            setField(-2, key: name)
+        }
+        var bytes: [UInt8] = []
+        let status = withUnsafeMutablePointer(to: &bytes) { bytes in
+            writeBundle(-1, writer: { _, p, size, ud in
+                if let p {
+                    ud!.assumingMemoryBound(to: [UInt8].self).pointee.append(contentsOf: UnsafeRawBufferPointer(start: p, count: size))
+                }
+                return 0
+            }, data: UnsafeMutableRawPointer(bytes), compress: compress)
+        }
+        guard status == 0 else {
+            remove(-2)
+            return nil
+        }
+        pop()
+        return bytes
+    }
+    
+    /// Maps the bundle file at `path` read-only and appends it to `package.bundles`, so `require` finds its modules with a lookup in its table of contents instead of searching `package.path`. Binary chunks stored uncompressed are used in place, sharing the mapping's pages. Returns `.LUA_OK`, or an error status with the message on the stack.
+    public func addBundle(path: String) -> LuaThreadStatus {
+        let status = openMappedBundle(path: path) ?? openBundle(path: path)
+        if status == .LUA_OK {
+            addBundle()
+        }
+        return status
+    }
+    
+    /// Pushes a bundle userdata for the file at `path` mapped read-only, or returns nil, pushing nothing, if it cannot be mapped.
+    private func openMappedBundle(path: String) -> LuaThreadStatus? {
+        let fd = open(path, O_RDONLY)
+        guard fd >= 0 else {
+            return nil
+        }
+        defer { _ = Foundation.close(fd) }
+        var info = stat()
+        guard fstat(fd, &info) == 0, info.st_size > 0 else {
+            return nil
+        }
+        let size = Int(info.st_size)
+        guard let mapping = mmap(nil, size, PROT_READ, MAP_PRIVATE, fd, 0), mapping != MAP_FAILED else {
+            return nil
+        }
+        return openBundle(bytes: UnsafeRawBufferPointer(start: mapping, count: size), name: path, release: { _, p, size in
+            _ = munmap(UnsafeMutableRawPointer(mutating: p), size)
+        })
+    }
+}
@@ -0,0 +1,68 @@
+import CLua
+import Lua
+import Foundation
+
+/// A chunk compiled by `LuaState.compileInParallel(_:threads:strip:)`.
+public struct LuaCompiledChunk: Sendable {
+    /// The name the chunk was compiled with.
+    public let name: String
+    /// The bytecode of the chunk, in `LUAC_FORMAT_ALIGNED` (see `LuaState.dumpAligned(writer:data:strip:)`), or nil if it did not compile.
+    public let bytecode: [UInt8]?
+    /// The error message of a chunk that did not compile.
+    public let error: String?
+}
+
+extension LuaState {
+    
+    /// Compiles `chunks` (name and source) on up to `threads` worker threads and returns them in the same order. Each worker compiles with a private scratch state, so the parser, which is tied to one state, runs in parallel. Compiling does not depend on the state, so the bytecode behaves as if the source had been loaded by the state that loads it (see `load(_:)`).
+    public static func compileInParallel(_ chunks: [(name: String, source: String)], threads: Int = ProcessInfo.processInfo.activeProcessorCount, strip: Bool = false) -> [LuaCompiledChunk] {
+        guard !chunks.isEmpty else {
+            return []
+        }
+        let results = UnsafeMutableBufferPointer<LuaCompiledChunk?>.allocate(capacity: chunks.count)
+        results.initialize(repeating: nil)
+        let next = UnsafeMutablePointer<Int>.allocate(capacity: 1)
+        next.initialize(to: 0)
+        defer {
+            results.deinitialize()
+            results.deallocate()
+            next.deallocate()
+        }
+        let lock = NSLock()
+        DispatchQueue.concurrentPerform(iterations: max(1, min(threads, chunks.count))) { _ in
+            let L = LuaState.newLuaState()
+            defer { L.close() }
+            while true {
+                lock.lock()
+                let i = next.pointee
+                next.pointee += 1
+                lock.unlock()
+                guard i < chunks.count else {
+                    return
+                }
+                results[i] = L.compile(chunks[i].source, name: chunks[i].name, strip: strip)
+            }
+        }
+        return results.map { $0! }
+    }
+    
+    /// Compiles `source` to bytecode without running it, leaving the stack as it was.
+    public func compile(_ source: String, name: String, strip: Bool = false) -> LuaCompiledChunk {
+        defer { pop() }
+        guard loadBufferX(buffer: source, name: name, mode: "t") == .LUA_OK else {
+            return LuaCompiledChunk(name: name, bytecode: nil, error: toString() ?? "")
+        }
+        return LuaCompiledChunk(name: name, bytecode: dumpToBytes(strip: strip, aligned: true), error: nil)
+    }
+    
+    /// Loads a compiled chunk, pushing its function, or its error message if it did not compile.
+    public func load(_ chunk: LuaCompiledChunk) -> LuaThreadStatus {
+        guard let bytecode = chunk.bytecode else {
+            pushString(chunk.error ?? "cannot compile \(chunk.name)")
+            return .LUA_ERRSYNTAX
+        }
+        return bytecode.withUnsafeBytes { bytes in
+            loadBufferX(bytes: bytes, name: chunk.name, mode: "b")
+        }
+    }
+}
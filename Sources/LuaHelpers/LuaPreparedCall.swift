@@ -0,0 +1,124 @@
+import CLua
+import Lua
+
+/// Calls the same Lua function many times from Swift. The function is pinned at the bottom of a thread of its own, created once along with the stack space for the arguments and results, so a call pushes the function and its arguments, runs `lua_pcall` on that thread and leaves the results there to read in place: no registry lookups, no `Value` or `LuaValue` conversions, and nothing allocated for scalar arguments and results.
+///
+/// ```swift
+/// let update = LuaPreparedCall(L, nargs: 2, nresults: 1)  // pops the function
+/// for entity in entities {
+///     guard update.call(entity.id, dt) == .LUA_OK else { ... }
+///     entity.speed = update.result(0, as: lua_Number.self) ?? 0
+/// }
+/// ```
+///
+/// Results stay valid until the next call. On an error the error object is result 0 (see `errorMessage`). The prepared call lives until `close()` or until the state is closed. Like the state, it must be used from one thread at a time.
+public struct LuaPreparedCall: @unchecked Sendable {
+    
+    /// The state the call was prepared in.
+    public let luaState: LuaState
+    /// The thread the function runs on, with the function at index 1 and the results of the last call above it.
+    public let thread: LuaState
+    /// The number of arguments stack space was reserved for, or -1.
+    public let nargs: Int32
+    /// The number of results kept, or `LUA_MULTRET` for all of them.
+    public let nresults: Int32
+    @usableFromInline
+    let ref: Int32
+    
+    /// Prepares calls to the function on the top of the stack of `L`, which is popped. `nargs` and `nresults` are only used to reserve stack space, pass -1 if unknown.
+    public init(_ L: LuaState, nargs: Int32 = -1, nresults: Int32 = LUA_MULTRET) {
+        self.luaState = L
+        self.nargs = nargs
+        self.nresults = nresults
+        self.thread = L.newThread()
+        self.ref = L.ref()
+        L.xmove(to: thread, n: 1)
+        _ = thread.checkStack(1 + max(nargs, 0) + max(nresults, 0) + LUA_MINSTACK)
+    }
+    
+    /// Drops the results of the last call and pushes the function, ready for its arguments to be pushed to `thread` (see `push(_:)`), for callers that push arguments themselves before calling `invoke()`.
+    @inlinable
+    @inline(__always)
+    public func begin() {
+        thread.setTop(1)
+        thread.pushValue(copiedFromIdx: 1)
+    }
+    
+    /// Pushes an argument after `begin()`.
+    @inlinable
+    @inline(__always)
+    public func push<A: LuaPushable>(_ argument: A) {
+        argument.push(to: thread)
+    }
+    
+    /// Calls the function with the arguments pushed since `begin()`.
+    @inlinable
+    @inline(__always)
+    @discardableResult
+    public func invoke() -> LuaThreadStatus {
+        return thread.pcall(nargs: thread.getTop() - 2, nresults: nresults)
+    }
+    
+    /// Calls the function with `arguments`.
+    @inlinable
+    @inline(__always)
+    @discardableResult
+    public func call<each A: LuaPushable>(_ arguments: repeat each A) -> LuaThreadStatus {
+        begin()
+        repeat (each arguments).push(to: thread)
+        return invoke()
+    }
+    
+    /// The number of results of the last call, or 1 after an error.
+    @inlinable
+    @inline(__always)
+    public var resultCount: Int32 {
+        return thread.getTop() - 1
+    }
+    
+    /// Returns result `i` of the last call, counting from 0, or nil if there is no such result or it has another type.
+    @inlinable
+    @inline(__always)
+    public func result<R: LuaReadable>(_ i: Int32 = 0, as type: R.Type = R.self) -> R? {
+        guard i >= 0, i < resultCount else {
+            return nil
+        }
+        return R.read(from: thread, at: i + 2)
+    }
+    
+    /// Calls `body` with the bytes of string result `i` without copying them (see `LuaState.withUnsafeLString(_:_:)`). They are only valid inside `body`.
+    @inlinable
+    @inline(__always)
+    public func withUnsafeResultString<R>(_ i: Int32 = 0, _ body: (UnsafeRawBufferPointer) throws -> R) rethrows -> R? {
+        guard i >= 0, i < resultCount, thread.type(i + 2) == .LUA_TSTRING else {
+            return nil
+        }
+        return try thread.withUnsafeLString(i + 2, body)
+    }
+    
+    /// Pushes result `i` of the last call onto the stack of `L`, a thread of the same state (by default the one the call was prepared in), for results that are not scalars. Pushes nil if there is no such result.
+    @inlinable
+    @inline(__always)
+    public func pushResult(_ i: Int32 = 0, to L: LuaState? = nil) {
+        guard i >= 0, i < resultCount else {
+            (L ?? luaState).pushNil()
+            return
+        }
+        thread.pushValue(copiedFromIdx: i + 2)
+        thread.xmove(to: L ?? luaState, n: 1)
+    }
+    
+    /// After a failed call, its error object if it is a string (or a number).
+    public var errorMessage: String? {
+        guard resultCount >= 1 else {
+            return nil
+        }
+        return thread.toString(2)
+    }
+    
+    /// Releases the thread and the function, which must not be used afterwards.
+    public func close() {
+        thread.setTop(0)
+        luaState.unref(ref: ref)
+    }
+}
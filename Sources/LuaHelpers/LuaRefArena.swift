@@ -0,0 +1,122 @@
+import CLua
+import Lua
+
+/// A reference to a value kept by a `LuaRefArena`. It goes stale when released, and the arena detects any later use.
+public struct LuaArenaRef: Sendable, Hashable {
+    /// The slot of the value in the arena.
+    public let index: Int32
+    /// The generation of the slot when the reference was created.
+    public let generation: UInt32
+}
+
+/// Counters of a `LuaRefArena` (see `LuaRefArena.stats`).
+public struct LuaRefArenaStats: Sendable, Equatable {
+    /// References not released yet.
+    public let live: Int
+    /// The highest number of live references.
+    public let peak: Int
+    /// References created.
+    public let created: Int
+    /// References released, one by one or by scopes.
+    public let released: Int
+    /// Uses of released references.
+    public let stale: Int
+    
+    @inlinable
+    public init(_ stats: lua_RefArenaStats) {
+        self.live = stats.live
+        self.peak = stats.peak
+        self.created = stats.created
+        self.released = stats.released
+        self.stale = stats.stale
+    }
+}
+
+/// Keeps Lua values alive for Swift, like `UnsafeLuaRef`, without going through the registry. The values live in a table of the arena that is written in place, free slots are reused from a stack, and each reference carries a generation, so pushing or releasing a reference after it was released is caught (and counted) instead of reaching whatever took its slot. References created inside `withScope(_:)` are released together when it returns.
+///
+/// The arena lives until `close()` or until the state is closed, which releases its references.
+public struct LuaRefArena: @unchecked Sendable {
+    
+    @usableFromInline
+    let arena: OpaquePointer
+    public let luaState: LuaState
+    
+    /// Creates an arena with room for `capacity` references before it grows.
+    @inlinable
+    public init(_ L: LuaState, capacity: Int = 256) {
+        self.luaState = L
+        self.arena = lua_newrefarena(L.state, Int32(clamping: capacity))
+    }
+    
+    /// Returns a reference to the value at the given index, which stays on the stack.
+    @inlinable
+    @inline(__always)
+    public func ref(_ idx: Int32 = -1) -> LuaArenaRef {
+        luaState.pushValue(copiedFromIdx: idx)
+        return refPopping()
+    }
+    
+    /// Pops the value on the top of the stack and returns a reference to it.
+    @inlinable
+    @inline(__always)
+    public func refPopping() -> LuaArenaRef {
+        var generation: UInt32 = 0
+        let index = lua_arenaref(luaState.state, arena, &generation)
+        return LuaArenaRef(index: index, generation: generation)
+    }
+    
+    /// Pushes the value of a reference onto the stack of `L` (a thread of the arena's state, by default the one it was created with) and returns its type. A released reference pushes nil and returns `.LUA_TNONE`.
+    @inlinable
+    @inline(__always)
+    @discardableResult
+    public func push(_ ref: LuaArenaRef, to L: LuaState? = nil) -> LuaType {
+        return LuaType(rawValue: lua_arenapush((L ?? luaState).state, arena, ref.index, ref.generation))
+    }
+    
+    /// Returns a new reference to the value of `ref`, or nil if `ref` was released.
+    @inlinable
+    @inline(__always)
+    public func copy(_ ref: LuaArenaRef) -> LuaArenaRef? {
+        guard push(ref) != .LUA_TNONE else {
+            luaState.pop()
+            return nil
+        }
+        return refPopping()
+    }
+    
+    /// Releases a reference, so its value can be collected. Returns false if it was already released.
+    @inlinable
+    @inline(__always)
+    @discardableResult
+    public func unref(_ ref: LuaArenaRef) -> Bool {
+        return lua_arenaunref(luaState.state, arena, ref.index, ref.generation) != 0
+    }
+    
+    /// Runs `body` and then releases every reference it created that is still live, also when it throws. Scopes nest. To keep a value past the scope, leave it on the stack and take a new reference after the scope returns.
+    @inlinable
+    public func withScope<R>(_ body: () throws -> R) rethrows -> R {
+        let mark = lua_arenaopenscope(luaState.state, arena)
+        defer { lua_arenaclosescope(luaState.state, arena, mark) }
+        return try body()
+    }
+    
+    /// The counters of the arena.
+    @inlinable
+    public var stats: LuaRefArenaStats {
+        var stats = lua_RefArenaStats()
+        lua_arenastats(arena, &stats)
+        return LuaRefArenaStats(stats)
+    }
+    
+    /// The number of references not released yet.
+    @inlinable
+    public var liveCount: Int {
+        return stats.live
+    }
+    
+    /// Releases every reference and frees the arena, which must not be used afterwards.
+    @inlinable
+    public func close() {
+        lua_closerefarena(luaState.state, arena)
+    }
+}
@@ -0,0 +1,230 @@
+import CLua
+import Lua
+import Foundation
+
+/// Runs the coroutines of many independent states across worker threads.
+///
+/// A state is not thread safe (`lua_lock` is a no-op), so the scheduler pins each state to one worker at a time: the unit of work is a state together with its runnable coroutines. Every worker owns a deque of states. It takes the state at the bottom of its deque, resumes that state's next coroutine until it yields or finishes, and pushes the state back while it still has coroutines to run. A worker whose deque runs dry steals a state from the top of another worker's deque.
+///
+/// Coroutines hand control back with `coroutine.yield()`, or when their instruction budget runs out (see `LuaState.setInstructionBudget(_:quantum:onExhausted:)` with `.yield`). Values yielded to the scheduler are dropped, and the coroutine is resumed with no arguments.
+public final class LuaScheduler: @unchecked Sendable {
+    
+    /// Called on a worker when a coroutine finishes, with its state pinned to that worker. On `.LUA_OK` the results of the coroutine are on the stack of `thread`, otherwise the error object is.
+    public typealias Completion = @Sendable (_ state: LuaState, _ thread: LuaState, _ status: LuaThreadStatus) -> Void
+    
+    /// Counters of one call to `run(onCompletion:)`.
+    public struct Statistics: Sendable {
+        /// Calls to `lua_resume`.
+        public var resumes = 0
+        /// States taken from another worker's deque.
+        public var steals = 0
+        /// Coroutines that finished, successfully or not.
+        public var completed = 0
+    }
+    
+    public let workerCount: Int
+    
+    private var states: [UnsafeMutablePointer<lua_State>: LuaScheduledState] = [:]
+    private var order: [LuaScheduledState] = []
+    private var deques: [LuaWorkDeque] = []
+    private let idle = NSCondition()
+    private var remaining = 0
+    private var waiting = 0
+    
+    public init(workerCount: Int = ProcessInfo.processInfo.activeProcessorCount) {
+        self.workerCount = max(workerCount, 1)
+    }
+    
+    /// Creates a coroutine in `state` that runs the function below the `nargs` values on top of the stack, with those values as arguments, and pops them. The coroutine is first resumed by the next `run(onCompletion:)`.
+    ///
+    /// Must not be called while the scheduler is running.
+    public func spawn(_ state: LuaState, nargs: Int32 = 0) {
+        _ = state.rawGetI(LUA_REGISTRYINDEX, n: lua_Integer(LUA_RIDX_MAINTHREAD))
+        let main = state.toThread()!
+        state.pop()
+        let scheduled: LuaScheduledState
+        if let existing = states[main.state!] {
+            scheduled = existing
+        } else {
+            scheduled = LuaScheduledState(state: main)
+            states[main.state!] = scheduled
+            order.append(scheduled)
+        }
+        let thread = state.newThread()
+        let ref = state.ref()
+        state.xmove(to: thread, n: nargs + 1)
+        scheduled.ready.append(LuaScheduledCoroutine(thread: thread, ref: ref, nargs: nargs))
+    }
+    
+    /// Runs every spawned coroutine to completion on `workerCount` workers, and returns once all of them have finished.
+    @discardableResult
+    public func run(onCompletion: Completion = { _, _, _ in }) -> Statistics {
+        deques = (0..<workerCount).map { _ in LuaWorkDeque() }
+        for (i, scheduled) in order.enumerated() {
+            deques[i % workerCount].pushBottom(scheduled)
+        }
+        remaining = order.count
+        states.removeAll()
+        order.removeAll()
+        let perWorker = UnsafeMutableBufferPointer<Statistics>.allocate(capacity: workerCount)
+        perWorker.initialize(repeating: Statistics())
+        defer { perWorker.deallocate() }
+        DispatchQueue.concurrentPerform(iterations: workerCount) { worker in
+            perWorker[worker] = work(worker, onCompletion: onCompletion)
+        }
+        deques.removeAll()
+        return perWorker.reduce(into: Statistics()) { total, stats in
+            total.resumes += stats.resumes
+            total.steals += stats.steals
+            total.completed += stats.completed
+        }
+    }
+    
+    private func work(_ worker: Int, onCompletion: Completion) -> Statistics {
+        var stats = Statistics()
+        let deque = deques[worker]
+        while true {
+            var next = deque.popBottom()
+            if next == nil {
+                next = steal(from: worker)
+                if next != nil {
+                    stats.steals += 1
+                }
+            }
+            guard let scheduled = next else {
+                idle.lock()
+                if remaining == 0 {
+                    idle.unlock()
+                    return stats
+                }
+                // A push since the steal failed did not signal this worker, which was not waiting yet. Pushes happen before their worker takes `idle` to signal, so checking under it misses none
+                if deques.contains(where: { $0.count > 0 }) {
+                    idle.unlock()
+                    continue
+                }
+                waiting += 1
+                idle.wait()
+                waiting -= 1
+                idle.unlock()
+                continue
+            }
+            var coroutine = scheduled.ready.removeFirst()
+            var nresults: Int32 = 0
+            let status = coroutine.thread.resume(from: scheduled.state, nargs: coroutine.nargs, nresults: &nresults)
+            stats.resumes += 1
+            if status == .LUA_YIELD {
+                coroutine.thread.pop(nresults)
+                coroutine.nargs = 0
+                scheduled.ready.append(coroutine)
+            } else {
+                onCompletion(scheduled.state, coroutine.thread, status)
+                coroutine.thread.setTop(0)
+                scheduled.state.unref(ref: coroutine.ref)
+                stats.completed += 1
+            }
+            if scheduled.ready.isEmpty {
+                idle.lock()
+                remaining -= 1
+                if remaining == 0 {
+                    idle.broadcast()
+                }
+                idle.unlock()
+            } else if deque.pushBottom(scheduled) > 1 {
+                // Something to steal; wake an idle worker
+                idle.lock()
+                if waiting > 0 {
+                    idle.signal()
+                }
+                idle.unlock()
+            }
+        }
+    }
+    
+    private func steal(from worker: Int) -> LuaScheduledState? {
+        guard workerCount > 1 else {
+            return nil
+        }
+        let start = Int.random(in: 1..<workerCount)
+        for offset in 0..<(workerCount - 1) {
+            let victim = (worker + start + offset) % workerCount
+            if victim != worker, let stolen = deques[victim].stealTop() {
+                return stolen
+            }
+        }
+        return nil
+    }
+}
+
+/// A coroutine waiting in a `LuaScheduledState`, anchored in the registry by `ref`.
+struct LuaScheduledCoroutine {
+    let thread: LuaState
+    let ref: Int32
+    var nargs: Int32
+}
+
+/// A state and its runnable coroutines. It sits in at most one deque, so only one worker touches it at a time.
+final class LuaScheduledState: @unchecked Sendable {
+    let state: LuaState
+    var ready: [LuaScheduledCoroutine] = []
+    
+    init(state: LuaState) {
+        self.state = state
+    }
+}
+
+/// A work-stealing deque: its worker pushes and pops at the bottom, other workers steal from the top.
+final class LuaWorkDeque: @unchecked Sendable {
+    private let lock = NSLock()
+    private var items: [LuaScheduledState] = []
+    /// Index of the top state: the slots before it were stolen, and are dropped once they make up half of `items`.
+    private var top = 0
+    
+    /// The number of states in the deque.
+    var count: Int {
+        lock.lock()
+        defer { lock.unlock() }
+        return items.count - top
+    }
+    
+    /// Returns the number of states in the deque after the push.
+    @discardableResult
+    func pushBottom(_ item: LuaScheduledState) -> Int {
+        lock.lock()
+        defer { lock.unlock() }
+        items.append(item)
+        return items.count - top
+    }
+    
+    func popBottom() -> LuaScheduledState? {
+        lock.lock()
+        defer { lock.unlock() }
+        guard items.count > top else {
+            return nil
+        }
+        let item = items.removeLast()
+        if items.count == top {
+            items.removeAll(keepingCapacity: true)
+            top = 0
+        }
+        return item
+    }
+    
+    func stealTop() -> LuaScheduledState? {
+        lock.lock()
+        defer { lock.unlock() }
+        guard items.count > top else {
+            return nil
+        }
+        let item = items[top]
+        top += 1
+        if items.count == top {
+            items.removeAll(keepingCapacity: true)
+            top = 0
+        } else if top * 2 >= items.count {
+            // The owner can keep pushing while thieves take the top, so the deque may never run empty
+            items.removeFirst(top)
+            top = 0
+        }
+        return item
+    }
+}
@@ -0,0 +1,138 @@
+import CLua
+import Lua
+
+/// A Swift value pushed straight to the stack, without going through `Value`: arguments of a `LuaPreparedCall` and results of a typed function (see `LuaState.pushTypedFunction(_:)`).
+public protocol LuaPushable {
+    func push(to L: LuaState)
+}
+
+/// A Swift value read straight from the stack, without going through `LuaValue`: results of a `LuaPreparedCall` and arguments of a typed function (see `LuaState.pushTypedFunction(_:)`).
+public protocol LuaReadable {
+    /// The Lua type expected, for error messages.
+    static var luaTypeName: StaticString { get }
+    /// Returns the value at `idx`, or nil if it cannot be converted.
+    static func read(from L: LuaState, at idx: Int32) -> Self?
+}
+
+extension lua_Number: LuaPushable, LuaReadable {
+    @inlinable
+    @inline(__always)
+    public func push(to L: LuaState) {
+        L.pushNumber(self)
+    }
+    
+    @inlinable
+    @inline(__always)
+    public static var luaTypeName: StaticString { "number" }
+    
+    /// Like `luaL_checknumber`, strings convertible to numbers are read too.
+    @inlinable
+    @inline(__always)
+    public static func read(from L: LuaState, at idx: Int32) -> lua_Number? {
+        return L.toNumber(idx)
+    }
+}
+
+extension lua_Integer: LuaPushable, LuaReadable {
+    @inlinable
+    @inline(__always)
+    public func push(to L: LuaState) {
+        L.pushInteger(self)
+    }
+    
+    @inlinable
+    @inline(__always)
+    public static var luaTypeName: StaticString { "integer" }
+    
+    /// Like `luaL_checkinteger`, floats with an integral value and strings convertible to integers are read too.
+    @inlinable
+    @inline(__always)
+    public static func read(from L: LuaState, at idx: Int32) -> lua_Integer? {
+        return L.toInteger(idx)
+    }
+}
+
+extension Int: LuaPushable, LuaReadable {
+    @inlinable
+    @inline(__always)
+    public func push(to L: LuaState) {
+        L.pushInteger(lua_Integer(self))
+    }
+    
+    @inlinable
+    @inline(__always)
+    public static var luaTypeName: StaticString { "integer" }
+    
+    @inlinable
+    @inline(__always)
+    public static func read(from L: LuaState, at idx: Int32) -> Int? {
+        return L.toInteger(idx).map { Int(truncatingIfNeeded: $0) }
+    }
+}
+
+extension Bool: LuaPushable, LuaReadable {
+    @inlinable
+    @inline(__always)
+    public func push(to L: LuaState) {
+        L.pushBoolean(self)
+    }
+    
+    @inlinable
+    @inline(__always)
+    public static var luaTypeName: StaticString { "boolean" }
+    
+    /// Like Lua's conditions, nil and false are false and every other value is true.
+    @inlinable
+    @inline(__always)
+    public static func read(from L: LuaState, at idx: Int32) -> Bool? {
+        return L.toBoolean(idx)
+    }
+}
+
+extension String: LuaPushable, LuaReadable {
+    @inlinable
+    @inline(__always)
+    public func push(to L: LuaState) {
+        L.pushLString(self)
+    }
+    
+    @inlinable
+    @inline(__always)
+    public static var luaTypeName: StaticString { "string" }
+    
+    /// Like `luaL_checkstring`, numbers are read too, converted in place.
+    @inlinable
+    @inline(__always)
+    public static func read(from L: LuaState, at idx: Int32) -> String? {
+        return L.toString(idx)
+    }
+}
+
+extension Optional: LuaPushable where Wrapped: LuaPushable {
+    /// Pushes nil for nil.
+    @inlinable
+    @inline(__always)
+    public func push(to L: LuaState) {
+        if let value = self {
+            value.push(to: L)
+        } else {
+            L.pushNil()
+        }
+    }
+}
+
+extension Optional: LuaReadable where Wrapped: LuaReadable {
+    @inlinable
+    @inline(__always)
+    public static var luaTypeName: StaticString { Wrapped.luaTypeName }
+    
+    /// Reads nil (or a missing value) as nil, and other values as `Wrapped`.
+    @inlinable
+    @inline(__always)
+    public static func read(from L: LuaState, at idx: Int32) -> Wrapped?? {
+        if lua_type(L.state, idx) <= LUA_TNIL {
+            return .some(nil)
+        }
+        return Wrapped.read(from: L, at: idx).map { .some($0) }
+    }
+}
@@ -0,0 +1,298 @@
+import CLua
+import Lua
+import Foundation
+
+/// Only its identity is used, as the registry key of the pristine copies a pooled state is reset from.
+final class LuaStatePoolSnapshotKey {}
+
+/// Keeps states that are already initialized (`openLibs` and whatever `prepare` loads) and hands them out, so a request does not pay for creating one.
+///
+/// When a state is checked back in, it is reset in place instead of being closed:
+/// - the globals table and every table it holds (the libraries, `package` and so on) get their pristine contents back, so globals the request set are removed and the ones it replaced or removed are restored;
+/// - so do the registry and every table it holds (`package.loaded`, metatables of userdata), which drops the refs, metatables and modules the request added;
+/// - so do the metatables of basic types (the string metatable and the ones `debug.setmetatable` gives to nil, booleans, numbers, functions and so on), and the metatables of all those tables; each of those tables also gets its pristine metatable back (e.g. none for `_G`);
+/// - the collector gets its pristine settings back: restarted if the request stopped it, and with its mode and parameters as they were;
+/// - a hook the request set (`debug.sethook`) is removed, except the one of an instruction budget;
+/// - the stack is emptied and the collector runs an incremental step instead of a full collection, so the garbage is collected over the next steps.
+///
+/// The copies are shallow: tables nested deeper than that (e.g. one a library table holds) and state outside those tables (upvalues of functions, metatables of metatables) are not reset. States that should not be reused can be closed rather than checked in.
+public final class LuaStatePool: @unchecked Sendable {
+    
+    /// Counters since the pool was created.
+    public struct Metrics: Sendable {
+        /// Calls to `checkout()`.
+        public var checkouts = 0
+        /// Checkouts served by an idle state.
+        public var hits = 0
+        /// Checkouts that had to create a state.
+        public var misses = 0
+        /// States reset by `checkin(_:)`.
+        public var resets = 0
+        /// States closed by `checkin(_:)` because the pool was full.
+        public var discarded = 0
+        /// Time spent in `checkout()`, creating states included.
+        public var checkoutNanoseconds: UInt64 = 0
+        /// Time spent resetting states.
+        public var resetNanoseconds: UInt64 = 0
+    
+        /// The fraction of checkouts served by an idle state.
+        public var hitRate: Double {
+            return checkouts > 0 ? Double(hits) / Double(checkouts) : 0
+        }
+    
+        /// The average time of a `checkout()`, in nanoseconds.
+        public var averageCheckoutNanoseconds: Double {
+            return checkouts > 0 ? Double(checkoutNanoseconds) / Double(checkouts) : 0
+        }
+    
+        /// The average time of a reset, in nanoseconds.
+        public var averageResetNanoseconds: Double {
+            return resets > 0 ? Double(resetNanoseconds) / Double(resets) : 0
+        }
+    }
+    
+    /// The most idle states kept.
+    public let capacity: Int
+    /// The kilobytes of work of the collector step run by each reset (see `LUA_GCSTEP`); 0 runs one basic step.
+    public let gcStepKB: Int32
+    
+    private let allocator: LuaAllocator
+    private let prepare: (LuaState) -> Void
+    private let lock = NSLock()
+    private var idle: [LuaState] = []
+    private var counters = Metrics()
+    
+    /// Creates a pool keeping up to `capacity` idle states, `prewarm` of which are created right away. Each state is created with `allocator` and initialized by `prepare`, which by default opens the standard libraries.
+    public init(capacity: Int, prewarm: Int = 0, allocator: LuaAllocator = .system, gcStepKB: Int32 = 0, prepare: @escaping (LuaState) -> Void = { $0.openLibs() }) {
+        self.capacity = max(capacity, 0)
+        self.allocator = allocator
+        self.gcStepKB = gcStepKB
+        self.prepare = prepare
+        for _ in 0..<min(prewarm, self.capacity) {
+            idle.append(makeState())
+        }
+    }
+    
+    deinit {
+        close()
+    }
+    
+    /// Returns an idle state, or a new one if there is none. It must be checked back in (or closed) by its user.
+    public func checkout() -> LuaState {
+        let start = DispatchTime.now().uptimeNanoseconds
+        lock.lock()
+        let state = idle.popLast()
+        lock.unlock()
+        let L = state ?? makeState()
+        let elapsed = DispatchTime.now().uptimeNanoseconds - start
+        lock.lock()
+        counters.checkouts += 1
+        if state != nil {
+            counters.hits += 1
+        } else {
+            counters.misses += 1
+        }
+        counters.checkoutNanoseconds += elapsed
+        lock.unlock()
+        return L
+    }
+    
+    /// Resets a state from `checkout()` and keeps it for the next checkout, or closes it if the pool is full.
+    public func checkin(_ L: LuaState) {
+        lock.lock()
+        let full = idle.count >= capacity
+        if full {
+            counters.discarded += 1
+        }
+        lock.unlock()
+        if full {
+            L.close()
+            return
+        }
+        let start = DispatchTime.now().uptimeNanoseconds
+        LuaStatePool.reset(L, gcStepKB: gcStepKB)
+        let elapsed = DispatchTime.now().uptimeNanoseconds - start
+        // Other checkins may have filled the pool during the reset, so check again along with the append
+        lock.lock()
+        counters.resets += 1
+        counters.resetNanoseconds += elapsed
+        let kept = idle.count < capacity
+        if kept {
+            idle.append(L)
+        } else {
+            counters.discarded += 1
+        }
+        lock.unlock()
+        if !kept {
+            L.close()
+        }
+    }
+    
+    /// Checks out a state, runs `body` with it and checks it back in, also when `body` throws.
+    public func withState<R>(_ body: (LuaState) throws -> R) rethrows -> R {
+        let L = checkout()
+        defer { checkin(L) }
+        return try body(L)
+    }
+    
+    /// The number of idle states.
+    public var idleCount: Int {
+        lock.lock()
+        defer { lock.unlock() }
+        return idle.count
+    }
+    
+    public var metrics: Metrics {
+        lock.lock()
+        defer { lock.unlock() }
+        return counters
+    }
+    
+    /// Closes the idle states. States checked out are closed when checked in.
+    public func close() {
+        lock.lock()
+        let states = idle
+        idle.removeAll()
+        lock.unlock()
+        for L in states {
+            L.close()
+        }
+    }
+    
+    private func makeState() -> LuaState {
+        let L = LuaState.newLuaState(allocator: allocator)
+        prepare(L)
+        L.setTop(0)
+        LuaStatePool.snapshot(L)
+        return L
+    }
+    
+    /// Registry key of the sequence of tables to reset, each followed by its pristine copy.
+    private static var snapshotKey: UnsafeRawPointer {
+        UnsafeRawPointer(bitPattern: Int(bitPattern: ObjectIdentifier(LuaStatePoolSnapshotKey.self)))!
+    }
+    
+    /// Records the pristine copies `reset(_:gcStepKB:)` restores. The registry is copied last, so its copy has the copies too.
+    static func snapshot(_ L: LuaState) {
+        L.newTable()
+        let tables = L.getTop()
+        L.pushValue(copiedFromIdx: LUA_REGISTRYINDEX)
+        let registry = L.getTop()
+        _ = L.rawGetI(LUA_REGISTRYINDEX, n: lua_Integer(LUA_RIDX_GLOBALS))
+        let globals = L.getTop()
+        lua_getbasicmetatables(L.state)
+        let basics = L.getTop()
+        // Collect each table once: the globals, the tables held by the globals or the registry, and the metatables of basic types
+        L.pushValue(copiedFromIdx: globals)
+        L.pushBoolean(true)
+        L.rawSet(tables)
+        for holder in [globals, registry, basics] {
+            L.pushNil()
+            while L.next(holder) {
+                if L.type(-1) == .LUA_TTABLE && !L.rawequal(-1, registry) {
+                    L.pushBoolean(true)
+                    L.rawSet(tables)
+                } else {
+                    L.pop()
+                }
+            }
+        }
+        // Then the metatables of those, listed first since the set must not grow while it is traversed
+        L.newTable()
+        let list = L.getTop()
+        var count: lua_Integer = 0
+        L.pushNil()
+        while L.next(tables) {
+            L.pop()
+            L.pushValue(copiedFromIdx: -1)
+            count += 1
+            lua_rawseti(L.state, list, count)
+        }
+        for i in stride(from: 1, through: count, by: 1) {
+            _ = L.rawGetI(list, n: i)
+            if L.getMetatable(-1) {
+                if L.rawequal(-1, registry) {
+                    L.pop()
+                } else {
+                    L.pushBoolean(true)
+                    L.rawSet(tables)
+                }
+            }
+            L.pop()
+        }
+        // Each table is followed by its pristine copy and its metatable, or false
+        L.newTable()
+        let copies = L.getTop()
+        var n: lua_Integer = 0
+        func record(_ idx: Int32) {
+            let t = L.absIndex(idx)
+            L.pushValue(copiedFromIdx: t)
+            n += 1
+            lua_rawseti(L.state, copies, n)
+            copyTable(L, t)
+            n += 1
+            lua_rawseti(L.state, copies, n)
+            if !L.getMetatable(t) {
+                L.pushBoolean(false)
+            }
+            n += 1
+            lua_rawseti(L.state, copies, n)
+        }
+        L.pushNil()
+        while L.next(tables) {
+            L.pop()
+            record(-1)
+        }
+        L.pushValue(copiedFromIdx: basics)
+        L.setField(copies, key: "basicmetatables")
+        let settings = L.newUserDataUV(size: MemoryLayout<lua_GCSettings>.size, nuValue: 0).bindMemory(to: lua_GCSettings.self, capacity: 1)
+        lua_getgcsettings(L.state, settings)
+        L.setField(copies, key: "gc")
+        L.pushValue(copiedFromIdx: copies)
+        L.rawSetP(LUA_REGISTRYINDEX, p: snapshotKey)
+        record(registry)
+        L.setTop(tables - 1)
+    }
+    
+    /// Restores the tables recorded by `snapshot(_:)` with `lua_restoretable`, which walks them directly and only assigns what changed, along with their metatables, the metatables of basic types and the collector settings. Then it removes a hook other than the budget's, empties the stack and runs a collector step.
+    static func reset(_ L: LuaState, gcStepKB: Int32) {
+        L.setTop(0)
+        _ = L.rawGetP(LUA_REGISTRYINDEX, p: snapshotKey)
+        let n = lua_Integer(L.rawLen(1))
+        for i in stride(from: 1, to: n, by: 3) {
+            _ = L.rawGetI(1, n: i)
+            _ = L.rawGetI(1, n: i + 1)
+            lua_restoretable(L.state, 2, 3)
+            L.pop()
+            _ = L.rawGetI(1, n: i + 2)
+            if L.type(-1) != .LUA_TTABLE {
+                L.pop()
+                L.pushNil()
+            }
+            L.setMetatable(2)
+            L.pop()
+        }
+        _ = L.getField(1, key: "basicmetatables")
+        lua_setbasicmetatables(L.state, -1)
+        L.pop()
+        _ = L.getField(1, key: "gc")
+        lua_setgcsettings(L.state, L.toUserData(-1)!.assumingMemoryBound(to: lua_GCSettings.self))
+        if lua_gethook(L.state) != nil && lua_isbudgethook(L.state) == 0 {
+            lua_sethook(L.state, nil, 0, 0)
+        }
+        L.setTop(0)
+        _ = L.gc(what: LUA_GCSTEP, data: gcStepKB)
+    }
+    
+    /// Pushes a shallow copy of the table at `idx`.
+    private static func copyTable(_ L: LuaState, _ idx: Int32) {
+        let t = L.absIndex(idx)
+        L.newTable()
+        L.pushNil()
+        while L.next(t) {
+            L.pushValue(copiedFromIdx: -2)
+            L.insert(-2)
+            L.rawSet(-4)
+        }
+    }
+}
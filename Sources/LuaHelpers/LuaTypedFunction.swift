@@ -0,0 +1,120 @@
+import CLua
+import Lua
+
+/// The body of a typed function, called by the trampoline pushed by `LuaState.pushTypedFunction(_:)`. Returns the number of results, or a negative value after a failure: minus the index of an argument of the wrong type (see `expectedType`), or `LuaTypedFunctionBox.thrown` after pushing the error the function threw.
+@usableFromInline
+final class LuaTypedFunctionBox {
+    @usableFromInline
+    static let thrown = Int32.min
+    
+    @usableFromInline
+    let body: (LuaState, LuaTypedFunctionBox) -> Int32
+    /// The type expected by the last argument that failed to convert.
+    @usableFromInline
+    var expectedType: StaticString = ""
+    
+    @usableFromInline
+    init(_ body: @escaping (LuaState, LuaTypedFunctionBox) -> Int32) {
+        self.body = body
+    }
+    
+    /// Reads argument `arg + 1` and advances `arg`.
+    @inlinable
+    @inline(__always)
+    func argument<T: LuaReadable>(_ L: LuaState, _ type: T.Type, _ arg: inout Int32) throws -> T {
+        arg += 1
+        guard let value = T.read(from: L, at: arg) else {
+            expectedType = T.luaTypeName
+            throw LuaTypedFunctionArgumentError()
+        }
+        return value
+    }
+    
+    /// Pushes what a typed function threw, for the trampoline to raise.
+    @inlinable
+    func pushError(_ L: LuaState, _ error: any Error) -> Int32 {
+        L.pushString(String(describing: error))
+        return LuaTypedFunctionBox.thrown
+    }
+}
+
+/// Thrown while reading arguments; the argument and its type are in the `LuaTypedFunctionBox`.
+@usableFromInline
+struct LuaTypedFunctionArgumentError: Error {
+    @usableFromInline
+    init() {}
+}
+
+extension LuaState {
+    
+    /// Pushes a Lua function calling the Swift function `function` with its Lua arguments converted to the types of its parameters, and returning its result converted back, e.g. `L.pushTypedFunction { (id: lua_Integer, dt: lua_Number, name: String) in ... }`.
+    ///
+    /// Arguments are checked and read straight from the stack (see `LuaReadable`), and the result is pushed straight to it (see `LuaPushable`), without going through `Value`, `LuaValue` or registry refs. An argument of the wrong type raises the same error as `luaL_checknumber` and friends; optional parameters also accept nil and missing arguments, and extra arguments are ignored. An error thrown by `function` is raised in Lua as a string.
+    @inlinable
+    public func pushTypedFunction<each A: LuaReadable, R: LuaPushable>(_ function: @escaping (repeat each A) throws -> R) {
+        self.pushTypedFunctionBox(LuaTypedFunctionBox { L, box in
+            var arg: Int32 = 0
+            do {
+                let arguments: (repeat each A) = try (repeat box.argument(L, (each A).self, &arg))
+                try function(repeat each arguments).push(to: L)
+                return 1
+            } catch is LuaTypedFunctionArgumentError {
+                return -arg
+            } catch {
+                return box.pushError(L, error)
+            }
+        })
+    }
+    
+    /// Pushes a Lua function calling the Swift function `function`, which returns no result (see `pushTypedFunction(_:)`).
+    @inlinable
+    public func pushTypedFunction<each A: LuaReadable>(_ function: @escaping (repeat each A) throws -> Void) {
+        self.pushTypedFunctionBox(LuaTypedFunctionBox { L, box in
+            var arg: Int32 = 0
+            do {
+                let arguments: (repeat each A) = try (repeat box.argument(L, (each A).self, &arg))
+                try function(repeat each arguments)
+                return 0
+            } catch is LuaTypedFunctionArgumentError {
+                return -arg
+            } catch {
+                return box.pushError(L, error)
+            }
+        })
+    }
+    
+    /// Sets the global `name` to a Lua function calling `function` (see `pushTypedFunction(_:)`).
+    @inlinable
+    public func registerTypedFunction<each A: LuaReadable, R: LuaPushable>(_ name: String, _ function: @escaping (repeat each A) throws -> R) {
+        self.pushTypedFunction(function)
+        self.setGlobal(name)
+    }
+    
+    /// Sets the global `name` to a Lua function calling `function` (see `pushTypedFunction(_:)`).
+    @inlinable
+    public func registerTypedFunction<each A: LuaReadable>(_ name: String, _ function: @escaping (repeat each A) throws -> Void) {
+        self.pushTypedFunction(function)
+        self.setGlobal(name)
+    }
+    
+    /// Pushes the trampoline shared by every typed function, a C closure with the box as its upvalue. It is not generic, so it can be a thin function; the box's body is the generic part, specialized where the typed function is pushed.
+    @usableFromInline
+    func pushTypedFunctionBox(_ box: LuaTypedFunctionBox) {
+        self.pushSwiftObject(box)
+        self.pushCClosure({ L in
+            let object = L.toUserData(lua_upvalueindex(1))!.load(as: UnsafeMutableRawPointer.self)
+            let box = Unmanaged<LuaTypedFunctionBox>.fromOpaque(object)
+            let n = box._withUnsafeGuaranteedRef { $0.body(L, $0) }
+            if n >= 0 {
+                return n
+            }
+            // Raising longjmps over this frame, so nothing reference counted is alive here
+            if n == LuaTypedFunctionBox.thrown {
+                L.error()
+            }
+            let expected = box._withUnsafeGuaranteedRef { $0.expectedType }
+            luaL_typeerror(L.state, -n, UnsafeRawPointer(expected.utf8Start).assumingMemoryBound(to: CChar.self))
+            return 0
+        }, n: 1)
+    }
+}
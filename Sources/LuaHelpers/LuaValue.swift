@@ -240,6 +240,21 @@ public struct LuaString: ~Copyable {
         return res
     }
     
+    /// Copies the exact bytes of the string, including any embedded zeros or invalid UTF-8.
+    @inlinable
+    @inline(__always)
+    public borrowing func copyBytesToSwift() -> [UInt8] {
+        let type = unsafeLuaString.luaState.pushRef(unsafeLuaString.ref)
+        if type != .LUA_TSTRING {
+            assertionFailure()
+            unsafeLuaString.luaState.pop()
+            return []
+        }
+        let res = unsafeLuaString.luaState.toBytes(unsafeLuaString.luaState.getTop()) ?? []
+        unsafeLuaString.luaState.pop()
+        return res
+    }
+    
     public consuming func discardWithoutUnref() {
         discard self
     }
@@ -6,6 +6,14 @@ public let SwiftStructUserdataWrapperName = "SwiftStructUserdataWrapper"
 /// Should be a `struct`, not a class.
 public protocol SwiftStructUserdata: Sendable {
     
+    /// The metamethods installed in this type's metatable. Defaults to `.all`, which shares one metatable between every type and dispatches each metamethod dynamically.
+    /// Return only the metamethods the type overrides to get a metatable of its own without the others, e.g. without `__index`/`__newindex` field accesses never call into Swift. `__gc` is always installed.
+    static var metamethods: SwiftStructUserdataMetamethods { get }
+    
+    /// Named fields and methods. They are stored in tables keyed by the interned name, so `obj:method()` resolves with a plain table lookup inside the Lua VM and `obj.field` calls its getter without comparing strings in Swift.
+    /// Keys which aren't members fall back to `__index`/`__newindex`. Types with members always get a metatable of their own, and when a type has no getters and leaves `.index` out of `metamethods`, the method table itself becomes `__index` so lookups never call into Swift.
+    static var members: [SwiftStructUserdataMember] { get }
+    
     static func __add(self: OpaquePointer, _ L: LuaState) -> Int32
     mutating func __add(_ L: LuaState) -> Int32
     static func __sub(self: OpaquePointer, _ L: LuaState) -> Int32
@@ -58,6 +66,8 @@ public protocol SwiftStructUserdata: Sendable {
 }
 
 extension SwiftStructUserdata {
+    public static var metamethods: SwiftStructUserdataMetamethods { .all }
+    public static var members: [SwiftStructUserdataMember] { [] }
     @inline(__always)
     public static func pt(from pt: OpaquePointer) -> UnsafeMutablePointer<any SwiftStructUserdata> {
         return UnsafeMutablePointer<any SwiftStructUserdata>(pt)
@@ -153,107 +163,264 @@ extension LuaState {
                 value: instance
             )
         )
-        if self.newMetatable(typeName: SwiftStructUserdataWrapperName) {
-            // Binary operations - userdata at index -2
+        self.pushSwiftStructUserdataMetatable(for: T.self)
+        self.setMetatable(-2)
+        return withUnsafeMutablePointer(to: &wrapperPointer.pointee.value) { $0 }
+    }
+    
+    /// Builds the metatable used by `T` ahead of time, so the first call to `new` doesn't have to.
+    @inlinable
+    public func registerSwiftStructUserdata<T: SwiftStructUserdata>(_ type: T.Type) {
+        self.pushSwiftStructUserdataMetatable(for: type)
+        self.pop()
+    }
+    
+    /// Pushes the metatable for `T`. Metatables are cached in the registry under a light userdata key per type, so after the first call this is a single raw lookup instead of the string lookup done by `luaL_newmetatable`.
+    @inlinable
+    @inline(__always)
+    func pushSwiftStructUserdataMetatable<T: SwiftStructUserdata>(for type: T.Type) {
+        let key = SwiftStructUserdataWrapper<T>.metatableKey
+        if self.rawGetP(LUA_REGISTRYINDEX, p: key) == .LUA_TTABLE {
+            return
+        }
+        self.pop()
+        self.buildSwiftStructUserdataMetatable(
+            name: String(describing: T.self),
+            metamethods: T.metamethods,
+            members: T.members
+        )
+        self.pushValue(copiedFromIdx: -1)
+        self.rawSetP(LUA_REGISTRYINDEX, p: key)
+    }
+    
+    /// Pushes the metatable for a type. Types using every metamethod and no members share one metatable, the others get their own.
+    @usableFromInline
+    func buildSwiftStructUserdataMetatable(name: String, metamethods: SwiftStructUserdataMetamethods, members: [SwiftStructUserdataMember]) {
+        if metamethods == .all && members.isEmpty {
+            if self.rawGetP(LUA_REGISTRYINDEX, p: SwiftStructUserdataWrapperErased.metatableKey) == .LUA_TTABLE {
+                return
+            }
+            self.pop()
+            _ = self.newMetatable(typeName: SwiftStructUserdataWrapperName)
+            self.installSwiftStructUserdataMetamethods(metamethods)
+            self.pushValue(copiedFromIdx: -1)
+            self.rawSetP(LUA_REGISTRYINDEX, p: SwiftStructUserdataWrapperErased.metatableKey)
+            return
+        }
+        self.newTable()
+        self.pushString(name)
+        self.setField(-2, key: "__name")
+        if members.isEmpty {
+            self.installSwiftStructUserdataMetamethods(metamethods)
+            return
+        }
+        self.installSwiftStructUserdataMetamethods(metamethods.subtracting([.index, .newindex]))
+        
+        let methods = members.filter { $0.method != nil }
+        let getters = members.filter { $0.getter != nil }
+        let setters = members.filter { $0.setter != nil }
+        self.createTable(narr: 0, nrec: Int32(methods.count))
+        for member in methods {
+            self.setField(-2, key: member.name, cFunction: member.method!)
+        }
+        if getters.isEmpty && !metamethods.contains(.index) {
+            // Nothing to compute, so the VM resolves methods straight from this table.
+            self.setField(-2, key: "__index")
+        } else {
+            self.createTable(narr: 0, nrec: Int32(getters.count))
+            for member in getters {
+                self.setField(-2, key: member.name, cFunction: member.getter!)
+            }
+            // Userdata at index 1, key at index 2
+            self.pushCClosure({ L in
+                L.pushValue(copiedFromIdx: 2)
+                if L.rawGet(lua_upvalueindex(1)) != .LUA_TNIL {
+                    return 1
+                }
+                L.pop()
+                L.pushValue(copiedFromIdx: 2)
+                if L.rawGet(lua_upvalueindex(2)) == .LUA_TFUNCTION, let getter = L.toCFunction(-1) {
+                    L.pop()
+                    return getter(L)
+                }
+                L.pop()
+                guard let wrappedInstance = L.getUserDataInstance(index: 1) else { return 0 }
+                return wrappedInstance.tag.__index(self: wrappedInstance.value, L)
+            }, n: 2)
+            self.setField(-2, key: "__index")
+        }
+        if !setters.isEmpty {
+            self.createTable(narr: 0, nrec: Int32(setters.count))
+            for member in setters {
+                self.setField(-2, key: member.name, cFunction: member.setter!)
+            }
+            // Userdata at index 1, key at index 2, value at index 3
+            self.pushCClosure({ L in
+                L.pushValue(copiedFromIdx: 2)
+                if L.rawGet(lua_upvalueindex(1)) == .LUA_TFUNCTION, let setter = L.toCFunction(-1) {
+                    L.pop()
+                    return setter(L)
+                }
+                L.pop()
+                guard let wrappedInstance = L.getUserDataInstance(index: 1) else { return 0 }
+                return wrappedInstance.tag.__newindex(self: wrappedInstance.value, L)
+            }, n: 1)
+            self.setField(-2, key: "__newindex")
+        } else if metamethods.contains(.newindex) {
+            self.installSwiftStructUserdataMetamethods(.newindex, gc: false)
+        }
+    }
+    
+    /// Sets the given metamethods, plus `__gc` unless told otherwise, on the table at the top of the stack.
+    @usableFromInline
+    func installSwiftStructUserdataMetamethods(_ metamethods: SwiftStructUserdataMetamethods, gc: Bool = true) {
+        // Binary operations - userdata at index -2
+        if metamethods.contains(.add) {
             self.setField(-2, key: "__add", cFunction: { L in
                 guard let wrappedInstance = L.getUserDataInstance(index: -2) else { return 0 }
                 return wrappedInstance.tag.__add(self: wrappedInstance.value, L)
             })
+        }
+        if metamethods.contains(.sub) {
             self.setField(-2, key: "__sub", cFunction: { L in
                 guard let wrappedInstance = L.getUserDataInstance(index: -2) else { return 0 }
                 return wrappedInstance.tag.__sub(self: wrappedInstance.value, L)
             })
+        }
+        if metamethods.contains(.mul) {
             self.setField(-2, key: "__mul", cFunction: { L in
                 guard let wrappedInstance = L.getUserDataInstance(index: -2) else { return 0 }
                 return wrappedInstance.tag.__mul(self: wrappedInstance.value, L)
             })
+        }
+        if metamethods.contains(.div) {
             self.setField(-2, key: "__div", cFunction: { L in
                 guard let wrappedInstance = L.getUserDataInstance(index: -2) else { return 0 }
                 return wrappedInstance.tag.__div(self: wrappedInstance.value, L)
             })
+        }
+        if metamethods.contains(.mod) {
             self.setField(-2, key: "__mod", cFunction: { L in
                 guard let wrappedInstance = L.getUserDataInstance(index: -2) else { return 0 }
                 return wrappedInstance.tag.__mod(self: wrappedInstance.value, L)
             })
+        }
+        if metamethods.contains(.pow) {
             self.setField(-2, key: "__pow", cFunction: { L in
                 guard let wrappedInstance = L.getUserDataInstance(index: -2) else { return 0 }
                 return wrappedInstance.tag.__pow(self: wrappedInstance.value, L)
             })
+        }
+        if metamethods.contains(.idiv) {
             self.setField(-2, key: "__idiv", cFunction: { L in
                 guard let wrappedInstance = L.getUserDataInstance(index: -2) else { return 0 }
                 return wrappedInstance.tag.__idiv(self: wrappedInstance.value, L)
             })
+        }
+        if metamethods.contains(.band) {
             self.setField(-2, key: "__band", cFunction: { L in
                 guard let wrappedInstance = L.getUserDataInstance(index: -2) else { return 0 }
                 return wrappedInstance.tag.__band(self: wrappedInstance.value, L)
             })
+        }
+        if metamethods.contains(.bor) {
             self.setField(-2, key: "__bor", cFunction: { L in
                 guard let wrappedInstance = L.getUserDataInstance(index: -2) else { return 0 }
                 return wrappedInstance.tag.__bor(self: wrappedInstance.value, L)
             })
+        }
+        if metamethods.contains(.bxor) {
             self.setField(-2, key: "__bxor", cFunction: { L in
                 guard let wrappedInstance = L.getUserDataInstance(index: -2) else { return 0 }
                 return wrappedInstance.tag.__bxor(self: wrappedInstance.value, L)
             })
+        }
+        if metamethods.contains(.shl) {
             self.setField(-2, key: "__shl", cFunction: { L in
                 guard let wrappedInstance = L.getUserDataInstance(index: -2) else { return 0 }
                 return wrappedInstance.tag.__shl(self: wrappedInstance.value, L)
             })
+        }
+        if metamethods.contains(.shr) {
             self.setField(-2, key: "__shr", cFunction: { L in
                 guard let wrappedInstance = L.getUserDataInstance(index: -2) else { return 0 }
                 return wrappedInstance.tag.__shr(self: wrappedInstance.value, L)
             })
+        }
+        if metamethods.contains(.concat) {
             self.setField(-2, key: "__concat", cFunction: { L in
                 guard let wrappedInstance = L.getUserDataInstance(index: -2) else { return 0 }
                 return wrappedInstance.tag.__concat(self: wrappedInstance.value, L)
             })
+        }
+        if metamethods.contains(.eq) {
             self.setField(-2, key: "__eq", cFunction: { L in
                 guard let wrappedInstance = L.getUserDataInstance(index: -2) else { return 0 }
                 return wrappedInstance.tag.__eq(self: wrappedInstance.value, L)
             })
+        }
+        if metamethods.contains(.lt) {
             self.setField(-2, key: "__lt", cFunction: { L in
                 guard let wrappedInstance = L.getUserDataInstance(index: -2) else { return 0 }
                 return wrappedInstance.tag.__lt(self: wrappedInstance.value, L)
             })
+        }
+        if metamethods.contains(.le) {
             self.setField(-2, key: "__le", cFunction: { L in
                 guard let wrappedInstance = L.getUserDataInstance(index: -2) else { return 0 }
                 return wrappedInstance.tag.__le(self: wrappedInstance.value, L)
             })
-            
-            // Unary operations - userdata at index -1
+        }
+        
+        // Unary operations - userdata at index -1
+        if metamethods.contains(.unm) {
             self.setField(-2, key: "__unm", cFunction: { L in
                 guard let wrappedInstance = L.getUserDataInstance(index: -1) else { return 0 }
                 return wrappedInstance.tag.__unm(self: wrappedInstance.value, L)
             })
+        }
+        if metamethods.contains(.bnot) {
             self.setField(-2, key: "__bnot", cFunction: { L in
                 guard let wrappedInstance = L.getUserDataInstance(index: -1) else { return 0 }
                 return wrappedInstance.tag.__bnot(self: wrappedInstance.value, L)
             })
+        }
+        if metamethods.contains(.len) {
             self.setField(-2, key: "__len", cFunction: { L in
                 guard let wrappedInstance = L.getUserDataInstance(index: -1) else { return 0 }
                 return wrappedInstance.tag.__len(self: wrappedInstance.value, L)
             })
+        }
+        if metamethods.contains(.tostring) {
             self.setField(-2, key: "__tostring", cFunction: { L in
                 guard let wrappedInstance = L.getUserDataInstance(index: -1) else { return 0 }
                 return wrappedInstance.tag.__tostring(self: wrappedInstance.value, L)
             })
-            
-            // Index operations - userdata at index -2 for __index, -3 for __newindex
+        }
+        
+        // Index operations - userdata at index -2 for __index, -3 for __newindex
+        if metamethods.contains(.index) {
             self.setField(-2, key: "__index", cFunction: { L in
                 guard let wrappedInstance = L.getUserDataInstance(index: -2) else { return 0 }
                 return wrappedInstance.tag.__index(self: wrappedInstance.value, L)
             })
+        }
+        if metamethods.contains(.newindex) {
             self.setField(-2, key: "__newindex", cFunction: { L in
                 guard let wrappedInstance = L.getUserDataInstance(index: -3) else { return 0 }
                 return wrappedInstance.tag.__newindex(self: wrappedInstance.value, L)
             })
-            
-            // Call operation - userdata at index -1
+        }
+        
+        // Call operation - userdata at index -1
+        if metamethods.contains(.call) {
             self.setField(-2, key: "__call", cFunction: { L in
                 guard let wrappedInstance = L.getUserDataInstance(index: 1) else { return 0 }
                 return wrappedInstance.tag.__call(self: wrappedInstance.value, L)
             })
-            
+        }
+        
+        if gc {
             // GC operation - userdata at index -1
             self.setField(-2, key: "__gc", cFunction: { L in
                 guard let wrappedInstance = L.getUserDataInstance(index: -1) else { return 0 }
@@ -268,8 +435,6 @@ extension LuaState {
                 return res
             })
         }
-        self.setMetatable(-2)
-        return withUnsafeMutablePointer(to: &wrapperPointer.pointee.value) { $0 }
     }
     
     @usableFromInline
@@ -294,6 +459,11 @@ extension LuaState {
 
 @usableFromInline
 struct SwiftStructUserdataWrapperErased {
+    /// Registry key of the metatable shared by all types using every metamethod.
+    @inlinable
+    static var metatableKey: UnsafeRawPointer {
+        UnsafeRawPointer(bitPattern: Int(bitPattern: ObjectIdentifier(SwiftStructUserdataWrapperErased.self)))!
+    }
     @usableFromInline
     let tag: SwiftStructUserdata.Type
     @usableFromInline
@@ -313,6 +483,11 @@ struct SwiftStructUserdataWrapperErased {
 
 @usableFromInline
 struct SwiftStructUserdataWrapper<T: SwiftStructUserdata> {
+    /// Registry key of the metatable used by `T` when it only installs some metamethods.
+    @inlinable
+    static var metatableKey: UnsafeRawPointer {
+        UnsafeRawPointer(bitPattern: Int(bitPattern: ObjectIdentifier(T.self)))!
+    }
     let tag: SwiftStructUserdata.Type
     @usableFromInline
     var value: T
@@ -323,3 +498,75 @@ struct SwiftStructUserdataWrapper<T: SwiftStructUserdata> {
         self.value = value
     }
 }
+
+/// A named field or method of a `SwiftStructUserdata` type (see `SwiftStructUserdata.members`).
+/// The functions are plain Lua C functions; use `toUserDataInstancePointer(index: 1, as:)` to get the instance.
+public struct SwiftStructUserdataMember {
+    public let name: String
+    /// Called as `obj:name(...)`, with the userdata at index 1 followed by the arguments.
+    public let method: (@convention(thin) (LuaState) -> Int32)?
+    /// Called for `obj.name` with the userdata at index 1 and the key at index 2. Pushes the value and returns 1.
+    public let getter: (@convention(thin) (LuaState) -> Int32)?
+    /// Called for `obj.name = value` with the userdata at index 1, the key at index 2 and the value at index 3.
+    public let setter: (@convention(thin) (LuaState) -> Int32)?
+    
+    @inlinable
+    @inline(__always)
+    public static func method(_ name: String, _ method: @escaping @convention(thin) (LuaState) -> Int32) -> SwiftStructUserdataMember {
+        return SwiftStructUserdataMember(name: name, method: method, getter: nil, setter: nil)
+    }
+    
+    @inlinable
+    @inline(__always)
+    public static func field(_ name: String, get getter: @escaping @convention(thin) (LuaState) -> Int32, set setter: (@convention(thin) (LuaState) -> Int32)? = nil) -> SwiftStructUserdataMember {
+        return SwiftStructUserdataMember(name: name, method: nil, getter: getter, setter: setter)
+    }
+    
+    @usableFromInline
+    init(name: String, method: (@convention(thin) (LuaState) -> Int32)?, getter: (@convention(thin) (LuaState) -> Int32)?, setter: (@convention(thin) (LuaState) -> Int32)?) {
+        self.name = name
+        self.method = method
+        self.getter = getter
+        self.setter = setter
+    }
+}
+
+/// The set of metamethods installed for a `SwiftStructUserdata` type (see `SwiftStructUserdata.metamethods`).
+public struct SwiftStructUserdataMetamethods: OptionSet, Sendable {
+    public let rawValue: UInt32
+    
+    @inlinable
+    @inline(__always)
+    public init(rawValue: UInt32) {
+        self.rawValue = rawValue
+    }
+    
+    public static let add = SwiftStructUserdataMetamethods(rawValue: 1 << 0)
+    public static let sub = SwiftStructUserdataMetamethods(rawValue: 1 << 1)
+    public static let mul = SwiftStructUserdataMetamethods(rawValue: 1 << 2)
+    public static let div = SwiftStructUserdataMetamethods(rawValue: 1 << 3)
+    public static let mod = SwiftStructUserdataMetamethods(rawValue: 1 << 4)
+    public static let pow = SwiftStructUserdataMetamethods(rawValue: 1 << 5)
+    public static let unm = SwiftStructUserdataMetamethods(rawValue: 1 << 6)
+    public static let idiv = SwiftStructUserdataMetamethods(rawValue: 1 << 7)
+    public static let band = SwiftStructUserdataMetamethods(rawValue: 1 << 8)
+    public static let bor = SwiftStructUserdataMetamethods(rawValue: 1 << 9)
+    public static let bxor = SwiftStructUserdataMetamethods(rawValue: 1 << 10)
+    public static let bnot = SwiftStructUserdataMetamethods(rawValue: 1 << 11)
+    public static let shl = SwiftStructUserdataMetamethods(rawValue: 1 << 12)
+    public static let shr = SwiftStructUserdataMetamethods(rawValue: 1 << 13)
+    public static let concat = SwiftStructUserdataMetamethods(rawValue: 1 << 14)
+    public static let len = SwiftStructUserdataMetamethods(rawValue: 1 << 15)
+    public static let eq = SwiftStructUserdataMetamethods(rawValue: 1 << 16)
+    public static let lt = SwiftStructUserdataMetamethods(rawValue: 1 << 17)
+    public static let le = SwiftStructUserdataMetamethods(rawValue: 1 << 18)
+    public static let index = SwiftStructUserdataMetamethods(rawValue: 1 << 19)
+    public static let newindex = SwiftStructUserdataMetamethods(rawValue: 1 << 20)
+    public static let call = SwiftStructUserdataMetamethods(rawValue: 1 << 21)
+    public static let tostring = SwiftStructUserdataMetamethods(rawValue: 1 << 22)
+    
+    public static let arithmetic: SwiftStructUserdataMetamethods = [.add, .sub, .mul, .div, .mod, .pow, .unm, .idiv]
+    public static let bitwise: SwiftStructUserdataMetamethods = [.band, .bor, .bxor, .bnot, .shl, .shr]
+    public static let comparison: SwiftStructUserdataMetamethods = [.eq, .lt, .le]
+    public static let all: SwiftStructUserdataMetamethods = [.arithmetic, .bitwise, .comparison, .concat, .len, .index, .newindex, .call, .tostring]
+}
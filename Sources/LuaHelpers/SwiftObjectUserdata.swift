@@ -0,0 +1,76 @@
+import CLua
+import Lua
+
+/// Only its identity is used, as the registry key of the metatable of Swift object userdata.
+final class SwiftObjectUserdataMetatableKey {}
+
+extension LuaState {
+    
+    /// Registry key of the metatable of userdata pushed by `pushSwiftObject(_:)`.
+    @usableFromInline
+    static var swiftObjectMetatableKey: UnsafeRawPointer {
+        UnsafeRawPointer(bitPattern: Int(bitPattern: ObjectIdentifier(SwiftObjectUserdataMetatableKey.self)))!
+    }
+    
+    /// Pushes a full userdata holding a strong reference to `object`. The reference is released when Lua collects the userdata (through `__gc`), so the object lives exactly as long as Lua can reach it, e.g. as an upvalue of a C closure.
+    public func pushSwiftObject(_ object: AnyObject) {
+        let slot = self.newUserDataUV(size: MemoryLayout<UnsafeMutableRawPointer?>.size, nuValue: 0)
+        slot.storeBytes(of: Unmanaged.passRetained(object).toOpaque(), as: UnsafeMutableRawPointer?.self)
+        if self.rawGetP(LUA_REGISTRYINDEX, p: LuaState.swiftObjectMetatableKey) != .LUA_TTABLE {
+            self.pop()
+            self.createTable(narr: 0, nrec: 3)
+            self.pushString("SwiftObject")
+            self.setField(-2, key: "__name")
+            self.pushBoolean(false)
+            self.setField(-2, key: "__metatable")
+            self.setField(-2, key: "__gc", cFunction: { L in
+                let slot = L.toUserData(1)!
+                if let object = slot.load(as: UnsafeMutableRawPointer?.self) {
+                    slot.storeBytes(of: nil, as: UnsafeMutableRawPointer?.self)
+                    Unmanaged<AnyObject>.fromOpaque(object).release()
+                }
+                return 0
+            })
+            self.pushValue(copiedFromIdx: -1)
+            self.rawSetP(LUA_REGISTRYINDEX, p: LuaState.swiftObjectMetatableKey)
+        }
+        self.setMetatable(-2)
+    }
+    
+    /// Returns the object held by the userdata at the given index if it was pushed by `pushSwiftObject(_:)`, or nil otherwise.
+    public func toSwiftObject(_ idx: Int32 = -1) -> AnyObject? {
+        guard let slot = self.toUserData(idx), self.getMetatable(idx) else {
+            return nil
+        }
+        _ = self.rawGetP(LUA_REGISTRYINDEX, p: LuaState.swiftObjectMetatableKey)
+        let isSwiftObject = self.rawequal(-1, -2)
+        self.pop(2)
+        guard isSwiftObject, let object = slot.load(as: UnsafeMutableRawPointer?.self) else {
+            return nil
+        }
+        return Unmanaged<AnyObject>.fromOpaque(object).takeUnretainedValue()
+    }
+    
+    /// Pushes a C closure calling the Swift closure `body`, which may capture state. The closure is kept in a userdata pushed with `pushSwiftObject(_:)` as upvalue 1, so a call reaches it by upvalue index and `__gc` releases it once Lua collects the function. The `n` values on the top of the stack are popped and become upvalues 2 to n + 1.
+    ///
+    /// Like with `pushCFunction(_:)`, raising a Lua error from `body` longjmps over its frame, so nothing reference counted should be alive there when it does.
+    public func pushClosure(n: Int32 = 0, _ body: @escaping (LuaState) -> Int32) {
+        self.pushSwiftObject(LuaClosureBox(body))
+        if n > 0 {
+            self.insert(-(n + 1))
+        }
+        self.pushCClosure({ L in
+            let object = L.toUserData(lua_upvalueindex(1))!.load(as: UnsafeMutableRawPointer.self)
+            return Unmanaged<LuaClosureBox>.fromOpaque(object)._withUnsafeGuaranteedRef { $0.body(L) }
+        }, n: n + 1)
+    }
+}
+
+/// The Swift closure of a C closure pushed by `LuaState.pushClosure(n:_:)`.
+final class LuaClosureBox {
+    let body: (LuaState) -> Int32
+    
+    init(_ body: @escaping (LuaState) -> Int32) {
+        self.body = body
+    }
+}
@@ -248,32 +248,87 @@ public struct Table: ExpressibleByDictionaryLiteral, ExpressibleByArrayLiteral {
     @inlinable
     @inline(__always)
     public init(luaTable: borrowing LuaTable) {
+        let L = luaTable.unsafeLuaTable.luaState
+        let type = L.pushRef(luaTable.unsafeLuaTable.ref)
+        if type != .LUA_TTABLE {
+            assertionFailure()
+            L.pop()
+            self.init()
+            return
+        }
+        self.init(luaState: L, idx: -1)
+        L.pop()
+    }
+    
+    /// Copies the table at the given stack index by walking it with `lua_next` directly on the stack.
+    /// Keys and values are read straight into `Value`, so no registry references are created. Nested tables are copied the same way.
+    @inlinable
+    public init(luaState L: LuaState, idx: Int32) {
         self.init()
-        luaTable.forEach { next in
-            let swiftKey = next.key.copyToSwift()
-            let swiftValue = next.value.copyToSwift()
-            switch swiftKey {
-            case nil, .luaNil:
-                break
-            case .bool(let bool):
-                self[.dictKey(.bool(bool))] = swiftValue ?? .luaNil
-            case .number(let luaNumber):
-                switch luaNumber {
-                case .int(let int):
+        let t = L.absIndex(idx)
+        guard L.checkStack(3) else {
+            assertionFailure()
+            return
+        }
+        self.array.reserveCapacity(Int(L.rawLen(t)))
+        L.pushNil()
+        while L.next(t) {
+            let swiftValue = L.toValue(-1) ?? .luaNil
+            switch L.type(-2) {
+            case .LUA_TBOOLEAN:
+                self[.dictKey(.bool(L.toBoolean(-2)))] = swiftValue
+            case .LUA_TNUMBER:
+                if let int = L.toInteger(-2) {
                     if int > 0 {
-                        self[.arrayKey(int)] = swiftValue ?? .luaNil
+                        self[.arrayKey(int)] = swiftValue
                     } else {
-                        self[.dictKey(.nonIndexNumber(Double(int)))] = swiftValue ?? .luaNil
+                        self[.dictKey(.nonIndexNumber(Double(int)))] = swiftValue
                     }
-                case .double(let double):
-                    self[.dictKey(.nonIndexNumber(double))] = swiftValue ?? .luaNil
+                } else if let double = L.toNumber(-2) {
+                    self[.dictKey(.nonIndexNumber(double))] = swiftValue
+                }
+            case .LUA_TSTRING:
+                // Safe while traversing, as the key is already a string lua_tolstring won't convert it in place.
+                if let stringKey = L.toString(-2) {
+                    self[.dictKey(.string(stringKey))] = swiftValue
                 }
-            case .string(let stringKey):
-                self[.dictKey(.string(stringKey))] = swiftValue ?? .luaNil
-            case .table, .lightUserData:
+            default:
                 break
             }
-            return true
+            L.pop()
+        }
+    }
+}
+
+extension LuaState {
+    /// Copies the value at the given index into a `Value` which isn't associated with the Lua VM, without creating any registry references.
+    /// Returns `nil` for none and for values which can't be represented outside of the VM (functions, userdata and threads).
+    @inlinable
+    public func toValue(_ idx: Int32 = -1) -> Value? {
+        switch self.type(idx) {
+        case .LUA_TNIL:
+            return .luaNil
+        case .LUA_TBOOLEAN:
+            return .bool(toBoolean(idx))
+        case .LUA_TLIGHTUSERDATA:
+            if let lightUserData = toLightUserData(idx) {
+                return .lightUserData(lightUserData)
+            }
+            return .luaNil
+        case .LUA_TNUMBER:
+            if let int = self.toInteger(idx) {
+                return .number(.int(int))
+            } else if let double = self.toNumber(idx) {
+                return .number(.double(double))
+            } else {
+                return .number(.int(0))
+            }
+        case .LUA_TSTRING:
+            return .string(self.toString(idx) ?? "")
+        case .LUA_TTABLE:
+            return .table(Table(luaState: self, idx: idx))
+        default:
+            return nil
         }
     }
 }
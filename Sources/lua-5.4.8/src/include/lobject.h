@@ -544,6 +544,24 @@ typedef struct AbsLineInfo {
   int line;
 } AbsLineInfo;
 
+
+/*
+** Memory of a chunk loaded in place (see 'lua_loadmapped'), which
+** prototypes reference instead of copying. It is released when the
+** last prototype referencing it is freed.
+*/
+typedef struct ExternalData {
+  size_t refs;  /* number of prototypes referencing the memory */
+  const char *mem;
+  size_t size;
+  lua_Release release;
+  void *ud;
+} ExternalData;
+
+/* bits in 'extflags': which arrays of a prototype live in 'ext' */
+#define PF_EXTCODE	1
+#define PF_EXTLINEINFO	2
+
 /*
 ** Function Prototypes
 */
@@ -552,6 +570,7 @@ typedef struct Proto {
   lu_byte numparams;  /* number of fixed (named) parameters */
   lu_byte is_vararg;
   lu_byte maxstacksize;  /* number of registers needed by this function */
+  lu_byte extflags;  /* arrays not allocated by Lua (see PF_EXTCODE) */
   int sizeupvalues;  /* size of 'upvalues' */
   int sizek;  /* size of 'k' */
   int sizecode;
@@ -569,6 +588,7 @@ typedef struct Proto {
   AbsLineInfo *abslineinfo;  /* idem */
   LocVar *locvars;  /* information about local variables (debug information) */
   TString  *source;  /* used for debug information */
+  ExternalData *ext;  /* owner of the arrays in 'extflags' */
   GCObject *gclist;
 } Proto;
 
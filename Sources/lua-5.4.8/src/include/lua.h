@@ -118,6 +118,12 @@ typedef const char * (*lua_Reader) (lua_State *L, void *ud, size_t *sz);
 
 typedef int (*lua_Writer) (lua_State *L, const void *p, size_t sz, void *ud);
 
+/*
+** Type for functions that release the memory of a chunk loaded in place
+** (see lua_loadmapped)
+*/
+typedef void (*lua_Release) (void *ud, const void *p, size_t sz);
+
 
 /*
 ** Type for memory-allocation functions
@@ -245,6 +251,7 @@ LUA_API void        (lua_pushnil) (lua_State *L);
 LUA_API void        (lua_pushnumber) (lua_State *L, lua_Number n);
 LUA_API void        (lua_pushinteger) (lua_State *L, lua_Integer n);
 LUA_API const char *(lua_pushlstring) (lua_State *L, const char *s, size_t len);
+LUA_API char       *(lua_pushbuffstring) (lua_State *L, size_t len);
 LUA_API const char *(lua_pushstring) (lua_State *L, const char *s);
 LUA_API const char *(lua_pushvfstring) (lua_State *L, const char *fmt,
                                                       va_list argp);
@@ -302,6 +309,12 @@ LUA_API int   (lua_load) (lua_State *L, lua_Reader reader, void *dt,
 
 LUA_API int (lua_dump) (lua_State *L, lua_Writer writer, void *data, int strip);
 
+LUA_API int   (lua_loadmapped) (lua_State *L, const char *buff, size_t size,
+                                const char *chunkname, lua_Release release,
+                                void *ud);
+LUA_API int (lua_dumpaligned) (lua_State *L, lua_Writer writer, void *data,
+                               int strip);
+
 
 /*
 ** coroutine functions
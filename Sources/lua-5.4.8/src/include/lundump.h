@@ -25,11 +25,28 @@
 
 #define LUAC_FORMAT	0	/* this is the official format */
 
+/* official format, with code arrays padded to 'Instruction' alignment */
+#define LUAC_FORMAT_ALIGNED	1
+
+/* data for 'luaU_mappedreader': a chunk loaded in place */
+typedef struct MappedChunk {
+  const char *buff;
+  size_t size;
+  lua_Release release;
+  void *ud;
+  ExternalData *ext;  /* created by the first prototype referencing 'buff' */
+  int done;  /* chunk already handed to the loader? */
+} MappedChunk;
+
+LUAI_FUNC const char *luaU_mappedreader (lua_State *L, void *ud, size_t *size);
+
 /* load one chunk; from lundump.c */
 LUAI_FUNC LClosure* luaU_undump (lua_State* L, ZIO* Z, const char* name);
 
 /* dump one chunk; from ldump.c */
 LUAI_FUNC int luaU_dump (lua_State* L, const Proto* f, lua_Writer w,
                          void* data, int strip);
+LUAI_FUNC int luaU_dumpaligned (lua_State* L, const Proto* f, lua_Writer w,
+                                void* data, int strip);
 
 #endif
@@ -0,0 +1,72 @@
+#ifndef swiftalloc_h
+#define swiftalloc_h
+
+#include <stddef.h>
+
+#include "lua.h"
+
+/*
+** Size classes of the slab allocator: blocks of up to
+** LUA_SLAB_NUMCLASSES * LUA_SLAB_GRANULE bytes are carved out of
+** LUA_SLAB_CHUNKSIZE chunks, bigger blocks go to realloc/free
+*/
+#define LUA_SLAB_GRANULE    16
+#define LUA_SLAB_NUMCLASSES 16
+#define LUA_SLAB_MAXSIZE    (LUA_SLAB_GRANULE * LUA_SLAB_NUMCLASSES)
+#define LUA_SLAB_CHUNKSIZE  (64 * 1024)
+
+typedef struct lua_SlabStats {
+    size_t totalbytes;  /* bytes currently allocated by Lua */
+    size_t peakbytes;  /* highest value 'totalbytes' reached */
+    size_t largebytes;  /* part of 'totalbytes' in blocks bigger than LUA_SLAB_MAXSIZE */
+    size_t chunkbytes;  /* bytes reserved for slab chunks */
+    size_t classbytes[LUA_SLAB_NUMCLASSES];  /* bytes in use per size class */
+    size_t classblocks[LUA_SLAB_NUMCLASSES];  /* blocks in use per size class */
+    size_t freeblocks[LUA_SLAB_NUMCLASSES];  /* length of each free list */
+} lua_SlabStats;
+
+/*
+** Creates a state (like luaL_newstate) whose memory comes from a
+** size-class slab allocator owned by the state
+*/
+LUA_API lua_State *lua_newstate_slab (void);
+
+/*
+** Fills 'stats' for a state created by lua_newstate_slab. Returns 0
+** (and leaves 'stats' untouched) for any other state
+*/
+LUA_API int lua_slab_getstats (lua_State *L, lua_SlabStats *stats);
+
+typedef struct lua_MemStats {
+    size_t totalbytes;  /* bytes currently allocated by Lua */
+    size_t peakbytes;  /* highest value 'totalbytes' reached */
+    size_t softlimit;  /* 0 when there is no soft limit */
+    size_t hardlimit;  /* 0 when there is no hard limit */
+    size_t softcollections;  /* emergency collections run at the soft limit */
+    size_t failedallocs;  /* allocations refused at the hard limit */
+} lua_MemStats;
+
+/*
+** Wraps the allocator of 'L' with one that counts the bytes in use,
+** runs an emergency collection when usage passes 'soft' and fails
+** allocations (LUA_ERRMEM) that would pass 'hard'. 0 means no limit.
+** Calling it again only updates the limits. To ask for the collection,
+** the first allocation passing 'soft' fails; code calling the allocator
+** from lua_getallocf directly must retry once after a full collection
+** (lua_gc with LUA_GCCOLLECT), as lmem.c and lauxlib.c do
+*/
+LUA_API void lua_setmemlimit (lua_State *L, size_t soft, size_t hard);
+
+/*
+** Fills 'stats' for a state with a memory limit. Returns 0 (and leaves
+** 'stats' untouched) for any other state
+*/
+LUA_API int lua_getmemstats (lua_State *L, lua_MemStats *stats);
+
+/*
+** Closes the state like lua_close, then releases the allocators it
+** was created with, if it owns any
+*/
+LUA_API void lua_close_allocator (lua_State *L);
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef swiftbudget_h
+#define swiftbudget_h
+
+#include "lua.h"
+
+/* what happens when a coroutine runs out of instructions */
+#define LUA_BUDGETYIELD 0  /* yield, or raise an error where yielding is not possible */
+#define LUA_BUDGETERROR 1  /* raise an error */
+
+/*
+** Gives every coroutine of the state 'budget' VM instructions, counted
+** by a LUA_MASKCOUNT hook firing every 'quantum' instructions. The hook
+** is set on 'L'; coroutines created from it afterwards inherit it, and
+** each of them starts with a full budget. With LUA_BUDGETYIELD an
+** exhausted coroutine yields with no results and gets a full budget
+** again; with LUA_BUDGETERROR it raises an error on every quantum until
+** the budget is set again. Calling it again resets every coroutine's
+** budget. A budget <= 0 behaves like lua_clearbudget
+*/
+LUA_API void lua_setbudget (lua_State *L, lua_Integer budget, int quantum, int mode);
+
+/*
+** Removes the budget of the state and the hook of 'L'. Other coroutines
+** drop their hook the next time it fires
+*/
+LUA_API void lua_clearbudget (lua_State *L);
+
+/*
+** Sets '*remaining' to the instructions 'L' has left (counted in whole
+** quanta). Returns 0 (and leaves '*remaining' untouched) when the state
+** has no budget
+*/
+LUA_API int lua_getbudget (lua_State *L, lua_Integer *remaining);
+
+/*
+** Returns whether the hook of 'L' is the one counting its budget
+*/
+LUA_API int lua_isbudgethook (lua_State *L);
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef swiftbundle_h
+#define swiftbundle_h
+
+#include <stddef.h>
+
+#include "lua.h"
+
+/*
+** Module bundles: many modules (source or binary chunks) in one file,
+** found through a table of contents instead of one path search and one
+** file open per module. All integers are little endian.
+**
+**   header   signature (8 bytes), version (u32), module count (u32),
+**            table of contents size in bytes (u32), reserved (u32)
+**   toc      per module, sorted by name: name length (u16), method (u8),
+**            reserved (u8), offset from the start of the file (u32),
+**            stored size (u32), raw size (u32), FNV-1a hash of the raw
+**            bytes (u64), name bytes
+**   data     the modules, each starting at a multiple of
+**            LUA_BUNDLE_ALIGN so aligned binary chunks can be used
+**            in place (see lua_loadmapped)
+*/
+#define LUA_BUNDLE_SIGNATURE    "\x1bLuaBndl"
+#define LUA_BUNDLE_VERSION      1
+#define LUA_BUNDLE_ALIGN        8
+
+/* how a module is stored */
+#define LUA_BUNDLE_STORED       0
+#define LUA_BUNDLE_LZ           1  /* LZ77 block, see swiftbundle.c */
+
+/* flags for luaL_writebundle */
+#define LUA_BUNDLE_COMPRESS     1  /* compress modules that get smaller */
+
+/* name of the metatable of bundle userdata */
+#define LUA_BUNDLE_HANDLE       "LUA_BUNDLE*"
+
+typedef struct lua_BundleStats {
+    size_t modules;  /* modules in the bundle */
+    size_t loads;  /* modules loaded from the bundle */
+    size_t mapped;  /* loads that used the bundle's bytes in place */
+    size_t decompressed;  /* bytes produced by decompression */
+} lua_BundleStats;
+
+/*
+** Writes the modules of the table at 'idx' (module name -> chunk, as a
+** source or binary string) as a bundle through 'writer', like lua_dump.
+** Returns 0, the error code of the writer, or -1 (with an error message
+** on the stack) when the table holds something else. The stack holds
+** temporaries while 'writer' runs, so it must not keep values on it
+** (as a luaL_Buffer does)
+*/
+LUALIB_API int luaL_writebundle (lua_State *L, int idx, lua_Writer writer,
+                                 void *data, int flags);
+
+/*
+** Checks the bundle in 'buff' and pushes a bundle userdata for it.
+** 'buff' must stay valid until 'release' is called, which happens once
+** the userdata and every function loaded in place from it are
+** collected (or before returning, on errors). 'release' may be NULL.
+** Returns LUA_OK, or LUA_ERRSYNTAX / LUA_ERRMEM with an error message on
+** the stack
+*/
+LUA_API int lua_openbundle (lua_State *L, const char *buff, size_t size,
+                            const char *name, lua_Release release, void *ud);
+
+/*
+** Reads the bundle file 'filename' and pushes a bundle userdata for it.
+** Returns LUA_OK, or LUA_ERRFILE / LUA_ERRSYNTAX with an error message
+*/
+LUALIB_API int luaL_openbundlefile (lua_State *L, const char *filename);
+
+/*
+** Loads module 'modname' from the bundle at 'idx', pushing its chunk
+** like luaL_loadbuffer. Returns -1 and pushes nothing when the bundle
+** has no such module
+*/
+LUALIB_API int luaL_loadbundled (lua_State *L, int idx, const char *modname);
+
+/*
+** Appends the bundle on the top of the stack to 'package.bundles' (in
+** loadlib.c), whose modules 'require' finds before searching
+** 'package.path', and pops it. The package library must be open
+*/
+LUALIB_API void luaL_addbundle (lua_State *L);
+
+/*
+** Fills 'stats' for the bundle at 'idx'. Returns 0 if it is no bundle
+*/
+LUALIB_API int luaL_bundlestats (lua_State *L, int idx, lua_BundleStats *stats);
+
+/*
+** The 'luabundle' command line tool (luabundle.c), for an executable
+** to call from its main
+*/
+LUA_API int luabundle_main (int argc, char **argv);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef swiftpathcache_h
+#define swiftpathcache_h
+
+#include <stddef.h>
+
+#include "lua.h"
+
+/*
+** Path cache of 'require' (loadlib.c). 'searchpath' normally tries
+** every template of 'package.path' and 'package.cpath' with fopen; with
+** the cache it answers from snapshots of directory listings instead,
+** which record both the files a directory has and the directories that
+** do not exist.
+*/
+
+/* cache modes */
+#define LUA_PATHCACHE_OFF       0  /* open every candidate file (default) */
+#define LUA_PATHCACHE_CHECK     1  /* check the mtime of each directory once per search */
+#define LUA_PATHCACHE_TRUST     2  /* no system calls until luaL_invalidatepathcache */
+
+typedef struct luaL_PathCacheStats {
+    size_t hits;  /* file lookups answered by a snapshot */
+    size_t misses;  /* file lookups that had to read a directory or open the file */
+    size_t checks;  /* directory mtime checks */
+    size_t invalidations;  /* snapshots dropped as stale or by luaL_invalidatepathcache */
+} luaL_PathCacheStats;
+
+/*
+** Sets the mode of the path cache of the state. Turning it off drops
+** every snapshot
+*/
+LUALIB_API void luaL_setpathcache (lua_State *L, int mode);
+
+/*
+** Drops every snapshot, e.g. after installing modules while the cache
+** is in LUA_PATHCACHE_TRUST mode
+*/
+LUALIB_API void luaL_invalidatepathcache (lua_State *L);
+
+/*
+** Fills 'stats' and returns the mode of the path cache of the state
+*/
+LUALIB_API int luaL_getpathcache (lua_State *L, luaL_PathCacheStats *stats);
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef swiftrefarena_h
+#define swiftrefarena_h
+
+#include <stddef.h>
+
+#include "lua.h"
+
+/*
+** Reference arenas. Like luaL_ref on the registry, an arena keeps values
+** alive and gives back an integer to push them again, but the values live
+** in a table of its own that is reached without a lookup, free slots are
+** kept on a stack instead of a linked list inside the table, and each
+** reference also carries the generation of its slot, so using one after
+** it was released is detected instead of reaching whatever took its slot.
+** References created while a scope is open are released when it closes.
+*/
+
+typedef struct lua_RefArena lua_RefArena;
+
+typedef struct lua_RefArenaStats {
+    size_t live;  /* references not released yet */
+    size_t peak;  /* highest number of live references */
+    size_t created;  /* references created */
+    size_t released;  /* references released, one by one or by scopes */
+    size_t stale;  /* uses of released references */
+} lua_RefArenaStats;
+
+/*
+** Creates an arena with room for 'capacity' references before growing.
+** It lives until lua_closerefarena or until the state is closed
+*/
+LUA_API lua_RefArena *lua_newrefarena (lua_State *L, int capacity);
+
+/*
+** Releases every reference of the arena, which must not be used again
+*/
+LUA_API void lua_closerefarena (lua_State *L, lua_RefArena *A);
+
+/*
+** Pops a value and returns a reference to it, setting '*gen' to the
+** generation to pass along with it. Any value, nil included, can be kept
+*/
+LUA_API int lua_arenaref (lua_State *L, lua_RefArena *A, unsigned int *gen);
+
+/*
+** Pushes the value of a reference and returns its type. For a released
+** reference it pushes nil and returns LUA_TNONE
+*/
+LUA_API int lua_arenapush (lua_State *L, lua_RefArena *A, int ref, unsigned int gen);
+
+/*
+** Releases a reference. Returns 0 if it was already released
+*/
+LUA_API int lua_arenaunref (lua_State *L, lua_RefArena *A, int ref, unsigned int gen);
+
+/*
+** Opens a scope and returns the mark to close it with
+*/
+LUA_API size_t lua_arenaopenscope (lua_State *L, lua_RefArena *A);
+
+/*
+** Closes the scope opened with 'mark', the innermost one open, releasing
+** every reference created since that is still live
+*/
+LUA_API void lua_arenaclosescope (lua_State *L, lua_RefArena *A, size_t mark);
+
+LUA_API void lua_arenastats (lua_RefArena *A, lua_RefArenaStats *stats);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef swiftrestore_h
+#define swiftrestore_h
+
+#include "lua.h"
+
+/*
+** Gives the table at 'idx' the contents of the table at 'snapshotidx',
+** with raw accesses: keys the snapshot lacks are removed, values that
+** differ are replaced and keys missing are added back. Restoring a table
+** that changed little only assigns what changed, walking both tables
+** directly instead of through lua_next. Returns 0, doing nothing, if
+** either value is not a table
+*/
+LUA_API int lua_restoretable (lua_State *L, int idx, int snapshotidx);
+
+/*
+** Pushes a table holding, at index 'type + 1', the metatable shared by
+** all values of each basic type (nil, booleans, light userdata, numbers,
+** strings, functions, threads), which the registry does not reference
+*/
+LUA_API void lua_getbasicmetatables (lua_State *L);
+
+/*
+** Sets the metatables of the basic types from the table at 'idx', made
+** by lua_getbasicmetatables; types it has no metatable for lose theirs
+*/
+LUA_API void lua_setbasicmetatables (lua_State *L, int idx);
+
+/* collector settings that scripts can change with 'collectgarbage' */
+typedef struct lua_GCSettings {
+    int mode;  /* LUA_GCINC or LUA_GCGEN */
+    int stopped;  /* stopped with LUA_GCSTOP */
+    int pause, stepmul, stepsize;  /* see LUA_GCINC */
+    int minormul, majormul;  /* see LUA_GCGEN */
+} lua_GCSettings;
+
+LUA_API void lua_getgcsettings (lua_State *L, lua_GCSettings *settings);
+
+/*
+** Puts back collector settings saved by lua_getgcsettings, switching
+** mode (which runs a collection) only if it differs
+*/
+LUA_API void lua_setgcsettings (lua_State *L, const lua_GCSettings *settings);
+
+#endif
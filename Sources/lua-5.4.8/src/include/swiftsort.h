@@ -0,0 +1,19 @@
+#ifndef swiftsort_h
+#define swiftsort_h
+
+#include "lua.h"
+
+/* flags of lua_sortarray */
+#define LUA_SORT_STABLE 1  /* keep the order of equal elements */
+
+/*
+** Sorts t[1 .. n] in place with '<', where t is the table at 'idx',
+** when it can do so without calling Lua: t has no metatable, elements
+** 1 to n are in its array part and they are all integers, all floats
+** (none of them NaN) or all strings. Returns 1 if it sorted them, or 0,
+** leaving the table untouched, for the caller to fall back to a
+** generic sort
+*/
+LUA_API int lua_sortarray (lua_State *L, int idx, lua_Integer n, int flags);
+
+#endif
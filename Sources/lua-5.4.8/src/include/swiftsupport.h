@@ -29,6 +29,17 @@ LUA_API void (luaL_newlibtable_nonmacro) (lua_State *L, const luaL_Reg l[]);
 
 LUA_API int luaL_dostring_nonmacro (lua_State *L, const char *str);
 
+/*
+** Adds the decimal numeral of an integer to the buffer, without going
+** through a Lua string
+*/
+LUALIB_API void luaL_addinteger (luaL_Buffer *B, lua_Integer n);
+
+/*
+** Adds a float to the buffer, formatted as 'tostring' formats it
+*/
+LUALIB_API void luaL_addnumber (luaL_Buffer *B, lua_Number n);
+
 #endif
 
 
@@ -535,6 +535,28 @@ LUA_API const char *lua_pushlstring (lua_State *L, const char *s, size_t len) {
 }
 
 
+/*
+** Pushes a new long string of 'len' bytes and returns its contents, for
+** the caller to fill in place before the string is used in any way.
+** Short strings are interned by contents, so they cannot be filled
+** afterwards: for those it pushes nothing and returns NULL.
+*/
+LUA_API char *lua_pushbuffstring (lua_State *L, size_t len) {
+  TString *ts;
+  if (len <= LUAI_MAXSHORTLEN)
+    return NULL;
+  lua_lock(L);
+  if (l_unlikely(len >= (MAX_SIZE - sizeof(TString))))
+    luaM_toobig(L);
+  ts = luaS_createlngstrobj(L, len);
+  setsvalue2s(L, L->top.p, ts);
+  api_incr_top(L);
+  luaC_checkGC(L);
+  lua_unlock(L);
+  return getlngstr(ts);
+}
+
+
 LUA_API const char *lua_pushstring (lua_State *L, const char *s) {
   lua_lock(L);
   if (s == NULL)
@@ -1122,6 +1144,55 @@ LUA_API int lua_dump (lua_State *L, lua_Writer writer, void *data, int strip) {
 }
 
 
+/*
+** Like 'lua_dump', but in LUAC_FORMAT_ALIGNED, whose code arrays can be
+** used in place by 'lua_loadmapped'
+*/
+LUA_API int lua_dumpaligned (lua_State *L, lua_Writer writer, void *data,
+                             int strip) {
+  int status;
+  TValue *o;
+  lua_lock(L);
+  api_checknelems(L, 1);
+  o = s2v(L->top.p - 1);
+  if (isLfunction(o))
+    status = luaU_dumpaligned(L, getproto(o), writer, data, strip);
+  else
+    status = 1;
+  lua_unlock(L);
+  return status;
+}
+
+
+/*
+** Loads a binary chunk without copying its code and line information:
+** the prototypes point into 'buff', which must stay valid and unchanged
+** until 'release' is called, exactly once, when no prototype references
+** it anymore. That is usually from a garbage collection, so 'release'
+** must not call Lua. It is called before returning only when no
+** prototype came to reference 'buff'; a load that fails after that
+** leaves the prototypes it built to the collector, which calls
+** 'release' when it frees them. 'release' may be NULL when the caller
+** keeps 'buff' alive for the life of the state.
+*/
+LUA_API int lua_loadmapped (lua_State *L, const char *buff, size_t size,
+                            const char *chunkname, lua_Release release,
+                            void *ud) {
+  MappedChunk mc;
+  int status;
+  mc.buff = buff;
+  mc.size = size;
+  mc.release = release;
+  mc.ud = ud;
+  mc.ext = NULL;
+  mc.done = 0;
+  status = lua_load(L, luaU_mappedreader, &mc, chunkname, "b");
+  if (mc.ext == NULL && release)  /* nothing kept? */
+    (*release)(ud, buff, size);
+  return status;
+}
+
+
 LUA_API int lua_status (lua_State *L) {
   return L->status;
 }
@@ -478,6 +478,10 @@ static void *resizebox (lua_State *L, int idx, size_t newsize) {
   lua_Alloc allocf = lua_getallocf(L, &ud);
   UBox *box = (UBox *)lua_touserdata(L, idx);
   void *temp = allocf(ud, box->box, box->bsize, newsize);
+  if (l_unlikely(temp == NULL && newsize > 0)) {  /* try again after a full collection, like lmem.c */
+    lua_gc(L, LUA_GCCOLLECT, 0);
+    temp = allocf(ud, box->box, box->bsize, newsize);
+  }
   if (l_unlikely(temp == NULL && newsize > 0)) {  /* allocation error? */
     lua_pushliteral(L, "not enough memory");
     lua_error(L);  /* raise a memory error */
@@ -1106,7 +1110,16 @@ static void warnfon (void *ud, const char *message, int tocont) {
 
 
 LUALIB_API lua_State *luaL_newstate (void) {
-  lua_State *L = lua_newstate(l_alloc, NULL);
+  return luaL_newstatealloc(l_alloc, NULL);
+}
+
+
+/*
+** Same as 'luaL_newstate', but with a custom allocation function
+** (added for LuaSwift)
+*/
+LUALIB_API lua_State *luaL_newstatealloc (lua_Alloc f, void *ud) {
+  lua_State *L = lua_newstate(f, ud);
   if (l_likely(L)) {
     lua_atpanic(L, &panic);
     lua_setwarnf(L, warnfoff, L);  /* default is warnings off */
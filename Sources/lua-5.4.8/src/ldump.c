@@ -26,6 +26,8 @@ typedef struct {
   void *data;
   int strip;
   int status;
+  int aligned;  /* pad code arrays (LUAC_FORMAT_ALIGNED)? */
+  size_t offset;  /* bytes written so far */
 } DumpState;
 
 
@@ -43,6 +45,7 @@ static void dumpBlock (DumpState *D, const void *b, size_t size) {
     lua_unlock(D->L);
     D->status = (*D->writer)(D->L, b, size, D->data);
     lua_lock(D->L);
+    D->offset += size;
   }
 }
 
@@ -103,6 +106,10 @@ static void dumpString (DumpState *D, const TString *s) {
 
 static void dumpCode (DumpState *D, const Proto *f) {
   dumpInt(D, f->sizecode);
+  if (D->aligned) {
+    while (D->status == 0 && D->offset % sizeof(Instruction) != 0)
+      dumpByte(D, 0);
+  }
   dumpVector(D, f->code, f->sizecode);
 }
 
@@ -201,7 +208,7 @@ static void dumpFunction (DumpState *D, const Proto *f, TString *psource) {
 static void dumpHeader (DumpState *D) {
   dumpLiteral(D, LUA_SIGNATURE);
   dumpByte(D, LUAC_VERSION);
-  dumpByte(D, LUAC_FORMAT);
+  dumpByte(D, D->aligned ? LUAC_FORMAT_ALIGNED : LUAC_FORMAT);
   dumpLiteral(D, LUAC_DATA);
   dumpByte(D, sizeof(Instruction));
   dumpByte(D, sizeof(lua_Integer));
@@ -211,20 +218,38 @@ static void dumpHeader (DumpState *D) {
 }
 
 
-/*
-** dump Lua function as precompiled chunk
-*/
-int luaU_dump(lua_State *L, const Proto *f, lua_Writer w, void *data,
-              int strip) {
+static int dump (lua_State *L, const Proto *f, lua_Writer w, void *data,
+                 int strip, int aligned) {
   DumpState D;
   D.L = L;
   D.writer = w;
   D.data = data;
   D.strip = strip;
   D.status = 0;
+  D.aligned = aligned;
+  D.offset = 0;
   dumpHeader(&D);
   dumpByte(&D, f->sizeupvalues);
   dumpFunction(&D, f, NULL);
   return D.status;
 }
 
+
+/*
+** dump Lua function as precompiled chunk
+*/
+int luaU_dump(lua_State *L, const Proto *f, lua_Writer w, void *data,
+              int strip) {
+  return dump(L, f, w, data, strip, 0);
+}
+
+
+/*
+** dump Lua function as precompiled chunk whose code arrays are aligned
+** (relative to its start), so it can be loaded in place
+*/
+int luaU_dumpaligned(lua_State *L, const Proto *f, lua_Writer w, void *data,
+                     int strip) {
+  return dump(L, f, w, data, strip, 1);
+}
+
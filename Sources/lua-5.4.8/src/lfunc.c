@@ -255,6 +255,8 @@ Proto *luaF_newproto (lua_State *L) {
   f->numparams = 0;
   f->is_vararg = 0;
   f->maxstacksize = 0;
+  f->extflags = 0;
+  f->ext = NULL;
   f->locvars = NULL;
   f->sizelocvars = 0;
   f->linedefined = 0;
@@ -265,13 +267,21 @@ Proto *luaF_newproto (lua_State *L) {
 
 
 void luaF_freeproto (lua_State *L, Proto *f) {
-  luaM_freearray(L, f->code, f->sizecode);
+  if (!(f->extflags & PF_EXTCODE))
+    luaM_freearray(L, f->code, f->sizecode);
   luaM_freearray(L, f->p, f->sizep);
   luaM_freearray(L, f->k, f->sizek);
-  luaM_freearray(L, f->lineinfo, f->sizelineinfo);
+  if (!(f->extflags & PF_EXTLINEINFO))
+    luaM_freearray(L, f->lineinfo, f->sizelineinfo);
   luaM_freearray(L, f->abslineinfo, f->sizeabslineinfo);
   luaM_freearray(L, f->locvars, f->sizelocvars);
   luaM_freearray(L, f->upvalues, f->sizeupvalues);
+  if (f->ext != NULL && --f->ext->refs == 0) {  /* last reference? */
+    ExternalData *ext = f->ext;
+    if (ext->release)
+      (*ext->release)(ext->ud, ext->mem, ext->size);
+    luaM_free(L, ext);
+  }
   luaM_free(L, f);
 }
 
@@ -22,6 +22,8 @@
 
 #include "lauxlib.h"
 #include "lualib.h"
+#include "swiftbundle.h"
+#include "swiftpathcache.h"
 
 
 /*
@@ -430,6 +432,345 @@ static int readable (const char *filename) {
 }
 
 
+/*
+** {======================================================
+** Path cache (see swiftpathcache.h)
+** A userdata in registry._PATHCACHE holds the mode and the counters;
+** its user value maps directory names to snapshots. A snapshot maps
+** the names in its directory to true and keeps its kind, the mtime of
+** the directory when it was read and the search in which it was last
+** found valid at small integer keys, which never clash with names.
+** A missing directory stays missing as long as the snapshot of its
+** parent is valid and does not list it, so the usual templates under
+** directories that do not exist cost no system call. Names are
+** compared exactly, also on case-insensitive file systems.
+** =======================================================
+*/
+
+/*
+** LUA_USE_DIRSNAPSHOT makes the cache list directories (with opendir
+** and stat); without it, only LUA_PATHCACHE_TRUST caches, per file.
+*/
+#if !defined(LUA_USE_DIRSNAPSHOT) && \
+    (defined(LUA_USE_POSIX) || defined(__APPLE__) || defined(__linux__))
+#define LUA_USE_DIRSNAPSHOT
+#endif
+
+/* directories with more entries than this are not listed */
+#if !defined(LUA_DIRSNAPSHOTMAX)
+#define LUA_DIRSNAPSHOTMAX	4096
+#endif
+
+
+static const char *const PATHCACHE = "_PATHCACHE";
+
+typedef struct PathCache {
+  int mode;
+  lua_Integer serial;  /* number of the current search */
+  size_t reads;  /* directories read */
+  luaL_PathCacheStats stats;
+} PathCache;
+
+
+#if defined(LUA_USE_DIRSNAPSHOT)	/* { */
+
+#include <dirent.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+
+/* snapshot kinds */
+#define SNAP_DIR	1  /* a listing of the directory */
+#define SNAP_MISSING	2  /* the directory does not exist */
+#define SNAP_UNKNOWN	3  /* cannot be listed: open the files */
+
+/* keys of the snapshot fields */
+#define SNAP_KIND	1
+#define SNAP_STAMP	2
+#define SNAP_SERIAL	3
+
+
+static int statdir (const char *dir, lua_Integer *stamp) {
+  struct stat st;
+  if (stat(dir, &st) != 0)
+    return (errno == ENOENT || errno == ENOTDIR) ? SNAP_MISSING : SNAP_UNKNOWN;
+  if (!S_ISDIR(st.st_mode))
+    return SNAP_MISSING;
+  /* mtimes have whole seconds: a directory changed during the last
+     second may change again with the same mtime, so its snapshot gets
+     a stamp that no check matches (it is read again next time) */
+  *stamp = (st.st_mtime >= time(NULL) - 1) ? -1 : (lua_Integer)st.st_mtime;
+  return SNAP_DIR;
+}
+
+
+/*
+** Pushes the directory part of 'path' ("." when it has none) and
+** returns its last component
+*/
+static const char *pushdirname (lua_State *L, const char *path) {
+  const char *base = path + strlen(path);
+  while (base > path && base[-1] != *LUA_DIRSEP)
+    base--;
+  if (base == path)  /* no separator? */
+    lua_pushliteral(L, ".");
+  else if (base - 1 == path)  /* in the root directory? */
+    lua_pushliteral(L, LUA_DIRSEP);
+  else
+    lua_pushlstring(L, path, (base - 1) - path);
+  return base;
+}
+
+
+/* pushes a new snapshot of 'dir' and returns its kind */
+static int readsnapshot (lua_State *L, PathCache *pc, const char *dir) {
+  lua_Integer stamp = 0;
+  int kind = statdir(dir, &stamp);
+  lua_createtable(L, 3, 0);
+  if (kind == SNAP_DIR) {
+    DIR *d = opendir(dir);
+    pc->reads++;
+    if (d == NULL)
+      kind = SNAP_UNKNOWN;
+    else {
+      struct dirent *e;
+      int n = 0;
+      while ((e = readdir(d)) != NULL) {
+        if (++n > LUA_DIRSNAPSHOTMAX) {
+          kind = SNAP_UNKNOWN;
+          break;
+        }
+        lua_pushboolean(L, 1);
+        lua_setfield(L, -2, e->d_name);
+      }
+      closedir(d);
+    }
+  }
+  lua_pushinteger(L, kind);
+  lua_rawseti(L, -2, SNAP_KIND);
+  lua_pushinteger(L, stamp);
+  lua_rawseti(L, -2, SNAP_STAMP);
+  lua_pushinteger(L, pc->serial);
+  lua_rawseti(L, -2, SNAP_SERIAL);
+  return kind;
+}
+
+
+static lua_Integer snapfield (lua_State *L, int field) {
+  lua_Integer v;
+  lua_rawgeti(L, -1, field);
+  v = lua_tointeger(L, -1);
+  lua_pop(L, 1);
+  return v;
+}
+
+
+static int getsnapshot (lua_State *L, int dirs, PathCache *pc, const char *dir);
+
+/* is the snapshot of 'dir' (of 'kind', on the top) still valid? */
+static int stillvalid (lua_State *L, int dirs, PathCache *pc,
+                       const char *dir, int kind) {
+  lua_Integer stamp = 0;
+  if (kind == SNAP_MISSING) {  /* try to tell from the parent's snapshot */
+    const char *base = pushdirname(L, dir);
+    int res = -1;
+    if (*base != '\0' && strcmp(base, ".") != 0 && strcmp(base, "..") != 0) {
+      int parent = getsnapshot(L, dirs, pc, lua_tostring(L, -1));
+      if (parent == SNAP_MISSING)
+        res = 1;
+      else if (parent == SNAP_DIR) {
+        res = (lua_getfield(L, -1, base) == LUA_TNIL);
+        lua_pop(L, 1);
+      }
+      lua_pop(L, 1);  /* parent snapshot */
+    }
+    lua_pop(L, 1);  /* parent name */
+    if (res != -1)
+      return res;
+  }
+  pc->stats.checks++;
+  switch (statdir(dir, &stamp)) {
+    case SNAP_DIR:  /* unchanged, and listed or too big to list? */
+      return (kind != SNAP_MISSING && stamp != -1 &&
+              snapfield(L, SNAP_STAMP) == stamp);
+    case SNAP_MISSING:
+      return (kind == SNAP_MISSING);
+    default:  /* cannot even be checked */
+      return (kind == SNAP_UNKNOWN);
+  }
+}
+
+
+/* pushes a valid snapshot of 'dir' and returns its kind */
+static int getsnapshot (lua_State *L, int dirs, PathCache *pc, const char *dir) {
+  int kind;
+  if (lua_getfield(L, dirs, dir) == LUA_TTABLE) {
+    kind = (int)snapfield(L, SNAP_KIND);
+    if (pc->mode == LUA_PATHCACHE_TRUST || snapfield(L, SNAP_SERIAL) == pc->serial)
+      return kind;
+    if (stillvalid(L, dirs, pc, dir, kind)) {
+      lua_pushinteger(L, pc->serial);
+      lua_rawseti(L, -2, SNAP_SERIAL);
+      return kind;
+    }
+    pc->stats.invalidations++;
+  }
+  lua_pop(L, 1);
+  kind = readsnapshot(L, pc, dir);
+  lua_pushvalue(L, -1);
+  lua_setfield(L, dirs, dir);
+  return kind;
+}
+
+
+static int cachedreadable (lua_State *L, int dirs, PathCache *pc,
+                           const char *filename) {
+  size_t reads = pc->reads;
+  const char *base = pushdirname(L, filename);
+  int kind = getsnapshot(L, dirs, pc, lua_tostring(L, -1));
+  int res;
+  if (kind == SNAP_DIR) {
+    res = (*base != '\0' && lua_getfield(L, -1, base) != LUA_TNIL);
+    lua_pop(L, 1);
+    if (res && pc->mode == LUA_PATHCACHE_CHECK)
+      res = readable(filename);  /* listed, but can it be opened? */
+  }
+  else if (kind == SNAP_MISSING)
+    res = 0;
+  else
+    res = readable(filename);
+  lua_pop(L, 2);  /* snapshot and directory name */
+  if (kind == SNAP_UNKNOWN || pc->reads != reads)
+    pc->stats.misses++;
+  else
+    pc->stats.hits++;
+  return res;
+}
+
+#else				/* }{ */
+
+static int cachedreadable (lua_State *L, int dirs, PathCache *pc,
+                           const char *filename) {
+  int res;
+  if (pc->mode == LUA_PATHCACHE_TRUST) {
+    if (lua_getfield(L, dirs, filename) != LUA_TNIL) {
+      res = lua_toboolean(L, -1);
+      lua_pop(L, 1);
+      pc->stats.hits++;
+      return res;
+    }
+    lua_pop(L, 1);
+  }
+  res = readable(filename);
+  pc->stats.misses++;
+  if (pc->mode == LUA_PATHCACHE_TRUST) {
+    lua_pushboolean(L, res);
+    lua_setfield(L, dirs, filename);
+  }
+  return res;
+}
+
+#endif				/* } */
+
+
+/*
+** Pushes the user value of the path cache and returns the cache when
+** it is on; returns NULL, pushing nothing, otherwise
+*/
+static PathCache *getpathcache (lua_State *L) {
+  PathCache *pc = NULL;
+  if (lua_getfield(L, LUA_REGISTRYINDEX, PATHCACHE) == LUA_TUSERDATA) {
+    pc = (PathCache *)lua_touserdata(L, -1);
+    if (pc->mode != LUA_PATHCACHE_OFF) {
+      lua_getiuservalue(L, -1, 1);
+      lua_remove(L, -2);
+      pc->serial++;  /* a new search */
+      return pc;
+    }
+    pc = NULL;
+  }
+  lua_pop(L, 1);
+  return pc;
+}
+
+
+LUALIB_API void luaL_setpathcache (lua_State *L, int mode) {
+  PathCache *pc;
+  if (lua_getfield(L, LUA_REGISTRYINDEX, PATHCACHE) == LUA_TUSERDATA)
+    pc = (PathCache *)lua_touserdata(L, -1);
+  else {
+    lua_pop(L, 1);
+    pc = (PathCache *)lua_newuserdatauv(L, sizeof(PathCache), 1);
+    memset(pc, 0, sizeof(PathCache));
+    lua_newtable(L);
+    lua_setiuservalue(L, -2, 1);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, LUA_REGISTRYINDEX, PATHCACHE);
+  }
+  if (mode == LUA_PATHCACHE_OFF) {  /* drop the snapshots */
+    lua_newtable(L);
+    lua_setiuservalue(L, -2, 1);
+  }
+  pc->mode = mode;
+  lua_pop(L, 1);
+}
+
+
+LUALIB_API void luaL_invalidatepathcache (lua_State *L) {
+  if (lua_getfield(L, LUA_REGISTRYINDEX, PATHCACHE) == LUA_TUSERDATA) {
+    PathCache *pc = (PathCache *)lua_touserdata(L, -1);
+    pc->stats.invalidations++;
+    lua_newtable(L);
+    lua_setiuservalue(L, -2, 1);
+  }
+  lua_pop(L, 1);
+}
+
+
+LUALIB_API int luaL_getpathcache (lua_State *L, luaL_PathCacheStats *stats) {
+  int mode = LUA_PATHCACHE_OFF;
+  memset(stats, 0, sizeof(*stats));
+  if (lua_getfield(L, LUA_REGISTRYINDEX, PATHCACHE) == LUA_TUSERDATA) {
+    PathCache *pc = (PathCache *)lua_touserdata(L, -1);
+    *stats = pc->stats;
+    mode = pc->mode;
+  }
+  lua_pop(L, 1);
+  return mode;
+}
+
+
+static int ll_pathcache (lua_State *L) {
+  static const char *const opts[] = {"off", "check", "trust",
+                                     "invalidate", "count", NULL};
+  static const int modes[] = {LUA_PATHCACHE_OFF, LUA_PATHCACHE_CHECK,
+                              LUA_PATHCACHE_TRUST};
+  int o = luaL_checkoption(L, 1, "count", opts);
+  switch (o) {
+    case 3: {
+      luaL_invalidatepathcache(L);
+      return 0;
+    }
+    case 4: {
+      luaL_PathCacheStats stats;
+      int mode = luaL_getpathcache(L, &stats);
+      lua_pushinteger(L, (lua_Integer)stats.hits);
+      lua_pushinteger(L, (lua_Integer)stats.misses);
+      lua_pushinteger(L, (lua_Integer)stats.checks);
+      lua_pushinteger(L, (lua_Integer)stats.invalidations);
+      lua_pushstring(L, opts[mode]);
+      return 5;
+    }
+    default: {
+      luaL_setpathcache(L, modes[o]);
+      return 0;
+    }
+  }
+}
+
+/* }====================================================== */
+
+
 /*
 ** Get the next name in '*path' = 'name1;name2;name3;...', changing
 ** the ending ';' to '\0' to create a zero-terminated string. Return
@@ -477,9 +818,13 @@ static const char *searchpath (lua_State *L, const char *name,
   char *pathname;  /* path with name inserted */
   char *endpathname;  /* its end */
   const char *filename;
+  PathCache *pc;
+  int dirs;
   /* separator is non-empty and appears in 'name'? */
   if (*sep != '\0' && strchr(name, *sep) != NULL)
     name = luaL_gsub(L, name, sep, dirsep);  /* replace it by 'dirsep' */
+  pc = getpathcache(L);
+  dirs = lua_gettop(L);  /* snapshots, when 'pc' is not NULL */
   luaL_buffinit(L, &buff);
   /* add path to the buffer, replacing marks ('?') with the file name */
   luaL_addgsub(&buff, path, LUA_PATH_MARK, name);
@@ -487,7 +832,8 @@ static const char *searchpath (lua_State *L, const char *name,
   pathname = luaL_buffaddr(&buff);  /* writable list of file names */
   endpathname = pathname + luaL_bufflen(&buff) - 1;
   while ((filename = getnextfilename(&pathname, endpathname)) != NULL) {
-    if (readable(filename))  /* does file exist and is readable? */
+    if (pc != NULL ? cachedreadable(L, dirs, pc, filename)
+                   : readable(filename))  /* does file exist and is readable? */
       return lua_pushstring(L, filename);  /* save and return name */
   }
   luaL_pushresult(&buff);  /* push path to create error message */
@@ -612,6 +958,66 @@ static int searcher_preload (lua_State *L) {
 }
 
 
+/*
+** {======================================================
+** Bundles
+** 'package.bundles' lists bundle userdata (see swiftbundle.h), searched
+** in order by a binary search of their tables of contents, so a module
+** in a bundle costs no path search and no file open.
+** =======================================================
+*/
+
+static int searcher_bundle (lua_State *L) {
+  const char *name = luaL_checkstring(L, 1);
+  int i;
+  if (lua_getfield(L, lua_upvalueindex(1), "bundles") != LUA_TTABLE)
+    return 0;  /* no bundles */
+  for (i = 1; lua_rawgeti(L, 2, i) != LUA_TNIL; i++) {
+    int stat = luaL_loadbundled(L, 3, name);
+    if (stat != -1) {  /* module found? */
+      lua_getiuservalue(L, 3, 1);  /* bundle name */
+      if (l_likely(stat == LUA_OK))
+        return 2;  /* return open function and bundle name */
+      return luaL_error(L, "error loading module '%s' from bundle '%s':\n\t%s",
+                           name, lua_tostring(L, -1), lua_tostring(L, -2));
+    }
+    lua_pop(L, 1);  /* bundle */
+  }
+  if (i == 1)
+    return 0;  /* empty list: nothing to report */
+  lua_pushfstring(L, "no module '%s' in package.bundles", name);
+  return 1;
+}
+
+
+LUALIB_API void luaL_addbundle (lua_State *L) {
+  luaL_checkudata(L, -1, LUA_BUNDLE_HANDLE);
+  lua_getfield(L, LUA_REGISTRYINDEX, LUA_LOADED_TABLE);
+  if (lua_getfield(L, -1, LUA_LOADLIBNAME) != LUA_TTABLE)
+    luaL_error(L, "package library not open");
+  if (lua_getfield(L, -1, "bundles") != LUA_TTABLE)
+    luaL_error(L, "'package.bundles' must be a table");
+  lua_pushvalue(L, -4);
+  lua_rawseti(L, -2, luaL_len(L, -2) + 1);
+  lua_pop(L, 4);  /* LOADED, package, bundles and the bundle */
+}
+
+
+static int ll_addbundle (lua_State *L) {
+  const char *filename = luaL_checkstring(L, 1);
+  if (luaL_openbundlefile(L, filename) != LUA_OK) {
+    luaL_pushfail(L);
+    lua_insert(L, -2);
+    return 2;  /* return fail + error message */
+  }
+  lua_pushvalue(L, -1);
+  luaL_addbundle(L);
+  return 1;  /* return the bundle */
+}
+
+/* }====================================================== */
+
+
 static void findloader (lua_State *L, const char *name) {
   int i;
   luaL_Buffer msg;  /* to build error message */
@@ -682,11 +1088,14 @@ static int ll_require (lua_State *L) {
 static const luaL_Reg pk_funcs[] = {
   {"loadlib", ll_loadlib},
   {"searchpath", ll_searchpath},
+  {"addbundle", ll_addbundle},
+  {"pathcache", ll_pathcache},
   /* placeholders */
   {"preload", NULL},
   {"cpath", NULL},
   {"path", NULL},
   {"searchers", NULL},
+  {"bundles", NULL},
   {"loaded", NULL},
   {NULL, NULL}
 };
@@ -701,6 +1110,7 @@ static const luaL_Reg ll_funcs[] = {
 static void createsearcherstable (lua_State *L) {
   static const lua_CFunction searchers[] = {
     searcher_preload,
+    searcher_bundle,
     searcher_Lua,
     searcher_C,
     searcher_Croot,
@@ -749,6 +1159,9 @@ LUAMOD_API int luaopen_package (lua_State *L) {
   /* set field 'preload' */
   luaL_getsubtable(L, LUA_REGISTRYINDEX, LUA_PRELOAD_TABLE);
   lua_setfield(L, -2, "preload");
+  /* set field 'bundles' */
+  lua_newtable(L);
+  lua_setfield(L, -2, "bundles");
   lua_pushglobaltable(L);
   lua_pushvalue(L, -2);  /* set 'package' as upvalue for next lib */
   luaL_setfuncs(L, ll_funcs, 1);  /* open lib into global table */
@@ -355,10 +355,17 @@ static const luaL_Reg stringmetamethods[] = {
 #define CAP_POSITION	(-2)
 
 
+/* set of characters, one bit for each */
+typedef struct CharSet {
+  unsigned int bits[(UCHAR_MAX + 1) / 32];
+} CharSet;
+
+
 typedef struct MatchState {
   const char *src_init;  /* init of source string */
   const char *src_end;  /* end ('\0') of source string */
   const char *p_end;  /* end ('\0') of pattern */
+  const CharSet *sets;  /* character sets of the compiled pattern, if any */
   lua_State *L;
   int matchdepth;  /* control for recursive depth (to avoid C stack overflow) */
   unsigned char level;  /* total number of captures (finished or unfinished) */
@@ -483,14 +490,10 @@ static int singlematch (MatchState *ms, const char *s, const char *p,
 }
 
 
-static const char *matchbalance (MatchState *ms, const char *s,
-                                   const char *p) {
-  if (l_unlikely(p >= ms->p_end - 1))
-    luaL_error(ms->L, "malformed pattern (missing arguments to '%%b')");
-  if (*s != *p) return NULL;
+/* matches a string balanced between 'b' and 'e' */
+static const char *balance (MatchState *ms, const char *s, int b, int e) {
+  if (*s != b) return NULL;
   else {
-    int b = *p;
-    int e = *(p+1);
     int cont = 1;
     while (++s < ms->src_end) {
       if (*s == e) {
@@ -503,6 +506,14 @@ static const char *matchbalance (MatchState *ms, const char *s,
 }
 
 
+static const char *matchbalance (MatchState *ms, const char *s,
+                                   const char *p) {
+  if (l_unlikely(p >= ms->p_end - 1))
+    luaL_error(ms->L, "malformed pattern (missing arguments to '%%b')");
+  return balance(ms, s, *p, *(p+1));
+}
+
+
 static const char *max_expand (MatchState *ms, const char *s,
                                  const char *p, const char *ep) {
   ptrdiff_t i = 0;  /* counts maximum expand for item */
@@ -670,12 +681,142 @@ static const char *match (MatchState *ms, const char *s, const char *p) {
 
 
 
+/*
+** {======================================================
+** Substring search
+** 'memchr' finds candidates by the first character of the needle. When
+** that character turns out to be common (e.g. a space in text), the
+** search switches to SIMD (SSE2, AVX2 or NEON, as compiled for): the
+** first and the last characters are checked for a whole vector of
+** positions at once, and only positions where both match are compared
+** in full. Define LUA_NOVECTORFIND to always use 'memchr' alone.
+** =======================================================
+*/
+
+#if !defined(LUA_NOVECTORFIND) && defined(__GNUC__)
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define VECFIND_X86
+#define VF_WIDTH	32
+typedef __m256i vf_vec;
+#define vf_splat(c)	_mm256_set1_epi8(c)
+#define vf_load(p)	_mm256_loadu_si256((const __m256i *)(p))
+#define vf_mask(f,l,a,b)  ((unsigned int)_mm256_movemask_epi8( \
+	_mm256_and_si256(_mm256_cmpeq_epi8(f, a), _mm256_cmpeq_epi8(l, b))))
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define VECFIND_X86
+#define VF_WIDTH	16
+typedef __m128i vf_vec;
+#define vf_splat(c)	_mm_set1_epi8(c)
+#define vf_load(p)	_mm_loadu_si128((const __m128i *)(p))
+#define vf_mask(f,l,a,b)  ((unsigned int)_mm_movemask_epi8( \
+	_mm_and_si128(_mm_cmpeq_epi8(f, a), _mm_cmpeq_epi8(l, b))))
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+#define VECFIND_NEON
+#define VF_WIDTH	16
+#endif
+#endif
+
+
+/*
+** false candidates 'lmemfind' takes from 'memchr' before switching to
+** 'vecfind': 'memchr' is faster while the first character is rare
+*/
+#define VF_MAXMISSES	8
+
+
+#if defined(VECFIND_X86)
+
+/*
+** Returns the first position of 'mask' (bit i for position 'i' of 's1')
+** where all of 's2' matches, or NULL
+*/
+static const char *vf_check (const char *s1, unsigned int mask,
+                             const char *s2, size_t l2) {
+  while (mask != 0) {  /* for each position matching both ends */
+    const char *s = s1 + __builtin_ctz(mask);
+    if (memcmp(s + 1, s2 + 1, l2 - 2) == 0)
+      return s;
+    mask &= mask - 1;
+  }
+  return NULL;
+}
+
+
+/*
+** Searches 's2' ('l2' >= 2) in the first positions of 's1', a vector of
+** them at a time, while the vectors fit in 's1'. Returns the match, or
+** NULL with the number of positions searched in '*done'.
+*/
+static const char *vecfind (const char *s1, size_t l1,
+                            const char *s2, size_t l2, size_t *done) {
+  const vf_vec first = vf_splat(s2[0]);
+  const vf_vec last = vf_splat(s2[l2 - 1]);
+  const char *res;
+  size_t i = 0;
+  /* two vectors per step: most steps find no candidate in either */
+  for (; l1 - i >= 2 * VF_WIDTH + l2 - 1; i += 2 * VF_WIDTH) {
+    unsigned int mask1 = vf_mask(first, last, vf_load(s1 + i),
+                                 vf_load(s1 + i + l2 - 1));
+    unsigned int mask2 = vf_mask(first, last, vf_load(s1 + i + VF_WIDTH),
+                                 vf_load(s1 + i + VF_WIDTH + l2 - 1));
+    if ((mask1 | mask2) != 0) {
+      if ((res = vf_check(s1 + i, mask1, s2, l2)) != NULL ||
+          (res = vf_check(s1 + i + VF_WIDTH, mask2, s2, l2)) != NULL)
+        return res;
+    }
+  }
+  if (l1 - i >= VF_WIDTH + l2 - 1) {  /* one more vector fits? */
+    unsigned int mask = vf_mask(first, last, vf_load(s1 + i),
+                                vf_load(s1 + i + l2 - 1));
+    if ((res = vf_check(s1 + i, mask, s2, l2)) != NULL)
+      return res;
+    i += VF_WIDTH;
+  }
+  *done = i;
+  return NULL;
+}
+
+#elif defined(VECFIND_NEON)
+
+/* same as above, with a mask of 4 bits per position (NEON has no movemask) */
+static const char *vecfind (const char *s1, size_t l1,
+                            const char *s2, size_t l2, size_t *done) {
+  const uint8x16_t first = vdupq_n_u8(uchar(s2[0]));
+  const uint8x16_t last = vdupq_n_u8(uchar(s2[l2 - 1]));
+  size_t i;
+  for (i = 0; l1 - i >= VF_WIDTH + l2 - 1; i += VF_WIDTH) {
+    uint8x16_t eq = vandq_u8(
+        vceqq_u8(first, vld1q_u8((const uint8_t *)(s1 + i))),
+        vceqq_u8(last, vld1q_u8((const uint8_t *)(s1 + i + l2 - 1))));
+    uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(
+        vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+    while (mask != 0) {  /* for each position matching both ends */
+      int bit = __builtin_ctzll(mask);
+      size_t pos = i + (size_t)(bit >> 2);
+      if (memcmp(s1 + pos + 1, s2 + 1, l2 - 2) == 0)
+        return s1 + pos;
+      mask &= ~((uint64_t)0xF << (bit & ~3));
+    }
+  }
+  *done = i;
+  return NULL;
+}
+
+#endif
+
+
 static const char *lmemfind (const char *s1, size_t l1,
                                const char *s2, size_t l2) {
   if (l2 == 0) return s1;  /* empty strings are everywhere */
   else if (l2 > l1) return NULL;  /* avoids a negative 'l1' */
   else {
     const char *init;  /* to search for a '*s2' inside 's1' */
+#if defined(VF_WIDTH)
+    int misses = 0;  /* false candidates found by 'memchr' */
+#endif
     l2--;  /* 1st char will be checked by 'memchr' */
     l1 = l1-l2;  /* 's2' cannot be found after that */
     while (l1 > 0 && (init = (const char *)memchr(s1, *s2, l1)) != NULL) {
@@ -686,11 +827,23 @@ static const char *lmemfind (const char *s1, size_t l1,
         l1 -= init-s1;
         s1 = init;
       }
+#if defined(VF_WIDTH)
+      /* 1st char is common? then filter by both ends with SIMD */
+      if (l2 > 0 && ++misses == VF_MAXMISSES) {
+        size_t done;
+        if ((init = vecfind(s1, l1 + l2, s2, l2 + 1, &done)) != NULL)
+          return init;
+        l1 -= done;  /* search the rest with 'memchr' */
+        s1 += done;
+      }
+#endif
     }
     return NULL;  /* not found */
   }
 }
 
+/* }====================================================== */
+
 
 /*
 ** get information about the i-th capture. If there are no captures
@@ -754,6 +907,22 @@ static int nospecials (const char *p, size_t l) {
 }
 
 
+/*
+** Length of the literal prefix of a pattern: the plain characters any
+** match starts with. A character followed by a quantifier is not part
+** of it. Matches can only start where the prefix occurs, so callers skip
+** to its next occurrence with 'lmemfind' before trying 'match'.
+*/
+static size_t literalprefix (const char *p, size_t lp) {
+  size_t i = 0;
+  while (i < lp && (p[i] == '\0' || strchr(SPECIALS ")", p[i]) == NULL))
+    i++;
+  if (i > 0 && i < lp && strchr("*+-?", p[i]) != NULL)
+    i--;  /* last character is repeated or optional */
+  return i;
+}
+
+
 static void prepstate (MatchState *ms, lua_State *L,
                        const char *s, size_t ls, const char *p, size_t lp) {
   ms->L = L;
@@ -761,6 +930,7 @@ static void prepstate (MatchState *ms, lua_State *L,
   ms->src_init = s;
   ms->src_end = s + ls;
   ms->p_end = p + lp;
+  ms->sets = NULL;
 }
 
 
@@ -770,6 +940,807 @@ static void reprepstate (MatchState *ms) {
 }
 
 
+/*
+** {======================================================
+** Compiled patterns
+** A pattern is compiled on first use into a sequence of instructions,
+** one per pattern item, where each single-character class ('x', '.',
+** '%a', '[...]') becomes a set of 256 bits, so matching a character
+** tests one bit instead of parsing the class again. 'cmatch' follows
+** 'match' step by step (recursing where it recurses, so the limit on
+** its depth is reached at the same point) and shares its handling of
+** captures and back references. A cache kept as an upvalue of the
+** string functions maps pattern strings to their compiled forms, and
+** evicts the least recently used. Patterns that are malformed or too
+** long are not compiled: 'match' interprets them, raising any error
+** when it reaches the bad item, as before.
+** Once a compiled pattern has been used LUA_PATJITTHRESHOLD times, it
+** is specialized: runs of plain characters become one comparison,
+** greedy repetitions that backtracking can never shorten successfully
+** become plain loops, and the characters a match can start with are
+** kept, so callers skip positions where no match can start.
+** =======================================================
+*/
+
+/* opcodes of compiled patterns */
+#define OP_END		0	/* end of pattern */
+#define OP_CHAR		1	/* character 'a', with quantifier 'rep' */
+#define OP_SET		2	/* character in set 'a', with quantifier 'rep' */
+#define OP_OPEN		3	/* '(' */
+#define OP_POSITION	4	/* '()' */
+#define OP_CLOSE	5	/* ')' */
+#define OP_EOS		6	/* '$' at the end of the pattern */
+#define OP_BALANCE	7	/* '%b' with delimiters 'a' and 'b' */
+#define OP_FRONTIER	8	/* '%f' with set 'a' */
+#define OP_BACKREF	9	/* '%1'-'%9'; 'a' is the digit */
+/* opcodes of specialized patterns */
+#define OP_LITERAL	10	/* 'a' characters, in the next instructions */
+#define OP_SPANCHAR	11	/* possessive run of character 'a' */
+#define OP_SPANSET	12	/* possessive run of characters in set 'a' */
+
+typedef struct PatInstr {
+  unsigned char op;
+  unsigned char rep;  /* '*', '+', '-', '?' or '\0' */
+  unsigned char a, b;
+} PatInstr;
+
+
+/* maximum number of instructions of a compiled pattern */
+#if !defined(LUA_PATMAXCODE)
+#define LUA_PATMAXCODE		128
+#endif
+
+/* maximum number of distinct sets of a compiled pattern */
+#define PATMAXSETS		32
+
+/* number of compiled patterns cached by each state */
+#if !defined(LUA_PATCACHESIZE)
+#define LUA_PATCACHESIZE	64
+#endif
+
+#define PATBUCKETS		(2 * LUA_PATCACHESIZE)
+
+/* uses after which compiled patterns are specialized */
+#if !defined(LUA_PATJITTHRESHOLD)
+#define LUA_PATJITTHRESHOLD	16
+#endif
+
+/* maximum length of the name of the locale kept by compiled patterns */
+#define PATLOCALELEN		32
+
+
+/*
+** A compiled pattern, in a userdata whose user value is the pattern
+** string, so the string lives (and its address identifies it) as long
+** as the compiled pattern. Sets of classes such as '%a' follow the
+** current locale; patterns using them ('ctype') keep the name of the
+** locale they were compiled in and are compiled again if it changes.
+*/
+typedef struct PatProg {
+  const CharSet *sets;  /* 'nsets' sets, after the structure */
+  const PatInstr *code;  /* instructions, after the sets */
+  size_t lprefix;  /* length of the literal prefix (see 'literalprefix') */
+  int nsets;
+  int ncode;  /* instructions; room for as many follows, for 'specialize' */
+  int ctype;  /* do the sets depend on LC_CTYPE? */
+  unsigned int uses;  /* times used before being specialized */
+  int specialized;
+  int firstchar;  /* single character matches start with, or -1 */
+  int hasfirst;  /* do matches start with a character in 'first'? */
+  CharSet first;
+  char locale[PATLOCALELEN];  /* LC_CTYPE when compiled, if 'ctype' */
+} PatProg;
+
+
+typedef struct PatCompiler {
+  int ncode, nsets;
+  int ctype;
+  PatInstr code[LUA_PATMAXCODE];
+  CharSet sets[PATMAXSETS];
+} PatCompiler;
+
+
+#define setadd(cs,c)	((cs)->bits[(c) >> 5] |= 1u << ((c) & 31))
+#define setin(cs,c)	(((cs)->bits[(c) >> 5] >> ((c) & 31)) & 1u)
+
+
+/* classes whose characters depend on the locale */
+#define isctypeclass(cl)	(isalpha(uchar(cl)) && tolower(uchar(cl)) != 'z')
+
+
+/*
+** End of the single-character class at 'p', as 'classend', or NULL if
+** the class is malformed
+*/
+static const char *classlimit (const char *p, const char *p_end) {
+  switch (*p++) {
+    case L_ESC: {
+      return (p == p_end) ? NULL : p+1;
+    }
+    case '[': {
+      if (*p == '^') p++;
+      do {  /* look for a ']' */
+        if (p == p_end)
+          return NULL;
+        if (*(p++) == L_ESC && p < p_end)
+          p++;  /* skip escapes (e.g. '%]') */
+      } while (*p != ']');
+      return p+1;
+    }
+    default: {
+      return p;
+    }
+  }
+}
+
+
+static int emit (PatCompiler *pc, int op, int rep, int a, int b) {
+  PatInstr *i;
+  if (pc->ncode == LUA_PATMAXCODE)
+    return 0;  /* too long */
+  i = &pc->code[pc->ncode++];
+  i->op = (unsigned char)op;
+  i->rep = (unsigned char)rep;
+  i->a = (unsigned char)a;
+  i->b = (unsigned char)b;
+  return 1;
+}
+
+
+/* adds set 'cs' (once); returns its index, or -1 if there is no room */
+static int addset (PatCompiler *pc, const CharSet *cs) {
+  int i;
+  for (i = 0; i < pc->nsets; i++) {
+    if (memcmp(&pc->sets[i], cs, sizeof(CharSet)) == 0)
+      return i;
+  }
+  if (pc->nsets == PATMAXSETS)
+    return -1;
+  pc->sets[i] = *cs;
+  return pc->nsets++;
+}
+
+
+/*
+** Set of the characters matched by the class at 'p' (ending at 'ep');
+** returns how many there are
+*/
+static int buildset (PatCompiler *pc, CharSet *cs, const char *p,
+                                                   const char *ep) {
+  int c, n = 0;
+  memset(cs, 0, sizeof(CharSet));
+  for (c = 0; c <= UCHAR_MAX; c++) {
+    int in;
+    switch (*p) {
+      case '.': in = 1; break;
+      case L_ESC: in = match_class(c, uchar(*(p+1))); break;
+      case '[': in = matchbracketclass(c, p, ep-1); break;
+      default: in = (uchar(*p) == c); break;
+    }
+    if (in) {
+      setadd(cs, c);
+      n++;
+    }
+  }
+  if ((*p == L_ESC && isctypeclass(*(p+1))) ||
+      (*p == '[' && memchr(p, L_ESC, ep - p) != NULL))
+    pc->ctype = 1;  /* depends on the locale */
+  return n;
+}
+
+
+/* compiles a single-character class with quantifier 'rep' */
+static int compileclass (PatCompiler *pc, const char *p, const char *ep,
+                                          int rep) {
+  CharSet cs;
+  int i;
+  if (*p != '.' && *p != '[' && *p != L_ESC)
+    return emit(pc, OP_CHAR, rep, uchar(*p), 0);
+  else if (buildset(pc, &cs, p, ep) == 1) {  /* a single character? */
+    for (i = 0; !setin(&cs, i); i++) ;
+    return emit(pc, OP_CHAR, rep, i, 0);
+  }
+  else
+    return (i = addset(pc, &cs)) >= 0 && emit(pc, OP_SET, rep, i, 0);
+}
+
+
+/*
+** Compiles pattern 'p' (without the anchor). Returns 0 if the pattern
+** is malformed or too long
+*/
+static int compilepattern (PatCompiler *pc, const char *p,
+                                            const char *p_end) {
+  CharSet cs;
+  const char *ep;
+  int rep, i;
+  pc->ncode = pc->nsets = pc->ctype = 0;
+  while (p < p_end) {
+    switch (*p) {
+      case '(': {
+        if (*(p + 1) == ')') {
+          if (!emit(pc, OP_POSITION, 0, 0, 0)) return 0;
+          p += 2;
+        }
+        else {
+          if (!emit(pc, OP_OPEN, 0, 0, 0)) return 0;
+          p++;
+        }
+        continue;
+      }
+      case ')': {
+        if (!emit(pc, OP_CLOSE, 0, 0, 0)) return 0;
+        p++;
+        continue;
+      }
+      case '$': {
+        if (p + 1 != p_end)
+          break;  /* a plain character */
+        if (!emit(pc, OP_EOS, 0, 0, 0)) return 0;
+        p++;
+        continue;
+      }
+      case L_ESC: {
+        switch (*(p + 1)) {
+          case 'b': {
+            if (p + 2 >= p_end - 1)
+              return 0;  /* missing arguments */
+            if (!emit(pc, OP_BALANCE, 0, uchar(*(p + 2)), uchar(*(p + 3))))
+              return 0;
+            p += 4;
+            continue;
+          }
+          case 'f': {
+            if (*(p + 2) != '[' || (ep = classlimit(p + 2, p_end)) == NULL)
+              return 0;  /* malformed frontier */
+            buildset(pc, &cs, p + 2, ep);
+            if ((i = addset(pc, &cs)) < 0 || !emit(pc, OP_FRONTIER, 0, i, 0))
+              return 0;
+            p = ep;
+            continue;
+          }
+          case '0': case '1': case '2': case '3':
+          case '4': case '5': case '6': case '7':
+          case '8': case '9': {
+            if (!emit(pc, OP_BACKREF, 0, uchar(*(p + 1)), 0)) return 0;
+            p += 2;
+            continue;
+          }
+          default: break;
+        }
+        break;
+      }
+      default: break;
+    }
+    /* single-character class plus optional suffix */
+    if ((ep = classlimit(p, p_end)) == NULL)
+      return 0;  /* malformed class */
+    switch (*ep) {  /* ('\0' at the end of the pattern) */
+      case '*': case '+': case '-': case '?': rep = *ep; break;
+      default: rep = '\0'; break;
+    }
+    if (!compileclass(pc, p, ep, rep))
+      return 0;
+    p = (rep != '\0') ? ep + 1 : ep;
+  }
+  return emit(pc, OP_END, 0, 0, 0);
+}
+
+
+/* does the character or set of instruction 'pc' have 'c'? */
+static int itemhas (const PatProg *prog, const PatInstr *pc, int c) {
+  if (pc->op == OP_CHAR)
+    return (pc->a == c);
+  else
+    return setin(&prog->sets[pc->a], c);
+}
+
+
+/*
+** Whether the greedy repetition 'pc' ('*' or '+') can keep all the
+** characters it matches. When the rest of the pattern fails after the
+** longest run, 'match' retries it after each shorter run, where it
+** starts at a character of the run. The retries are useless when the
+** rest (after captures, which take no characters) ends the pattern or
+** the subject, or needs a character the run cannot have
+*/
+static int possessive (const PatProg *prog, const PatInstr *pc) {
+  const PatInstr *next = pc + 1;
+  int c;
+  while (next->op == OP_OPEN || next->op == OP_POSITION ||
+         next->op == OP_CLOSE)
+    next++;
+  switch (next->op) {
+    case OP_END: case OP_EOS: {
+      return 1;
+    }
+    case OP_BALANCE: {
+      return !itemhas(prog, pc, next->a);
+    }
+    case OP_CHAR: case OP_SET: {
+      if (next->rep != '\0' && next->rep != '+')
+        return 0;  /* can match the empty string */
+      for (c = 0; c <= UCHAR_MAX; c++) {
+        if (itemhas(prog, pc, c) && itemhas(prog, next, c))
+          return 0;
+      }
+      return 1;
+    }
+    default: {
+      return 0;
+    }
+  }
+}
+
+
+/*
+** Characters that matches start with, if the pattern starts (after
+** fewer opened captures than raise errors) with an item that takes at
+** least one character
+*/
+static void firstchars (PatProg *prog, const PatInstr *pc) {
+  int c, n = 0;
+  prog->hasfirst = 0;
+  while (pc->op == OP_OPEN || pc->op == OP_POSITION) {
+    if (++n == LUA_MAXCAPTURES)
+      return;
+    pc++;
+  }
+  if ((pc->op != OP_CHAR && pc->op != OP_SET && pc->op != OP_BALANCE) ||
+      (pc->rep != '\0' && pc->rep != '+'))
+    return;
+  memset(&prog->first, 0, sizeof(CharSet));
+  for (c = n = 0; c <= UCHAR_MAX; c++) {
+    if (pc->op == OP_BALANCE ? (c == pc->a) : itemhas(prog, pc, c)) {
+      setadd(&prog->first, c);
+      prog->firstchar = c;
+      n++;
+    }
+  }
+  if (n != 1)
+    prog->firstchar = -1;
+  prog->hasfirst = 1;
+}
+
+
+/*
+** Rewrites the code of a compiled pattern, after it, with specialized
+** instructions. Matching with it gives the same results and errors
+** ('cmatch' still counts the recursion that possessive runs save)
+*/
+static void specialize (PatProg *prog) {
+  const PatInstr *pc = prog->code;
+  PatInstr *out = (PatInstr *)(prog->code + prog->ncode);
+  PatInstr *code = out;
+  for (;;) {
+    int n = 0;
+    while (pc[n].op == OP_CHAR && pc[n].rep == '\0' && n < UCHAR_MAX)
+      n++;  /* count a run of plain characters */
+    if (n > 1) {
+      char *lit = (char *)(out + 1);
+      int i;
+      out->op = OP_LITERAL; out->rep = '\0'; out->a = (unsigned char)n;
+      out->b = 0;
+      for (i = 0; i < n; i++)
+        lit[i] = (char)pc[i].a;
+      for (; i % (int)sizeof(PatInstr) != 0; i++)
+        lit[i] = '\0';
+      out += 1 + i / sizeof(PatInstr);
+      pc += n;
+      continue;
+    }
+    *out = *pc;
+    if ((pc->op == OP_CHAR || pc->op == OP_SET) &&
+        (pc->rep == '*' || pc->rep == '+') && possessive(prog, pc))
+      out->op = (pc->op == OP_CHAR) ? OP_SPANCHAR : OP_SPANSET;
+    out++;
+    if (pc++->op == OP_END)
+      break;
+  }
+  firstchars(prog, prog->code);
+  prog->code = code;
+  prog->specialized = 1;
+}
+
+
+/* recursive function */
+static const char *cmatch (MatchState *ms, const char *s, const PatInstr *pc);
+
+
+static int csinglematch (MatchState *ms, const char *s, const PatInstr *pc) {
+  if (s >= ms->src_end)
+    return 0;
+  else if (pc->op == OP_CHAR)
+    return (uchar(*s) == pc->a);
+  else
+    return setin(&ms->sets[pc->a], uchar(*s));
+}
+
+
+static const char *cmax_expand (MatchState *ms, const char *s,
+                                  const PatInstr *pc) {
+  ptrdiff_t i = 0;  /* counts maximum expand for item */
+  while (csinglematch(ms, s + i, pc))
+    i++;
+  /* keeps trying to match with the maximum repetitions */
+  while (i>=0) {
+    const char *res = cmatch(ms, (s+i), pc+1);
+    if (res) return res;
+    i--;  /* else didn't match; reduce 1 repetition to try again */
+  }
+  return NULL;
+}
+
+
+static const char *cmin_expand (MatchState *ms, const char *s,
+                                  const PatInstr *pc) {
+  for (;;) {
+    const char *res = cmatch(ms, s, pc+1);
+    if (res != NULL)
+      return res;
+    else if (csinglematch(ms, s, pc))
+      s++;  /* try with one more repetition */
+    else return NULL;
+  }
+}
+
+
+static const char *cstart_capture (MatchState *ms, const char *s,
+                                     const PatInstr *pc, int what) {
+  const char *res;
+  int level = ms->level;
+  if (level >= LUA_MAXCAPTURES) luaL_error(ms->L, "too many captures");
+  ms->capture[level].init = s;
+  ms->capture[level].len = what;
+  ms->level = level+1;
+  if ((res=cmatch(ms, s, pc)) == NULL)  /* match failed? */
+    ms->level--;  /* undo capture */
+  return res;
+}
+
+
+static const char *cend_capture (MatchState *ms, const char *s,
+                                   const PatInstr *pc) {
+  int l = capture_to_close(ms);
+  const char *res;
+  ms->capture[l].len = s - ms->capture[l].init;  /* close capture */
+  if ((res = cmatch(ms, s, pc)) == NULL)  /* match failed? */
+    ms->capture[l].len = CAP_UNFINISHED;  /* undo capture */
+  return res;
+}
+
+
+static const char *cmatch (MatchState *ms, const char *s,
+                                           const PatInstr *pc) {
+  int runs = 0;  /* levels of recursion that possessive runs saved */
+  if (l_unlikely(ms->matchdepth-- == 0))
+    luaL_error(ms->L, "pattern too complex");
+  init: /* using goto to optimize tail recursion */
+  switch (pc->op) {
+    case OP_END: break;
+    case OP_OPEN: {
+      s = cstart_capture(ms, s, pc + 1, CAP_UNFINISHED);
+      break;
+    }
+    case OP_POSITION: {
+      s = cstart_capture(ms, s, pc + 1, CAP_POSITION);
+      break;
+    }
+    case OP_CLOSE: {
+      s = cend_capture(ms, s, pc + 1);
+      break;
+    }
+    case OP_EOS: {
+      s = (s == ms->src_end) ? s : NULL;  /* check end of string */
+      break;
+    }
+    case OP_BALANCE: {
+      s = balance(ms, s, (char)pc->a, (char)pc->b);
+      if (s != NULL) {
+        pc++; goto init;
+      }
+      break;
+    }
+    case OP_FRONTIER: {
+      const CharSet *cs = &ms->sets[pc->a];
+      int previous = (s == ms->src_init) ? 0 : uchar(*(s - 1));
+      if (!setin(cs, previous) && setin(cs, uchar(*s))) {
+        pc++; goto init;
+      }
+      s = NULL;  /* match failed */
+      break;
+    }
+    case OP_BACKREF: {
+      s = match_capture(ms, s, pc->a);
+      if (s != NULL) {
+        pc++; goto init;
+      }
+      break;
+    }
+    case OP_LITERAL: {
+      size_t l = pc->a;
+      if ((size_t)(ms->src_end - s) < l || memcmp(s, pc + 1, l) != 0) {
+        s = NULL;  /* fail */
+        break;
+      }
+      s += l;
+      pc += 1 + (l + sizeof(PatInstr) - 1) / sizeof(PatInstr);
+      goto init;
+    }
+    case OP_SPANCHAR: case OP_SPANSET: {
+      if (s >= ms->src_end || !(pc->op == OP_SPANCHAR ? uchar(*s) == pc->a
+                                  : setin(&ms->sets[pc->a], uchar(*s)))) {
+        if (pc->rep == '+') {
+          s = NULL;  /* fail */
+          break;
+        }
+        pc++; goto init;  /* accept empty */
+      }
+      if (pc->op == OP_SPANCHAR) {
+        while (++s < ms->src_end && uchar(*s) == pc->a) ;
+      }
+      else {
+        const CharSet *cs = &ms->sets[pc->a];
+        while (++s < ms->src_end && setin(cs, uchar(*s))) ;
+      }
+      /* where 'max_expand' would call 'cmatch' */
+      if (l_unlikely(ms->matchdepth-- == 0))
+        luaL_error(ms->L, "pattern too complex");
+      runs++;
+      pc++; goto init;
+    }
+    default: {  /* OP_CHAR or OP_SET */
+      if (!csinglematch(ms, s, pc)) {  /* does not match at least once? */
+        if (pc->rep == '*' || pc->rep == '?' || pc->rep == '-') {
+          pc++; goto init;  /* accept empty */
+        }
+        else  /* '+' or no suffix */
+          s = NULL;  /* fail */
+      }
+      else {  /* matched once */
+        switch (pc->rep) {
+          case '?': {
+            const char *res;
+            if ((res = cmatch(ms, s + 1, pc + 1)) != NULL)
+              s = res;
+            else {
+              pc++; goto init;
+            }
+            break;
+          }
+          case '+':  /* 1 or more repetitions */
+            s++;  /* 1 match already done */
+            /* FALLTHROUGH */
+          case '*':  /* 0 or more repetitions */
+            s = cmax_expand(ms, s, pc);
+            break;
+          case '-':  /* 0 or more repetitions (minimum) */
+            s = cmin_expand(ms, s, pc);
+            break;
+          default:  /* no suffix */
+            s++; pc++; goto init;
+        }
+      }
+      break;
+    }
+  }
+  ms->matchdepth += 1 + runs;
+  return s;
+}
+
+
+/*
+** First position in [s, e) where a match of a specialized pattern can
+** start, or NULL
+*/
+static const char *nextstart (const PatProg *prog, const char *s,
+                                                   const char *e) {
+  if (prog->firstchar >= 0)
+    return (const char *)memchr(s, prog->firstchar, e - s);
+  for (; s < e; s++) {
+    if (setin(&prog->first, uchar(*s)))
+      return s;
+  }
+  return NULL;
+}
+
+
+/* matches with the compiled pattern, if there is one */
+static const char *domatch (MatchState *ms, const char *s, const char *p,
+                                            const PatProg *prog) {
+  if (prog != NULL)
+    return cmatch(ms, s, prog->code);
+  else
+    return match(ms, s, p);
+}
+
+
+/*
+** The cache. Entries are found by the address of the pattern string
+** through a hash table of chains, and kept in a list from the most to
+** the least recently used. The user value of the cache is a table that
+** keeps, at index 'i + 1', the compiled pattern of entry 'i' (or its
+** pattern string, for a pattern that is not compiled), so cached
+** pattern strings are not collected and their addresses stay unique.
+*/
+typedef struct PatEntry {
+  const void *key;  /* address of the pattern string */
+  PatProg *prog;  /* NULL for patterns that 'match' interprets */
+  int hnext;  /* next entry in the same chain, or -1 */
+  int prev, next;  /* neighbours in the list, or -1 */
+} PatEntry;
+
+
+typedef struct PatCache {
+  int enabled;
+  int nused;  /* entries in use */
+  int mru, lru;  /* first and last entries of the list, or -1 */
+  lua_Integer jitthreshold;  /* uses before specializing, or -1 */
+  size_t hits, misses, evictions, specialized;
+  int hash[PATBUCKETS];  /* first entry of each chain, or -1 */
+  PatEntry entry[LUA_PATCACHESIZE];
+} PatCache;
+
+
+#define pathash(k)	((unsigned int)(((size_t)(k)) >> 4) % PATBUCKETS)
+
+
+static void clearpatcache (lua_State *L, PatCache *cache, int idx) {
+  int i;
+  idx = lua_absindex(L, idx);
+  cache->nused = 0;
+  cache->mru = cache->lru = -1;
+  for (i = 0; i < PATBUCKETS; i++)
+    cache->hash[i] = -1;
+  lua_createtable(L, LUA_PATCACHESIZE, 0);
+  lua_setiuservalue(L, idx, 1);  /* drop every entry */
+}
+
+
+static void unlinkentry (PatCache *cache, int i) {
+  PatEntry *e = &cache->entry[i];
+  if (e->prev >= 0) cache->entry[e->prev].next = e->next;
+  else cache->mru = e->next;
+  if (e->next >= 0) cache->entry[e->next].prev = e->prev;
+  else cache->lru = e->prev;
+}
+
+
+static void linkentry (PatCache *cache, int i) {
+  PatEntry *e = &cache->entry[i];
+  e->prev = -1;
+  e->next = cache->mru;
+  if (cache->mru >= 0) cache->entry[cache->mru].prev = i;
+  else cache->lru = i;
+  cache->mru = i;
+}
+
+
+/* takes a free entry, or the least recently used one */
+static int newentry (PatCache *cache) {
+  int i;
+  int *pi;
+  if (cache->nused < LUA_PATCACHESIZE)
+    return cache->nused++;
+  i = cache->lru;
+  unlinkentry(cache, i);
+  for (pi = &cache->hash[pathash(cache->entry[i].key)]; *pi != i;
+       pi = &cache->entry[*pi].hnext) ;
+  *pi = cache->entry[i].hnext;  /* remove it from its chain */
+  cache->evictions++;
+  return i;
+}
+
+
+/*
+** Compiles pattern 'p' (the string at index 'arg', maybe without its
+** anchor). Pushes the compiled pattern and returns it, or pushes the
+** pattern string and returns NULL if it cannot be compiled
+*/
+static PatProg *newprog (lua_State *L, int arg, const char *p, size_t lp) {
+  PatCompiler pc;
+  PatProg *prog;
+  const char *locale = "";
+  size_t size;
+  if (!compilepattern(&pc, p, p + lp) ||
+      (pc.ctype && strlen(locale = setlocale(LC_CTYPE, NULL)) >= PATLOCALELEN)) {
+    lua_pushvalue(L, arg);
+    return NULL;
+  }
+  size = sizeof(PatProg) + pc.nsets * sizeof(CharSet) +
+         2 * pc.ncode * sizeof(PatInstr);
+  prog = (PatProg *)lua_newuserdatauv(L, size, 1);
+  memcpy(prog + 1, pc.sets, pc.nsets * sizeof(CharSet));
+  prog->sets = (const CharSet *)(prog + 1);
+  memcpy((CharSet *)(prog + 1) + pc.nsets, pc.code,
+         pc.ncode * sizeof(PatInstr));
+  prog->code = (const PatInstr *)(prog->sets + pc.nsets);
+  prog->lprefix = literalprefix(p, lp);
+  prog->nsets = pc.nsets;
+  prog->ncode = pc.ncode;
+  prog->ctype = pc.ctype;
+  prog->uses = 0;
+  prog->specialized = prog->hasfirst = 0;
+  prog->firstchar = -1;
+  strcpy(prog->locale, locale);
+  lua_pushvalue(L, arg);
+  lua_setiuservalue(L, -2, 1);  /* keep the pattern string */
+  return prog;
+}
+
+
+/* counts a use of a compiled pattern, specializing it once it is hot */
+static void useprog (PatCache *cache, PatProg *prog) {
+  if (!prog->specialized && cache->jitthreshold >= 0 &&
+      prog->uses++ >= cache->jitthreshold) {
+    specialize(prog);
+    cache->specialized++;
+  }
+}
+
+
+/*
+** Returns the compiled form of pattern 'p' (the string at index 'arg',
+** maybe without its anchor), compiling it on a miss, or NULL if 'match'
+** should interpret it. Pushes the compiled pattern (or nil), so that
+** it lives while the caller uses it
+*/
+static PatProg *getprog (lua_State *L, int arg, const char *p, size_t lp) {
+  PatCache *cache = (PatCache *)lua_touserdata(L, lua_upvalueindex(1));
+  const void *key = lua_topointer(L, arg);
+  PatProg *prog;
+  int i;
+  if (cache == NULL || !cache->enabled) {
+    lua_pushnil(L);
+    return NULL;
+  }
+  lua_getiuservalue(L, lua_upvalueindex(1), 1);  /* table of entries */
+  for (i = cache->hash[pathash(key)]; i >= 0; i = cache->entry[i].hnext) {
+    if (cache->entry[i].key == key)
+      break;
+  }
+  if (i >= 0) {  /* cached? */
+    prog = cache->entry[i].prog;
+    unlinkentry(cache, i);
+    linkentry(cache, i);  /* now the most recently used */
+    if (prog == NULL || !prog->ctype ||
+        strcmp(prog->locale, setlocale(LC_CTYPE, NULL)) == 0) {
+      cache->hits++;
+      if (prog == NULL)
+        lua_pushnil(L);
+      else {
+        lua_rawgeti(L, -1, i + 1);  /* the compiled pattern */
+        useprog(cache, prog);
+      }
+      lua_remove(L, -2);  /* table of entries */
+      return prog;
+    }
+  }
+  else {  /* a new entry */
+    i = newentry(cache);
+    cache->entry[i].key = key;
+    cache->entry[i].hnext = cache->hash[pathash(key)];
+    cache->hash[pathash(key)] = i;
+    linkentry(cache, i);
+  }
+  /* compile it (again, if the locale changed) */
+  cache->misses++;
+  prog = cache->entry[i].prog = newprog(L, arg, p, lp);
+  lua_pushvalue(L, -1);
+  lua_rawseti(L, -3, i + 1);
+  lua_remove(L, -2);  /* table of entries */
+  if (prog == NULL) {
+    lua_pop(L, 1);
+    lua_pushnil(L);
+  }
+  else
+    useprog(cache, prog);
+  return prog;
+}
+
+/* }====================================================== */
+
+
 static int str_find_aux (lua_State *L, int find) {
   size_t ls, lp;
   const char *s = luaL_checklstring(L, 1, &ls);
@@ -793,14 +1764,33 @@ static int str_find_aux (lua_State *L, int find) {
     MatchState ms;
     const char *s1 = s + init;
     int anchor = (*p == '^');
+    PatProg *prog;
+    size_t lprefix;
     if (anchor) {
       p++; lp--;  /* skip anchor character */
     }
+    prog = getprog(L, 2, p, lp);
+    if (anchor)
+      lprefix = 0;
+    else
+      lprefix = (prog != NULL) ? prog->lprefix : literalprefix(p, lp);
     prepstate(&ms, L, s, ls, p, lp);
+    if (prog != NULL)
+      ms.sets = prog->sets;
     do {
       const char *res;
+      if (lprefix > 0) {  /* skip to the next occurrence of the prefix */
+        s1 = lmemfind(s1, ms.src_end - s1, p, lprefix);
+        if (s1 == NULL)
+          break;
+      }
+      else if (!anchor && prog != NULL && prog->hasfirst) {
+        s1 = nextstart(prog, s1, ms.src_end);  /* skip to a possible start */
+        if (s1 == NULL)
+          break;
+      }
       reprepstate(&ms);
-      if ((res=match(&ms, s1, p)) != NULL) {
+      if ((res=domatch(&ms, s1, p, prog)) != NULL) {
         if (find) {
           lua_pushinteger(L, (s1 - s) + 1);  /* start */
           lua_pushinteger(L, res - s);   /* end */
@@ -831,18 +1821,31 @@ typedef struct GMatchState {
   const char *src;  /* current position */
   const char *p;  /* pattern */
   const char *lastmatch;  /* end of last match */
+  size_t lprefix;  /* length of the literal prefix of the pattern */
+  const PatProg *prog;  /* compiled pattern, or NULL */
   MatchState ms;  /* match state */
 } GMatchState;
 
 
 static int gmatch_aux (lua_State *L) {
-  GMatchState *gm = (GMatchState *)lua_touserdata(L, lua_upvalueindex(3));
+  GMatchState *gm = (GMatchState *)lua_touserdata(L, lua_upvalueindex(4));
   const char *src;
   gm->ms.L = L;
   for (src = gm->src; src <= gm->ms.src_end; src++) {
     const char *e;
+    if (gm->lprefix > 0) {  /* skip to the next occurrence of the prefix */
+      src = lmemfind(src, gm->ms.src_end - src, gm->p, gm->lprefix);
+      if (src == NULL)
+        break;
+    }
+    else if (gm->prog != NULL && gm->prog->hasfirst) {
+      src = nextstart(gm->prog, src, gm->ms.src_end);
+      if (src == NULL)
+        break;
+    }
     reprepstate(&gm->ms);
-    if ((e = match(&gm->ms, src, gm->p)) != NULL && e != gm->lastmatch) {
+    if ((e = domatch(&gm->ms, src, gm->p, gm->prog)) != NULL &&
+        e != gm->lastmatch) {
       gm->src = gm->lastmatch = e;
       return push_captures(&gm->ms, src, e);
     }
@@ -856,14 +1859,28 @@ static int gmatch (lua_State *L) {
   const char *s = luaL_checklstring(L, 1, &ls);
   const char *p = luaL_checklstring(L, 2, &lp);
   size_t init = posrelatI(luaL_optinteger(L, 3, 1), ls) - 1;
+  PatProg *prog;
   GMatchState *gm;
   lua_settop(L, 2);  /* keep strings on closure to avoid being collected */
+  if (*p == '^') {  /* a plain character here, unlike in compiled patterns */
+    lua_pushnil(L);
+    prog = NULL;
+  }
+  else
+    prog = getprog(L, 2, p, lp);  /* also kept on the closure */
   gm = (GMatchState *)lua_newuserdatauv(L, sizeof(GMatchState), 0);
   if (init > ls)  /* start after string's end? */
     init = ls + 1;  /* avoid overflows in 's + init' */
   prepstate(&gm->ms, L, s, ls, p, lp);
   gm->src = s + init; gm->p = p; gm->lastmatch = NULL;
-  lua_pushcclosure(L, gmatch_aux, 3);
+  gm->prog = prog;
+  if (prog != NULL) {
+    gm->ms.sets = prog->sets;
+    gm->lprefix = prog->lprefix;
+  }
+  else
+    gm->lprefix = literalprefix(p, lp);
+  lua_pushcclosure(L, gmatch_aux, 4);
   return 1;
 }
 
@@ -949,20 +1966,32 @@ static int str_gsub (lua_State *L) {
   int anchor = (*p == '^');
   lua_Integer n = 0;  /* replacement count */
   int changed = 0;  /* change flag */
+  PatProg *prog;
   MatchState ms;
   luaL_Buffer b;
   luaL_argexpected(L, tr == LUA_TNUMBER || tr == LUA_TSTRING ||
                    tr == LUA_TFUNCTION || tr == LUA_TTABLE, 3,
                       "string/function/table");
-  luaL_buffinit(L, &b);
   if (anchor) {
     p++; lp--;  /* skip anchor character */
   }
+  prog = getprog(L, 2, p, lp);
+  luaL_buffinit(L, &b);
   prepstate(&ms, L, src, srcl, p, lp);
+  if (prog != NULL)
+    ms.sets = prog->sets;
   while (n < max_s) {
     const char *e;
+    if (!anchor && prog != NULL && prog->hasfirst) {
+      /* copy the characters where no match can start */
+      const char *start = nextstart(prog, src, ms.src_end);
+      if (start == NULL)
+        start = ms.src_end;
+      luaL_addlstring(&b, src, start - src);
+      src = start;
+    }
     reprepstate(&ms);  /* (re)prepare state for new match */
-    if ((e = match(&ms, src, p)) != NULL && e != lastmatch) {  /* match? */
+    if ((e = domatch(&ms, src, p, prog)) != NULL && e != lastmatch) {  /* match? */
       n++;
       changed = add_value(&ms, &b, src, e, tr) | changed;
       src = lastmatch = e;
@@ -982,6 +2011,53 @@ static int str_gsub (lua_State *L) {
   return 2;
 }
 
+
+static void newpatcache (lua_State *L) {
+  PatCache *cache = (PatCache *)lua_newuserdatauv(L, sizeof(PatCache), 1);
+  cache->enabled = 1;
+  cache->jitthreshold = LUA_PATJITTHRESHOLD;
+  cache->hits = cache->misses = cache->evictions = cache->specialized = 0;
+  clearpatcache(L, cache, -1);
+}
+
+
+/*
+** string.patterncache([opt [, n]]): "on" and "off" turn the cache of
+** compiled patterns on and off (dropping its entries), "clear" drops its
+** entries, "jit" sets the uses after which compiled patterns are
+** specialized (-1 for never), and "count" (the default) returns its
+** hits, misses, evictions, number of entries, whether it is on and the
+** number of patterns specialized
+*/
+static int str_patterncache (lua_State *L) {
+  static const char *const opts[] = {"on", "off", "clear", "count", "jit",
+                                     NULL};
+  PatCache *cache = (PatCache *)lua_touserdata(L, lua_upvalueindex(1));
+  int o = luaL_checkoption(L, 1, "count", opts);
+  switch (o) {
+    case 3: {
+      lua_pushinteger(L, (lua_Integer)cache->hits);
+      lua_pushinteger(L, (lua_Integer)cache->misses);
+      lua_pushinteger(L, (lua_Integer)cache->evictions);
+      lua_pushinteger(L, cache->nused);
+      lua_pushstring(L, opts[cache->enabled ? 0 : 1]);
+      lua_pushinteger(L, (lua_Integer)cache->specialized);
+      return 6;
+    }
+    case 4: {
+      lua_Integer n = luaL_optinteger(L, 2, LUA_PATJITTHRESHOLD);
+      cache->jitthreshold = (n < 0) ? -1 : n;
+      return 0;
+    }
+    default: {
+      if (o != 2)
+        cache->enabled = (o == 0);
+      clearpatcache(L, cache, lua_upvalueindex(1));
+      return 0;
+    }
+  }
+}
+
 /* }====================================================== */
 
 
@@ -1845,6 +2921,7 @@ static const luaL_Reg strlib[] = {
   {"pack", str_pack},
   {"packsize", str_packsize},
   {"unpack", str_unpack},
+  {"patterncache", str_patterncache},
   {NULL, NULL}
 };
 
@@ -1867,7 +2944,9 @@ static void createmetatable (lua_State *L) {
 ** Open string library
 */
 LUAMOD_API int luaopen_string (lua_State *L) {
-  luaL_newlib(L, strlib);
+  luaL_newlibtable(L, strlib);
+  newpatcache(L);  /* upvalue of the functions: the pattern cache */
+  luaL_setfuncs(L, strlib, 1);
   createmetatable(L);
   return 1;
 }
@@ -11,6 +11,7 @@
 
 
 #include <limits.h>
+#include <locale.h>
 #include <stddef.h>
 #include <string.h>
 
@@ -19,6 +20,8 @@
 #include "lauxlib.h"
 #include "lualib.h"
 
+#include "swiftsort.h"
+
 
 /*
 ** Operations that an object must define to mimic a table
@@ -153,6 +156,107 @@ static void addfield (lua_State *L, luaL_Buffer *b, lua_Integer i) {
 }
 
 
+
+/* maximum length of a numeral, as in lobject.c */
+#define MAXNUMBER2STR	44
+
+/*
+** Writes the number on the top of the stack into 'buff' as 'tostring'
+** does (see 'tostringbuff' in lobject.c) and returns its length
+*/
+static size_t numtostr (lua_State *L, char *buff) {
+  int len;
+  if (lua_isinteger(L, -1))
+    len = lua_integer2str(buff, MAXNUMBER2STR, lua_tointeger(L, -1));
+  else {
+    len = lua_number2str(buff, MAXNUMBER2STR, lua_tonumber(L, -1));
+    if (buff[strspn(buff, "-0123456789")] == '\0') {  /* looks like an int? */
+      buff[len++] = lua_getlocaledecpoint();
+      buff[len++] = '0';  /* adds '.0' to result */
+    }
+  }
+  return (size_t)len;
+}
+
+
+/*
+** Pushes element 'i' of the table as a string in '*s' or 'buff',
+** returning its length, or returns (size_t)-1 if it is neither a
+** string nor a number. The element is left on the stack.
+*/
+static size_t getpiece (lua_State *L, lua_Integer i, const char **s,
+                        char *buff) {
+  size_t l;
+  switch (lua_rawgeti(L, 1, i)) {
+    case LUA_TSTRING:
+      *s = lua_tolstring(L, -1, &l);
+      return l;
+    case LUA_TNUMBER:
+      *s = buff;
+      return numtostr(L, buff);
+    default:
+      return (size_t)-1;
+  }
+}
+
+
+/*
+** Fast path of 'concat' for a table without a metatable whose elements
+** in [i, last] are all strings or numbers: sums their lengths, creates
+** the result once with 'lua_pushbuffstring' and fills it in place,
+** instead of growing a buffer and copying it into a new string. Returns
+** 0, pushing nothing, when it does not apply (the generic path then
+** also raises the errors).
+*/
+static int fastconcat (lua_State *L, const char *sep, size_t lsep,
+                       lua_Integer i, lua_Integer last) {
+  char buff[MAXNUMBER2STR];
+  const char *s;
+  size_t l, total, filled;
+  lua_Unsigned nsep = (lua_Unsigned)last - (lua_Unsigned)i;
+  lua_Integer k;
+  char *res;
+  if (lua_type(L, 1) != LUA_TTABLE)
+    return 0;
+  if (lua_getmetatable(L, 1)) {  /* elements may come from '__index' */
+    lua_pop(L, 1);
+    return 0;
+  }
+  if (lsep != 0 && nsep > ((size_t)-1 - 1) / lsep)
+    return 0;
+  total = (size_t)nsep * lsep;
+  for (k = i; ; k++) {  /* first pass: total length */
+    l = getpiece(L, k, &s, buff);
+    lua_pop(L, 1);
+    if (l == (size_t)-1 || l > (size_t)-1 - 1 - total)
+      return 0;
+    total += l;
+    if (k == last) break;
+  }
+  res = lua_pushbuffstring(L, total);
+  if (res == NULL)  /* short result? */
+    return 0;
+  filled = 0;
+  for (k = i; ; k++) {  /* second pass: fill the result */
+    l = getpiece(L, k, &s, buff);
+    /* a finalizer run by 'lua_pushbuffstring' may change the table */
+    if (l > total - filled)
+      return luaL_error(L, "table changed during 'concat'");
+    memcpy(res + filled, s, l);
+    filled += l;
+    lua_pop(L, 1);
+    if (k == last) break;
+    if (lsep > total - filled)
+      return luaL_error(L, "table changed during 'concat'");
+    memcpy(res + filled, sep, lsep);
+    filled += lsep;
+  }
+  if (filled != total)
+    return luaL_error(L, "table changed during 'concat'");
+  return 1;
+}
+
+
 static int tconcat (lua_State *L) {
   luaL_Buffer b;
   lua_Integer last = aux_getn(L, 1, TAB_R);
@@ -160,6 +264,8 @@ static int tconcat (lua_State *L) {
   const char *sep = luaL_optlstring(L, 2, "", &lsep);
   lua_Integer i = luaL_optinteger(L, 3, 1);
   last = luaL_optinteger(L, 4, last);
+  if (i <= last && fastconcat(L, sep, lsep, i, last))
+    return 1;
   luaL_buffinit(L, &b);
   for (; i < last; i++) {
     addfield(L, &b, i);
@@ -403,11 +509,112 @@ static int sort (lua_State *L) {
     if (!lua_isnoneornil(L, 2))  /* is there a 2nd argument? */
       luaL_checktype(L, 2, LUA_TFUNCTION);  /* must be a function */
     lua_settop(L, 2);  /* make sure there are two arguments */
+    if (lua_isnil(L, 2) && lua_sortarray(L, 1, n, 0))
+      return 0;  /* sorted the array part in place */
     auxsort(L, 1, (IdxT)n, 0);
   }
   return 0;
 }
 
+
+/* }====================================================== */
+
+
+
+/*
+** {======================================================
+** Stable merge sort
+** =======================================================
+*/
+
+/* intervals shorter than this use insertion sort */
+#define MERGE_INSERTION	12
+
+/*
+** Insertion sort of a[lo .. up]; moves elements only past greater ones,
+** so it is stable
+*/
+static void insertionsort (lua_State *L, IdxT lo, IdxT up) {
+  IdxT i, j;
+  for (i = lo + 1; i <= up; i++) {
+    lua_geti(L, 1, i);  /* x = a[i] */
+    for (j = i; j > lo; j--) {
+      lua_geti(L, 1, j - 1);
+      if (!sort_comp(L, -2, -1)) {  /* a[j - 1] <= x? */
+        lua_pop(L, 1);
+        break;
+      }
+      lua_seti(L, 1, j);  /* a[j] = a[j - 1] */
+    }
+    lua_seti(L, 1, j);  /* a[j] = x */
+  }
+}
+
+
+/*
+** Merge sort of a[lo .. up], using the table at index 3 to hold the
+** lower half of each merge. On ties it takes the element from the lower
+** half, so equal elements keep their order. An invalid order function
+** only gives an unspecified order.
+*/
+static void auxmergesort (lua_State *L, IdxT lo, IdxT up) {
+  IdxT mid, i, nlow, j, k;
+  if (up - lo < MERGE_INSERTION) {
+    insertionsort(L, lo, up);
+    return;
+  }
+  mid = lo + (up - lo) / 2;
+  auxmergesort(L, lo, mid);
+  auxmergesort(L, mid + 1, up);
+  lua_geti(L, 1, mid);
+  lua_geti(L, 1, mid + 1);
+  if (!sort_comp(L, -1, -2)) {  /* a[mid] <= a[mid + 1]? */
+    lua_pop(L, 2);
+    return;  /* halves are already in order */
+  }
+  lua_pop(L, 2);
+  nlow = mid - lo + 1;
+  for (i = 1; i <= nlow; i++) {  /* copy the lower half */
+    lua_geti(L, 1, lo + i - 1);
+    lua_rawseti(L, 3, i);
+  }
+  for (i = 1, j = mid + 1, k = lo; i <= nlow && j <= up; k++) {
+    lua_rawgeti(L, 3, i);
+    lua_geti(L, 1, j);
+    if (sort_comp(L, -1, -2)) {  /* a[j] < low[i]? */
+      lua_seti(L, 1, k);
+      j++;
+    }
+    else {
+      lua_pop(L, 1);
+      lua_seti(L, 1, k);
+      i++;
+      continue;
+    }
+    lua_pop(L, 1);
+  }
+  for (; i <= nlow; i++, k++) {  /* rest of the lower half */
+    lua_rawgeti(L, 3, i);
+    lua_seti(L, 1, k);
+  }
+}
+
+
+static int stablesort (lua_State *L) {
+  lua_Integer n = aux_getn(L, 1, TAB_RW);
+  if (n > 1) {  /* non-trivial interval? */
+    luaL_argcheck(L, n < INT_MAX, 1, "array too big");
+    if (!lua_isnoneornil(L, 2))  /* is there a 2nd argument? */
+      luaL_checktype(L, 2, LUA_TFUNCTION);  /* must be a function */
+    lua_settop(L, 2);  /* make sure there are two arguments */
+    if (lua_isnil(L, 2) && lua_sortarray(L, 1, n, LUA_SORT_STABLE))
+      return 0;  /* sorted the array part in place */
+    lua_createtable(L, (int)(n / 2 + 1), 0);  /* lower halves, at index 3 */
+    auxmergesort(L, 1, (IdxT)n);
+  }
+  return 0;
+}
+
 /* }====================================================== */
 
 
@@ -419,6 +626,7 @@ static const luaL_Reg tab_funcs[] = {
   {"remove", tremove},
   {"move", tmove},
   {"sort", sort},
+  {"stablesort", stablesort},
   {NULL, NULL}
 };
 
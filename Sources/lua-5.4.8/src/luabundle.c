@@ -0,0 +1,230 @@
+/*
+** $Id: luabundle.c $
+** Lua bundler (saves many modules into one bundle file, see swiftbundle.h)
+** See Copyright Notice in lua.h
+*/
+
+#define luabundle_c
+
+#include "lprefix.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+
+#include "swiftbundle.h"
+
+#define PROGNAME	"luabundle"	/* default program name */
+#define OUTPUT		PROGNAME ".out"	/* default output file */
+
+static int stripping=0;			/* strip debug information? */
+static int texts=0;			/* store sources instead of bytecodes? */
+static int flags=0;			/* luaL_writebundle flags */
+static char Output[]={ OUTPUT };	/* default output file name */
+static const char* output=Output;	/* actual output file name */
+static const char* progname=PROGNAME;	/* actual program name */
+
+static void fatal(const char* message)
+{
+ fprintf(stderr,"%s: %s\n",progname,message);
+ exit(EXIT_FAILURE);
+}
+
+static void cannot(const char* what)
+{
+ fprintf(stderr,"%s: cannot %s %s: %s\n",progname,what,output,strerror(errno));
+ exit(EXIT_FAILURE);
+}
+
+static void usage(const char* message)
+{
+ if (*message=='-')
+  fprintf(stderr,"%s: unrecognized option '%s'\n",progname,message);
+ else
+  fprintf(stderr,"%s: %s\n",progname,message);
+ fprintf(stderr,
+  "usage: %s [options] [module=]filename ...\n"
+  "Modules are named after their file names (a/b.lua and a/b/init.lua\n"
+  "become 'a.b') unless given as 'module=filename'.\n"
+  "Available options are:\n"
+  "  -o name  output to file 'name' (default is \"%s\")\n"
+  "  -s       strip debug information\n"
+  "  -t       store sources instead of precompiled chunks\n"
+  "  -z       compress modules\n"
+  "  -v       show version information\n"
+  "  --       stop handling options\n"
+  ,progname,Output);
+ exit(EXIT_FAILURE);
+}
+
+#define IS(s)	(strcmp(argv[i],s)==0)
+
+static int doargs(int argc, char* argv[])
+{
+ int i;
+ int version=0;
+ if (argv[0]!=NULL && *argv[0]!=0) progname=argv[0];
+ for (i=1; i<argc; i++)
+ {
+  if (*argv[i]!='-')			/* end of options; keep it */
+   break;
+  else if (IS("--"))			/* end of options; skip it */
+  {
+   ++i;
+   if (version) ++version;
+   break;
+  }
+  else if (IS("-o"))			/* output file */
+  {
+   output=argv[++i];
+   if (output==NULL || *output==0 || *output=='-')
+    usage("'-o' needs argument");
+  }
+  else if (IS("-s"))			/* strip debug information */
+   stripping=1;
+  else if (IS("-t"))			/* store sources */
+   texts=1;
+  else if (IS("-z"))			/* compress */
+   flags|=LUA_BUNDLE_COMPRESS;
+  else if (IS("-v"))			/* show version */
+   ++version;
+  else					/* unknown option */
+   usage(argv[i]);
+ }
+ if (version)
+ {
+  printf("%s\n",LUA_COPYRIGHT);
+  if (version==argc-1) exit(EXIT_SUCCESS);
+ }
+ return i;
+}
+
+/*
+** push the module name for argument 'arg' and set '*filename':
+** "name=file" is explicit, else "./a/b.lua" and "a/b/init.lua" give "a.b"
+*/
+static const char* modulename(lua_State* L, const char* arg, const char** filename)
+{
+ const char* eq=strchr(arg,'=');
+ size_t len;
+ luaL_Buffer b;
+ if (eq!=NULL)
+ {
+  *filename=eq+1;
+  return lua_pushlstring(L,arg,eq-arg);
+ }
+ *filename=arg;
+ if (strncmp(arg,"." LUA_DIRSEP,2)==0) arg+=2;
+ len=strlen(arg);
+ if (len>4 && strcmp(arg+len-4,".lua")==0) len-=4;
+ if (len>5 && strncmp(arg+len-5,LUA_DIRSEP "init",5)==0) len-=5;
+ luaL_buffinit(L,&b);
+ luaL_addlstring(&b,arg,len);
+ luaL_pushresult(&b);
+ return luaL_gsub(L,lua_tostring(L,-1),LUA_DIRSEP,".");
+}
+
+typedef struct DumpState {
+ int init;
+ luaL_Buffer b;
+} DumpState;
+
+static int dumpwriter(lua_State* L, const void* p, size_t size, void* u)
+{
+ DumpState* D=(DumpState*)u;
+ if (!D->init)
+ {
+  D->init=1;
+  luaL_buffinit(L,&D->b);
+ }
+ luaL_addlstring(&D->b,(const char*)p,size);
+ return 0;
+}
+
+/* replace the function on the top of the stack by its bytecodes */
+static void pushdump(lua_State* L)
+{
+ DumpState D;
+ D.init=0;
+ lua_dumpaligned(L,dumpwriter,&D,stripping);
+ if (!D.init) fatal("cannot dump chunk");
+ luaL_pushresult(&D.b);
+ lua_remove(L,-2);
+}
+
+static void pushtext(lua_State* L, const char* filename)
+{
+ FILE* f=fopen(filename,"rb");
+ luaL_Buffer b;
+ size_t n;
+ if (f==NULL) fatal(lua_pushfstring(L,"cannot open %s",filename));
+ luaL_buffinit(L,&b);
+ do
+ {
+  char* p=luaL_prepbuffer(&b);
+  n=fread(p,1,LUAL_BUFFERSIZE,f);
+  luaL_addsize(&b,n);
+ } while (n==LUAL_BUFFERSIZE);
+ if (ferror(f)) fatal(lua_pushfstring(L,"cannot read %s",filename));
+ fclose(f);
+ luaL_pushresult(&b);
+}
+
+static int writer(lua_State* L, const void* p, size_t size, void* u)
+{
+ (void)L;
+ return (fwrite(p,size,1,(FILE*)u)!=1) && (size!=0);
+}
+
+static int pmain(lua_State* L)
+{
+ int argc=(int)lua_tointeger(L,1);
+ char** argv=(char**)lua_touserdata(L,2);
+ int i;
+ FILE* D;
+ lua_newtable(L);			/* modules, at index 3 */
+ for (i=0; i<argc; i++)
+ {
+  const char* filename;
+  const char* name=modulename(L,argv[i],&filename);
+  if (lua_getfield(L,3,name)!=LUA_TNIL)
+   fatal(lua_pushfstring(L,"duplicate module '%s'",name));
+  lua_pop(L,1);
+  if (luaL_loadfile(L,filename)!=LUA_OK) fatal(lua_tostring(L,-1));
+  if (texts)
+  {
+   lua_pop(L,1);
+   pushtext(L,filename);
+  }
+  else
+   pushdump(L);
+  lua_setfield(L,3,name);
+  lua_settop(L,3);
+ }
+ D=fopen(output,"wb");
+ if (D==NULL) cannot("open");
+ if (luaL_writebundle(L,3,writer,D,flags)==-1) fatal(lua_tostring(L,-1));
+ if (ferror(D)) cannot("write");
+ if (fclose(D)) cannot("close");
+ return 0;
+}
+
+LUA_API int luabundle_main(int argc, char* argv[])
+{
+ lua_State* L;
+ int i=doargs(argc,argv);
+ argc-=i; argv+=i;
+ if (argc<=0) usage("no input files given");
+ L=luaL_newstate();
+ if (L==NULL) fatal("cannot create state: not enough memory");
+ lua_pushcfunction(L,&pmain);
+ lua_pushinteger(L,argc);
+ lua_pushlightuserdata(L,argv);
+ if (lua_pcall(L,2,0,0)!=LUA_OK) fatal(lua_tostring(L,-1));
+ lua_close(L);
+ return EXIT_SUCCESS;
+}
@@ -34,6 +34,9 @@ typedef struct {
   lua_State *L;
   ZIO *Z;
   const char *name;
+  MappedChunk *mapped;  /* chunk loaded in place, or NULL */
+  size_t offset;  /* bytes read since the start of the chunk */
+  int aligned;  /* format is LUAC_FORMAT_ALIGNED? */
 } LoadState;
 
 
@@ -52,6 +55,7 @@ static l_noret error (LoadState *S, const char *why) {
 static void loadBlock (LoadState *S, void *b, size_t size) {
   if (luaZ_read(S->Z, b, size) != 0)
     error(S, "truncated chunk");
+  S->offset += size;
 }
 
 
@@ -62,10 +66,44 @@ static lu_byte loadByte (LoadState *S) {
   int b = zgetc(S->Z);
   if (b == EOZ)
     error(S, "truncated chunk");
+  S->offset++;
   return cast_byte(b);
 }
 
 
+/*
+** When loading in place, returns the next 'size' bytes of the chunk
+** (skipping them) if they are suitably aligned, making 'f' reference
+** the chunk's memory; otherwise returns NULL and the caller copies.
+*/
+static const void *loadInPlace (LoadState *S, Proto *f, size_t size,
+                                size_t align) {
+  ZIO *Z = S->Z;
+  const char *p = Z->p;
+  MappedChunk *mc = S->mapped;
+  if (mc == NULL || size == 0 || Z->n < size ||
+      (point2uint(p) & (align - 1)) != 0)
+    return NULL;
+  if (f->ext == NULL) {
+    if (mc->ext == NULL) {
+      ExternalData *ext = luaM_new(S->L, ExternalData);
+      ext->refs = 0;
+      ext->mem = mc->buff;
+      ext->size = mc->size;
+      ext->release = mc->release;
+      ext->ud = mc->ud;
+      mc->ext = ext;
+    }
+    f->ext = mc->ext;
+    f->ext->refs++;
+  }
+  Z->p += size;
+  Z->n -= size;
+  S->offset += size;
+  return p;
+}
+
+
 static size_t loadUnsigned (LoadState *S, size_t limit) {
   size_t x = 0;
   int b;
@@ -143,6 +181,19 @@ static TString *loadString (LoadState *S, Proto *p) {
 
 static void loadCode (LoadState *S, Proto *f) {
   int n = loadInt(S);
+  const void *code;
+  if (S->aligned) {  /* skip padding */
+    while (S->offset % sizeof(Instruction) != 0)
+      loadByte(S);
+  }
+  if (n > 0 && (size_t)n <= MAX_SIZET / sizeof(Instruction) &&
+      (code = loadInPlace(S, f, n * sizeof(Instruction),
+                          sizeof(Instruction))) != NULL) {
+    f->code = cast(Instruction *, code);
+    f->sizecode = n;
+    f->extflags |= PF_EXTCODE;
+    return;
+  }
   f->code = luaM_newvectorchecked(S->L, n, Instruction);
   f->sizecode = n;
   loadVector(S, f->code, n);
@@ -226,10 +277,18 @@ static void loadUpvalues (LoadState *S, Proto *f) {
 
 static void loadDebug (LoadState *S, Proto *f) {
   int i, n;
+  const void *lineinfo;
   n = loadInt(S);
-  f->lineinfo = luaM_newvectorchecked(S->L, n, ls_byte);
-  f->sizelineinfo = n;
-  loadVector(S, f->lineinfo, n);
+  if ((lineinfo = loadInPlace(S, f, n, 1)) != NULL) {
+    f->lineinfo = cast(ls_byte *, lineinfo);
+    f->sizelineinfo = n;
+    f->extflags |= PF_EXTLINEINFO;
+  }
+  else {
+    f->lineinfo = luaM_newvectorchecked(S->L, n, ls_byte);
+    f->sizelineinfo = n;
+    loadVector(S, f->lineinfo, n);
+  }
   n = loadInt(S);
   f->abslineinfo = luaM_newvectorchecked(S->L, n, AbsLineInfo);
   f->sizeabslineinfo = n;
@@ -294,8 +353,11 @@ static void checkHeader (LoadState *S) {
   checkliteral(S, &LUA_SIGNATURE[1], "not a binary chunk");
   if (loadByte(S) != LUAC_VERSION)
     error(S, "version mismatch");
-  if (loadByte(S) != LUAC_FORMAT)
-    error(S, "format mismatch");
+  switch (loadByte(S)) {
+    case LUAC_FORMAT: S->aligned = 0; break;
+    case LUAC_FORMAT_ALIGNED: S->aligned = 1; break;
+    default: error(S, "format mismatch");
+  }
   checkliteral(S, LUAC_DATA, "corrupted chunk");
   checksize(S, Instruction);
   checksize(S, lua_Integer);
@@ -321,6 +383,9 @@ LClosure *luaU_undump(lua_State *L, ZIO *Z, const char *name) {
     S.name = name;
   S.L = L;
   S.Z = Z;
+  S.mapped = (Z->reader == luaU_mappedreader) ? (MappedChunk *)Z->data : NULL;
+  S.offset = 1;  /* 1st char already read */
+  S.aligned = 0;
   checkHeader(&S);
   cl = luaF_newLclosure(L, loadByte(&S));
   setclLvalue2s(L, L->top.p, cl);
@@ -333,3 +398,18 @@ LClosure *luaU_undump(lua_State *L, ZIO *Z, const char *name) {
   return cl;
 }
 
+
+
+/*
+** Reader for chunks loaded in place: hands over the whole chunk at once,
+** so that 'loadInPlace' can point into it
+*/
+const char *luaU_mappedreader (lua_State *L, void *ud, size_t *size) {
+  MappedChunk *mc = (MappedChunk *)ud;
+  (void)L;  /* not used */
+  if (mc->done || mc->size == 0)
+    return NULL;
+  mc->done = 1;
+  *size = mc->size;
+  return mc->buff;
+}
@@ -0,0 +1,377 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lgc.h"
+#include "lstate.h"
+#include "swiftalloc.h"
+
+/*
+** {======================================================
+** Slab allocator
+** Lua allocates huge numbers of small objects of a few sizes
+** (strings, tables, nodes, closures, upvalues, call infos). Blocks
+** up to LUA_SLAB_MAXSIZE are grouped in size classes of
+** LUA_SLAB_GRANULE bytes; each class hands out blocks from its free
+** list, or bumps a pointer through its current chunk. Chunks are
+** only returned to the system when the state is closed. A reserve
+** chunk, allocated with the state, serves the large blocks that shrink
+** to a class size when no chunk can be allocated, since such a block
+** cannot be kept in place: Lua frees it with its new size, which would
+** put it on a free list.
+** =======================================================
+*/
+
+typedef struct SlabBlock {
+    struct SlabBlock *next;
+} SlabBlock;
+
+typedef struct SlabAllocator {
+    SlabBlock *freelist[LUA_SLAB_NUMCLASSES];
+    char *next[LUA_SLAB_NUMCLASSES];  /* next unused block in the current chunk */
+    char *limit[LUA_SLAB_NUMCLASSES];  /* end of the current chunk */
+    char *reserve;  /* next unused block in the reserve chunk */
+    char *reservelimit;  /* end of the reserve chunk */
+    void *chunks;  /* all chunks, linked through their first word */
+    lua_SlabStats stats;
+} SlabAllocator;
+
+#define sizeclass(s)    ((int)(((s) - 1) / LUA_SLAB_GRANULE))
+#define classsize(c)    ((size_t)((c) + 1) * LUA_SLAB_GRANULE)
+
+static void slab_count (SlabAllocator *a, size_t osize, size_t nsize) {
+    a->stats.totalbytes = a->stats.totalbytes - osize + nsize;
+    if (a->stats.totalbytes > a->stats.peakbytes)
+        a->stats.peakbytes = a->stats.totalbytes;
+}
+
+/* account for a block of 'size' bytes being handed to Lua */
+static void slab_countblock (SlabAllocator *a, size_t size) {
+    if (size > LUA_SLAB_MAXSIZE)
+        a->stats.largebytes += size;
+    else {
+        a->stats.classbytes[sizeclass(size)] += size;
+        a->stats.classblocks[sizeclass(size)]++;
+    }
+    slab_count(a, 0, size);
+}
+
+/* account for a block of 'size' bytes given back by Lua */
+static void slab_uncountblock (SlabAllocator *a, size_t size) {
+    if (size > LUA_SLAB_MAXSIZE)
+        a->stats.largebytes -= size;
+    else {
+        a->stats.classbytes[sizeclass(size)] -= size;
+        a->stats.classblocks[sizeclass(size)]--;
+    }
+    slab_count(a, size, 0);
+}
+
+/* returns the first block of a new chunk */
+static char *slab_newchunk (SlabAllocator *a) {
+    char *chunk = (char *)malloc(LUA_SLAB_CHUNKSIZE);
+    if (chunk == NULL)
+        return NULL;
+    *(void **)chunk = a->chunks;
+    a->chunks = chunk;
+    a->stats.chunkbytes += LUA_SLAB_CHUNKSIZE;
+    /* keep the first granule for the link, so blocks stay aligned */
+    return chunk + LUA_SLAB_GRANULE;
+}
+
+static void *slab_acquire (SlabAllocator *a, size_t size) {
+    SlabBlock *b;
+    int c;
+    if (size > LUA_SLAB_MAXSIZE) {
+        void *p = malloc(size);
+        if (p != NULL)
+            slab_countblock(a, size);
+        return p;
+    }
+    c = sizeclass(size);
+    b = a->freelist[c];
+    if (b != NULL) {
+        a->freelist[c] = b->next;
+        a->stats.freeblocks[c]--;
+    }
+    else {
+        if (a->next[c] == NULL || a->next[c] + classsize(c) > a->limit[c]) {
+            char *first = slab_newchunk(a);
+            if (first == NULL)
+                return NULL;
+            a->next[c] = first;
+            a->limit[c] = first + LUA_SLAB_CHUNKSIZE - LUA_SLAB_GRANULE;
+        }
+        b = (SlabBlock *)a->next[c];
+        a->next[c] += classsize(c);
+    }
+    slab_countblock(a, size);
+    return b;
+}
+
+/* takes a block from the reserve chunk, replacing the chunk once used up */
+static void *slab_acquirereserve (SlabAllocator *a, size_t size) {
+    void *b;
+    int c = sizeclass(size);
+    if (a->reserve == NULL || a->reserve + classsize(c) > a->reservelimit) {
+        char *first = slab_newchunk(a);
+        if (first == NULL)
+            return NULL;
+        a->reserve = first;
+        a->reservelimit = first + LUA_SLAB_CHUNKSIZE - LUA_SLAB_GRANULE;
+    }
+    b = a->reserve;
+    a->reserve += classsize(c);
+    slab_countblock(a, size);
+    return b;
+}
+
+static void slab_release (SlabAllocator *a, void *ptr, size_t size) {
+    SlabBlock *b = (SlabBlock *)ptr;
+    int c;
+    if (ptr == NULL)
+        return;
+    slab_uncountblock(a, size);
+    if (size > LUA_SLAB_MAXSIZE) {
+        free(ptr);
+        return;
+    }
+    c = sizeclass(size);
+    b->next = a->freelist[c];
+    a->freelist[c] = b;
+    a->stats.freeblocks[c]++;
+}
+
+static void *slab_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
+    SlabAllocator *a = (SlabAllocator *)ud;
+    void *newptr;
+    if (ptr == NULL)
+        osize = 0;  /* 'osize' is the kind of object being created */
+    if (nsize == 0) {
+        slab_release(a, ptr, osize);
+        return NULL;
+    }
+    if (ptr != NULL && osize > LUA_SLAB_MAXSIZE && nsize > LUA_SLAB_MAXSIZE) {
+        newptr = realloc(ptr, nsize);
+        if (newptr == NULL)
+            return NULL;
+        a->stats.largebytes = a->stats.largebytes - osize + nsize;
+        slab_count(a, osize, nsize);
+        return newptr;
+    }
+    if (ptr != NULL && osize <= LUA_SLAB_MAXSIZE && nsize <= LUA_SLAB_MAXSIZE &&
+        sizeclass(osize) == sizeclass(nsize)) {  /* block still fits? */
+        a->stats.classbytes[sizeclass(nsize)] += nsize - osize;
+        slab_count(a, osize, nsize);
+        return ptr;
+    }
+    newptr = slab_acquire(a, nsize);
+    if (newptr == NULL && ptr != NULL && nsize <= osize) {
+        /* do not fail a shrink when possible */
+        if (osize <= LUA_SLAB_MAXSIZE) {
+            /* keep the bigger block, which is then released into the smaller class */
+            slab_uncountblock(a, osize);
+            slab_countblock(a, nsize);
+            return ptr;
+        }
+        newptr = slab_acquirereserve(a, nsize);  /* a large block must not reach a free list */
+    }
+    if (newptr == NULL)
+        return NULL;
+    if (ptr != NULL) {
+        memcpy(newptr, ptr, osize < nsize ? osize : nsize);
+        slab_release(a, ptr, osize);
+    }
+    return newptr;
+}
+
+static lua_Alloc baseallocf (lua_State *L, void **ud);
+
+static void slab_destroy (SlabAllocator *a) {
+    void *chunk = a->chunks;
+    while (chunk != NULL) {
+        void *next = *(void **)chunk;
+        free(chunk);
+        chunk = next;
+    }
+    free(a);
+}
+
+/*
+** Creates a state whose memory comes from a slab allocator owned by the state
+*/
+LUA_API lua_State *lua_newstate_slab (void) {
+    lua_State *L;
+    SlabAllocator *a = (SlabAllocator *)calloc(1, sizeof(SlabAllocator));
+    if (a == NULL)
+        return NULL;
+    a->reserve = slab_newchunk(a);
+    if (a->reserve == NULL) {
+        slab_destroy(a);
+        return NULL;
+    }
+    a->reservelimit = a->reserve + LUA_SLAB_CHUNKSIZE - LUA_SLAB_GRANULE;
+    L = luaL_newstatealloc(slab_alloc, a);
+    if (L == NULL)
+        slab_destroy(a);
+    return L;
+}
+
+/*
+** Copies the allocation statistics of a state created by lua_newstate_slab
+*/
+LUA_API int lua_slab_getstats (lua_State *L, lua_SlabStats *stats) {
+    void *ud;
+    if (baseallocf(L, &ud) != slab_alloc)
+        return 0;
+    *stats = ((SlabAllocator *)ud)->stats;
+    return 1;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Memory limit
+** A wrapper around the state's allocator that counts the bytes in use.
+** A growing allocation that would pass the soft limit fails once, when
+** it is safe for Lua to retry ('cantryagain' in lmem.c): Lua then runs
+** an emergency full collection and asks again. Allocations made by the
+** collection itself (or its finalizers) go through without counting as
+** that retry. Code calling the allocator directly (resizebox in
+** lauxlib.c, loadentry in swiftbundle.c) retries after a collection
+** too, so the soft limit never surfaces as an error. The next soft
+** collection waits until usage has grown by LUA_MEMSOFTSTEP of the soft
+** limit past what that collection left, so a script living near the
+** soft limit does not collect on every allocation. A growing allocation
+** that would pass the hard limit always fails; after its own emergency
+** collection Lua raises LUA_ERRMEM. Shrinking and freeing never fail.
+** =======================================================
+*/
+
+/* fraction (1/n) of the soft limit allocated between soft collections */
+#define LUA_MEMSOFTSTEP     8
+
+typedef struct MemLimit {
+    lua_Alloc f;  /* wrapped allocator */
+    void *ud;
+    global_State *g;
+    size_t soft, hard;  /* limits, (size_t)-1 for none */
+    size_t nextsoft;  /* usage that triggers the next soft collection */
+    int softpending;  /* a soft collection was requested and not yet seen */
+    lua_MemStats stats;
+} MemLimit;
+
+#define cantryagain(g)  (completestate(g) && !(g)->gcstopem)
+
+/* the collector or its finalizers are running */
+#define incollection(g) ((g)->gcstopem || ((g)->gcstp & GCSTPGC))
+
+static void *limit_alloc (void *ud, void *ptr, size_t osize, size_t nsize) {
+    MemLimit *m = (MemLimit *)ud;
+    void *newptr;
+    if (ptr == NULL)
+        osize = 0;  /* 'osize' is the kind of object being created */
+    if (nsize > osize) {
+        size_t total = m->stats.totalbytes + (nsize - osize);
+        if (total > m->hard) {
+            m->stats.failedallocs++;
+            return NULL;
+        }
+        if (m->softpending) {
+            if (!incollection(m->g)) {  /* Lua collected and is retrying */
+                size_t step = m->soft / LUA_MEMSOFTSTEP;
+                m->softpending = 0;
+                m->nextsoft = m->stats.totalbytes + step > m->soft
+                                  ? m->stats.totalbytes + step
+                                  : m->soft;
+            }
+        }
+        else if (total > m->nextsoft && cantryagain(m->g)) {
+            m->softpending = 1;
+            m->stats.softcollections++;
+            return NULL;
+        }
+    }
+    newptr = m->f(m->ud, ptr, osize, nsize);
+    if (newptr == NULL && nsize > 0)
+        return NULL;
+    m->stats.totalbytes = m->stats.totalbytes - osize + nsize;
+    if (m->stats.totalbytes > m->stats.peakbytes)
+        m->stats.peakbytes = m->stats.totalbytes;
+    return newptr;
+}
+
+/*
+** Returns the allocator of 'L' underneath the memory limit wrapper
+*/
+static lua_Alloc baseallocf (lua_State *L, void **ud) {
+    lua_Alloc f = lua_getallocf(L, ud);
+    if (f == limit_alloc) {
+        MemLimit *m = (MemLimit *)*ud;
+        *ud = m->ud;
+        return m->f;
+    }
+    return f;
+}
+
+
+/*
+** Installs the memory limit wrapper (0 means no limit) or updates its limits
+*/
+LUA_API void lua_setmemlimit (lua_State *L, size_t soft, size_t hard) {
+    void *ud;
+    MemLimit *m;
+    lua_Alloc f = lua_getallocf(L, &ud);
+    if (f == limit_alloc)
+        m = (MemLimit *)ud;
+    else {
+        m = (MemLimit *)calloc(1, sizeof(MemLimit));
+        if (m == NULL)
+            luaL_error(L, "cannot allocate memory limit");
+        m->f = f;
+        m->ud = ud;
+        m->g = G(L);
+        m->stats.totalbytes = m->stats.peakbytes = (size_t)gettotalbytes(G(L));
+        lua_setallocf(L, limit_alloc, m);
+    }
+    m->stats.softlimit = soft;
+    m->stats.hardlimit = hard;
+    m->soft = soft == 0 ? (size_t)-1 : soft;
+    m->hard = hard == 0 ? (size_t)-1 : hard;
+    m->nextsoft = m->soft;
+    m->softpending = 0;
+}
+
+/*
+** Copies the counters of a state with a memory limit
+*/
+LUA_API int lua_getmemstats (lua_State *L, lua_MemStats *stats) {
+    void *ud;
+    if (lua_getallocf(L, &ud) != limit_alloc)
+        return 0;
+    *stats = ((MemLimit *)ud)->stats;
+    return 1;
+}
+
+/* }====================================================== */
+
+
+/*
+** Closes the state and releases the allocators it owns (if any)
+*/
+LUA_API void lua_close_allocator (lua_State *L) {
+    void *ud;
+    lua_Alloc f = lua_getallocf(L, &ud);
+    lua_close(L);
+    if (f == limit_alloc) {
+        MemLimit *m = (MemLimit *)ud;
+        f = m->f;
+        ud = m->ud;
+        free(m);
+    }
+    if (f == slab_alloc)
+        slab_destroy((SlabAllocator *)ud);
+}
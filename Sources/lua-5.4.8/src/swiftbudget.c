@@ -0,0 +1,115 @@
+#include "lua.h"
+#include "lauxlib.h"
+#include "swiftbudget.h"
+
+/*
+** {======================================================
+** Instruction budget
+** The settings live in a userdata in the registry; its user value is a
+** weak-keyed table mapping each coroutine to the instructions it has
+** left. A coroutine without an entry has not used any of its budget.
+** States without a budget have no hook, so they pay nothing.
+** =======================================================
+*/
+
+typedef struct Budget {
+    lua_Integer budget;
+    int mode;
+} Budget;
+
+static const char BUDGETKEY = 'b';
+
+/* pushes the weak-keyed table of remaining budgets and returns the settings (or NULL, pushing nothing) */
+static Budget *getbudget (lua_State *L) {
+    Budget *b;
+    if (lua_rawgetp(L, LUA_REGISTRYINDEX, &BUDGETKEY) != LUA_TUSERDATA) {
+        lua_pop(L, 1);
+        return NULL;
+    }
+    b = (Budget *)lua_touserdata(L, -1);
+    lua_getiuservalue(L, -1, 1);
+    lua_remove(L, -2);
+    return b;
+}
+
+static void budgethook (lua_State *L, lua_Debug *ar) {
+    Budget *b;
+    lua_Integer left;
+    if (ar->event != LUA_HOOKCOUNT)
+        return;
+    b = getbudget(L);
+    if (b == NULL) {  /* budget was cleared */
+        lua_sethook(L, NULL, 0, 0);
+        return;
+    }
+    lua_pushthread(L);
+    if (lua_rawget(L, -2) == LUA_TNUMBER)
+        left = lua_tointeger(L, -1);
+    else
+        left = b->budget;
+    lua_pop(L, 1);
+    left -= lua_gethookcount(L);
+    if (left > 0 || (b->mode == LUA_BUDGETYIELD && lua_isyieldable(L))) {
+        lua_pushthread(L);
+        lua_pushinteger(L, left > 0 ? left : b->budget);
+        lua_rawset(L, -3);
+        lua_pop(L, 1);
+        if (left <= 0)
+            lua_yield(L, 0);  /* hook must return right after it */
+        return;
+    }
+    lua_pushthread(L);
+    lua_pushinteger(L, 0);
+    lua_rawset(L, -3);
+    lua_pop(L, 1);
+    luaL_error(L, "instruction budget exhausted");
+}
+
+LUA_API void lua_setbudget (lua_State *L, lua_Integer budget, int quantum, int mode) {
+    Budget *b;
+    if (budget <= 0) {
+        lua_clearbudget(L);
+        return;
+    }
+    if (quantum <= 0)
+        quantum = 1000;
+    if (quantum > budget)
+        quantum = (int)budget;
+    b = (Budget *)lua_newuserdatauv(L, sizeof(Budget), 1);
+    b->budget = budget;
+    b->mode = mode;
+    lua_createtable(L, 0, 1);
+    lua_createtable(L, 0, 1);  /* metatable */
+    lua_pushliteral(L, "k");
+    lua_setfield(L, -2, "__mode");
+    lua_setmetatable(L, -2);
+    lua_setiuservalue(L, -2, 1);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &BUDGETKEY);
+    lua_sethook(L, budgethook, LUA_MASKCOUNT, quantum);
+}
+
+LUA_API void lua_clearbudget (lua_State *L) {
+    lua_pushnil(L);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, &BUDGETKEY);
+    if (lua_gethook(L) == budgethook)
+        lua_sethook(L, NULL, 0, 0);
+}
+
+LUA_API int lua_getbudget (lua_State *L, lua_Integer *remaining) {
+    Budget *b = getbudget(L);
+    if (b == NULL)
+        return 0;
+    lua_pushthread(L);
+    if (lua_rawget(L, -2) == LUA_TNUMBER)
+        *remaining = lua_tointeger(L, -1);
+    else
+        *remaining = b->budget;
+    lua_pop(L, 2);
+    return 1;
+}
+
+LUA_API int lua_isbudgethook (lua_State *L) {
+    return lua_gethook(L) == budgethook;
+}
+
+/* }====================================================== */
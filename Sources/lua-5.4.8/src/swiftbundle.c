@@ -0,0 +1,610 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "swiftbundle.h"
+
+#define HEADERSIZE      24
+#define TOCENTRYSIZE    24  /* without the name */
+
+/*
+** {======================================================
+** LZ codec
+** An LZ77 block in the layout of LZ4: a sequence of
+**   token (literal length << 4 | match length - LZ_MINMATCH)
+**   [more literal length] literals offset (u16) [more match length]
+** where a nibble of 15 continues in bytes of 255 until a smaller one.
+** The last sequence has literals only. The compressor is greedy with a
+** single-entry hash table; decompression is a tight copy loop, which is
+** what matters when modules are loaded at startup.
+** =======================================================
+*/
+
+#define LZ_MINMATCH     4
+#define LZ_MAXOFFSET    65535
+#define LZ_HASHBITS     12
+
+/* worst case compressed size of 'n' bytes */
+#define lz_bound(n)     ((n) + (n) / 255 + 16)
+
+static unsigned int lz_hash (const unsigned char *p) {
+    unsigned int v = (unsigned int)p[0] | ((unsigned int)p[1] << 8) |
+                     ((unsigned int)p[2] << 16) | ((unsigned int)p[3] << 24);
+    return (v * 2654435761u) >> (32 - LZ_HASHBITS);
+}
+
+static unsigned char *lz_putlength (unsigned char *op, size_t len) {
+    for (; len >= 255; len -= 255)
+        *op++ = 255;
+    *op++ = (unsigned char)len;
+    return op;
+}
+
+static unsigned char *lz_putliterals (unsigned char *op, const unsigned char *lit,
+                                      size_t litlen, size_t matchlen) {
+    *op++ = (unsigned char)(((litlen < 15 ? litlen : 15) << 4) |
+                            (matchlen < 15 ? matchlen : 15));
+    if (litlen >= 15)
+        op = lz_putlength(op, litlen - 15);
+    memcpy(op, lit, litlen);
+    return op + litlen;
+}
+
+/* compresses 'n' bytes into 'dst' (of lz_bound(n) bytes); returns the compressed size */
+static size_t lz_compress (const unsigned char *src, size_t n, unsigned char *dst) {
+    unsigned int table[1 << LZ_HASHBITS];  /* position + 1 of the last occurrence */
+    const unsigned char *ip = src, *anchor = src, *end = src + n;
+    unsigned char *op = dst;
+    memset(table, 0, sizeof(table));
+    while (n >= LZ_MINMATCH && ip <= end - LZ_MINMATCH) {
+        unsigned int h = lz_hash(ip);
+        size_t candidate = table[h];
+        table[h] = (unsigned int)(ip - src) + 1;
+        if (candidate != 0 && (size_t)(ip - src) - (candidate - 1) <= LZ_MAXOFFSET &&
+            memcmp(src + candidate - 1, ip, LZ_MINMATCH) == 0) {
+            const unsigned char *ref = src + candidate - 1;
+            size_t offset = (size_t)(ip - ref);
+            size_t len = LZ_MINMATCH;
+            while (ip + len < end && ref[len] == ip[len])
+                len++;
+            op = lz_putliterals(op, anchor, (size_t)(ip - anchor), len - LZ_MINMATCH);
+            *op++ = (unsigned char)(offset & 0xff);
+            *op++ = (unsigned char)(offset >> 8);
+            if (len - LZ_MINMATCH >= 15)
+                op = lz_putlength(op, len - LZ_MINMATCH - 15);
+            ip += len;
+            anchor = ip;
+        }
+        else
+            ip++;
+    }
+    op = lz_putliterals(op, anchor, (size_t)(end - anchor), 0);
+    return (size_t)(op - dst);
+}
+
+static int lz_getlength (const unsigned char **ip, const unsigned char *iend, size_t *len) {
+    unsigned int b;
+    do {
+        if (*ip >= iend)
+            return 0;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+    return 1;
+}
+
+/* decompresses exactly 'rawsize' bytes into 'dst'; returns 0 on malformed input */
+static int lz_decompress (const unsigned char *ip, size_t n, unsigned char *dst, size_t rawsize) {
+    const unsigned char *iend = ip + n;
+    unsigned char *op = dst, *oend = dst + rawsize;
+    for (;;) {
+        unsigned int token;
+        size_t len, offset;
+        if (ip >= iend)
+            return 0;
+        token = *ip++;
+        len = token >> 4;
+        if (len == 15 && !lz_getlength(&ip, iend, &len))
+            return 0;
+        if ((size_t)(iend - ip) < len || (size_t)(oend - op) < len)
+            return 0;
+        memcpy(op, ip, len);
+        op += len;
+        ip += len;
+        if (ip == iend)  /* last sequence */
+            return op == oend;
+        if (iend - ip < 2)
+            return 0;
+        offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst))
+            return 0;
+        len = token & 15;
+        if (len == 15 && !lz_getlength(&ip, iend, &len))
+            return 0;
+        len += LZ_MINMATCH;
+        if ((size_t)(oend - op) < len)
+            return 0;
+        if (offset >= len)
+            memcpy(op, op - offset, len);
+        else {  /* overlapping match repeats the last 'offset' bytes */
+            const unsigned char *ref = op - offset;
+            while (len--)
+                *op++ = *ref++;
+            continue;
+        }
+        op += len;
+    }
+}
+
+/* }====================================================== */
+
+
+static unsigned long long fnv1a (const char *p, size_t n) {
+    unsigned long long h = 14695981039346656037ULL;
+    size_t i;
+    for (i = 0; i < n; i++) {
+        h ^= (unsigned char)p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static unsigned long getu32 (const unsigned char *p) {
+    return (unsigned long)p[0] | ((unsigned long)p[1] << 8) |
+           ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+static void putu32 (unsigned char *p, size_t v) {
+    p[0] = (unsigned char)(v & 0xff);
+    p[1] = (unsigned char)((v >> 8) & 0xff);
+    p[2] = (unsigned char)((v >> 16) & 0xff);
+    p[3] = (unsigned char)((v >> 24) & 0xff);
+}
+
+
+/*
+** {======================================================
+** Writing bundles
+** =======================================================
+*/
+
+typedef struct WriteModule {
+    const char *name;
+    size_t namelen;
+    const char *chunk;  /* bytes written, compressed or not */
+    size_t size;
+    size_t rawsize;
+    size_t offset;
+    unsigned long long hash;
+    int method;
+} WriteModule;
+
+static int cmpmodule (const void *a, const void *b) {
+    const WriteModule *ma = (const WriteModule *)a;
+    const WriteModule *mb = (const WriteModule *)b;
+    size_t len = ma->namelen < mb->namelen ? ma->namelen : mb->namelen;
+    int res = memcmp(ma->name, mb->name, len);
+    if (res != 0)
+        return res;
+    return (ma->namelen > mb->namelen) - (ma->namelen < mb->namelen);
+}
+
+LUALIB_API int luaL_writebundle (lua_State *L, int idx, lua_Writer writer,
+                                 void *data, int flags) {
+    static const unsigned char zeros[LUA_BUNDLE_ALIGN] = { 0 };
+    WriteModule *modules;
+    unsigned char header[HEADERSIZE];
+    size_t n = 0, i, maxsize = 0, tocsize = 0, offset;
+    int packed, status = 0;
+    idx = lua_absindex(L, idx);
+    luaL_checktype(L, idx, LUA_TTABLE);
+    lua_pushnil(L);
+    while (lua_next(L, idx)) {
+        if (lua_type(L, -2) != LUA_TSTRING || lua_type(L, -1) != LUA_TSTRING) {
+            lua_pop(L, 2);
+            lua_pushliteral(L, "bundle modules must map names to chunk strings");
+            return -1;
+        }
+        n++;
+        lua_pop(L, 1);
+    }
+    modules = (WriteModule *)lua_newuserdatauv(L, (n > 0 ? n : 1) * sizeof(WriteModule), 0);
+    lua_newtable(L);  /* keeps compressed chunks alive */
+    packed = lua_gettop(L);
+    lua_pushnil(L);
+    for (i = 0; lua_next(L, idx); i++) {
+        WriteModule *m = &modules[i];
+        m->name = lua_tolstring(L, -2, &m->namelen);
+        m->chunk = lua_tolstring(L, -1, &m->rawsize);
+        m->size = m->rawsize;
+        m->hash = fnv1a(m->chunk, m->rawsize);
+        m->method = LUA_BUNDLE_STORED;
+        if (m->rawsize > maxsize)
+            maxsize = m->rawsize;
+        lua_pop(L, 1);
+    }
+    qsort(modules, n, sizeof(WriteModule), cmpmodule);
+    if (flags & LUA_BUNDLE_COMPRESS) {
+        unsigned char *scratch = (unsigned char *)lua_newuserdatauv(L, lz_bound(maxsize), 0);
+        for (i = 0; i < n; i++) {
+            WriteModule *m = &modules[i];
+            size_t size = lz_compress((const unsigned char *)m->chunk, m->rawsize, scratch);
+            if (size < m->rawsize) {
+                m->chunk = lua_pushlstring(L, (const char *)scratch, size);
+                lua_rawseti(L, packed, (lua_Integer)i + 1);
+                m->size = size;
+                m->method = LUA_BUNDLE_LZ;
+            }
+        }
+        lua_pop(L, 1);  /* scratch */
+    }
+    for (i = 0; i < n; i++) {
+        if (modules[i].namelen > 0xffff) {
+            lua_pop(L, 2);
+            lua_pushfstring(L, "module name '%s' too long", modules[i].name);
+            return -1;
+        }
+        if (i > 0 && cmpmodule(&modules[i - 1], &modules[i]) == 0) {
+            lua_pop(L, 2);
+            lua_pushfstring(L, "duplicate module '%s'", modules[i].name);
+            return -1;
+        }
+        tocsize += TOCENTRYSIZE + modules[i].namelen;
+    }
+    offset = HEADERSIZE + tocsize;
+    for (i = 0; i < n; i++) {
+        offset = (offset + LUA_BUNDLE_ALIGN - 1) & ~(size_t)(LUA_BUNDLE_ALIGN - 1);
+        modules[i].offset = offset;
+        offset += modules[i].size;
+    }
+    if (offset > 0xffffffffUL) {
+        lua_pop(L, 2);
+        lua_pushliteral(L, "bundle too big");
+        return -1;
+    }
+    memcpy(header, LUA_BUNDLE_SIGNATURE, 8);
+    putu32(header + 8, LUA_BUNDLE_VERSION);
+    putu32(header + 12, n);
+    putu32(header + 16, tocsize);
+    putu32(header + 20, 0);
+    status = writer(L, header, HEADERSIZE, data);
+    for (i = 0; i < n && status == 0; i++) {
+        WriteModule *m = &modules[i];
+        unsigned char entry[TOCENTRYSIZE];
+        entry[0] = (unsigned char)(m->namelen & 0xff);
+        entry[1] = (unsigned char)(m->namelen >> 8);
+        entry[2] = (unsigned char)m->method;
+        entry[3] = 0;
+        putu32(entry + 4, m->offset);
+        putu32(entry + 8, m->size);
+        putu32(entry + 12, m->rawsize);
+        putu32(entry + 16, (size_t)(m->hash & 0xffffffffUL));
+        putu32(entry + 20, (size_t)(m->hash >> 32));
+        status = writer(L, entry, TOCENTRYSIZE, data);
+        if (status == 0)
+            status = writer(L, m->name, m->namelen, data);
+    }
+    offset = HEADERSIZE + tocsize;
+    for (i = 0; i < n && status == 0; i++) {
+        WriteModule *m = &modules[i];
+        if (m->offset > offset)
+            status = writer(L, zeros, m->offset - offset, data);
+        if (status == 0)
+            status = writer(L, m->chunk, m->size, data);
+        offset = m->offset + m->size;
+    }
+    lua_pop(L, 2);  /* modules and compressed chunks */
+    return status;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** Reading bundles
+** A bundle userdata holds the parsed table of contents; its user value
+** is the bundle's name. The bytes are shared, through a reference
+** count, with the functions loaded in place from them (stored binary
+** chunks, see lua_loadmapped), so they outlive the userdata if needed.
+** =======================================================
+*/
+
+typedef struct BundleData {
+    int refs;
+    const char *buff;
+    size_t size;
+    lua_Release release;
+    void *ud;
+    lua_Alloc allocf;  /* allocator of the state that allocated it */
+    void *allocud;
+} BundleData;
+
+typedef struct BundleEntry {
+    const char *name;
+    size_t namelen;
+    size_t offset, size, rawsize;
+    unsigned long long hash;
+    int method;
+    int verified;  /* hash already checked */
+} BundleEntry;
+
+typedef struct Bundle {
+    BundleData *data;  /* NULL once collected */
+    lua_BundleStats stats;
+    size_t n;
+    BundleEntry entries[1];
+} Bundle;
+
+static void unrefdata (void *ud, const void *p, size_t sz) {
+    BundleData *d = (BundleData *)ud;
+    (void)p; (void)sz;
+    if (--d->refs == 0) {
+        if (d->release)
+            (*d->release)(d->ud, d->buff, d->size);
+        (*d->allocf)(d->allocud, d, sizeof(BundleData), 0);
+    }
+}
+
+static int bundle_gc (lua_State *L) {
+    Bundle *b = (Bundle *)luaL_checkudata(L, 1, LUA_BUNDLE_HANDLE);
+    if (b->data != NULL) {
+        unrefdata(b->data, NULL, 0);
+        b->data = NULL;
+    }
+    return 0;
+}
+
+static int bundle_tostring (lua_State *L) {
+    luaL_checkudata(L, 1, LUA_BUNDLE_HANDLE);
+    lua_getiuservalue(L, 1, 1);
+    lua_pushfstring(L, "bundle (%s)", lua_tostring(L, -1));
+    return 1;
+}
+
+static int badbundle (lua_State *L, const char *name, const char *why,
+                      const char *buff, size_t size, lua_Release release, void *ud) {
+    if (release)
+        (*release)(ud, buff, size);
+    lua_pushfstring(L, "%s: bad bundle (%s)", name, why);
+    return LUA_ERRSYNTAX;
+}
+
+/* arguments and results of 'openbundle' */
+typedef struct OpenBundle {
+    const char *buff;
+    size_t size;
+    const char *name;
+    size_t n;
+    const char *why;  /* set when the table of contents is bad */
+} OpenBundle;
+
+/*
+** Creates the bundle userdata, with its metatable and name, and parses
+** the table of contents into it. It runs in protected mode, before the
+** bundle takes the bytes over, so that errors cannot lose them.
+*/
+static int openbundle (lua_State *L) {
+    OpenBundle *ob = (OpenBundle *)lua_touserdata(L, 1);
+    const unsigned char *p = (const unsigned char *)ob->buff;
+    size_t n = ob->n, tocsize = getu32(p + 16), i, pos;
+    Bundle *b = (Bundle *)lua_newuserdatauv(L, offsetof(Bundle, entries) +
+                                               (n > 0 ? n : 1) * sizeof(BundleEntry), 1);
+    memset(&b->stats, 0, sizeof(b->stats));
+    b->data = NULL;
+    b->n = n;
+    b->stats.modules = n;
+    if (luaL_newmetatable(L, LUA_BUNDLE_HANDLE)) {
+        lua_pushcfunction(L, bundle_gc);
+        lua_setfield(L, -2, "__gc");
+        lua_pushcfunction(L, bundle_tostring);
+        lua_setfield(L, -2, "__tostring");
+    }
+    lua_setmetatable(L, -2);
+    lua_pushstring(L, ob->name);
+    lua_setiuservalue(L, -2, 1);
+    pos = HEADERSIZE;
+    for (i = 0; i < n; i++) {
+        BundleEntry *e = &b->entries[i];
+        const unsigned char *t = p + pos;
+        if (pos + TOCENTRYSIZE > HEADERSIZE + tocsize)
+            break;
+        e->namelen = (size_t)t[0] | ((size_t)t[1] << 8);
+        e->method = t[2];
+        e->offset = getu32(t + 4);
+        e->size = getu32(t + 8);
+        e->rawsize = getu32(t + 12);
+        e->hash = (unsigned long long)getu32(t + 16) |
+                  ((unsigned long long)getu32(t + 20) << 32);
+        e->name = ob->buff + pos + TOCENTRYSIZE;
+        e->verified = 0;
+        pos += TOCENTRYSIZE + e->namelen;
+        if (pos > HEADERSIZE + tocsize || e->offset > ob->size || e->size > ob->size - e->offset ||
+            e->method > LUA_BUNDLE_LZ ||
+            (e->method == LUA_BUNDLE_STORED && e->size != e->rawsize))
+            break;
+        if (i > 0) {
+            const BundleEntry *prev = &b->entries[i - 1];
+            size_t len = prev->namelen < e->namelen ? prev->namelen : e->namelen;
+            int res = memcmp(prev->name, e->name, len);
+            if (res > 0 || (res == 0 && prev->namelen >= e->namelen))
+                break;  /* binary search needs sorted names */
+        }
+    }
+    if (i < n)
+        ob->why = "corrupted table of contents";
+    return 1;
+}
+
+LUA_API int lua_openbundle (lua_State *L, const char *buff, size_t size,
+                            const char *name, lua_Release release, void *ud) {
+    const unsigned char *p = (const unsigned char *)buff;
+    OpenBundle ob;
+    size_t tocsize;
+    BundleData *d;
+    lua_Alloc allocf;
+    void *allocud;
+    int status;
+    if (size < HEADERSIZE || memcmp(buff, LUA_BUNDLE_SIGNATURE, 8) != 0)
+        return badbundle(L, name, "not a bundle", buff, size, release, ud);
+    if (getu32(p + 8) != LUA_BUNDLE_VERSION)
+        return badbundle(L, name, "version mismatch", buff, size, release, ud);
+    ob.n = getu32(p + 12);
+    tocsize = getu32(p + 16);
+    if (tocsize > size - HEADERSIZE || ob.n > tocsize / TOCENTRYSIZE)
+        return badbundle(L, name, "truncated", buff, size, release, ud);
+    ob.buff = buff;
+    ob.size = size;
+    ob.name = name;
+    ob.why = NULL;
+    lua_pushcfunction(L, openbundle);
+    lua_pushlightuserdata(L, &ob);
+    status = lua_pcall(L, 1, 1, 0);
+    if (status != LUA_OK) {  /* error message on the stack */
+        if (release)
+            (*release)(ud, buff, size);
+        return status;
+    }
+    if (ob.why != NULL) {
+        lua_pop(L, 1);
+        return badbundle(L, name, ob.why, buff, size, release, ud);
+    }
+    /* nothing raises from here on */
+    allocf = lua_getallocf(L, &allocud);
+    d = (BundleData *)(*allocf)(allocud, NULL, 0, sizeof(BundleData));
+    if (d == NULL) {
+        lua_pop(L, 1);
+        if (release)
+            (*release)(ud, buff, size);
+        lua_pushliteral(L, "not enough memory");
+        return LUA_ERRMEM;
+    }
+    d->refs = 1;
+    d->buff = buff;
+    d->size = size;
+    d->release = release;
+    d->ud = ud;
+    d->allocf = allocf;
+    d->allocud = allocud;
+    ((Bundle *)lua_touserdata(L, -1))->data = d;
+    return LUA_OK;
+}
+
+static void freefilebuffer (void *ud, const void *p, size_t sz) {
+    (void)ud; (void)sz;
+    free((void *)p);
+}
+
+LUALIB_API int luaL_openbundlefile (lua_State *L, const char *filename) {
+    FILE *f = fopen(filename, "rb");
+    char *buff = NULL;
+    long size;
+    if (f == NULL) {
+        lua_pushfstring(L, "cannot open %s", filename);
+        return LUA_ERRFILE;
+    }
+    if (fseek(f, 0, SEEK_END) == 0 && (size = ftell(f)) >= 0 &&
+        fseek(f, 0, SEEK_SET) == 0 &&
+        (buff = (char *)malloc(size > 0 ? (size_t)size : 1)) != NULL &&
+        fread(buff, 1, (size_t)size, f) == (size_t)size) {
+        fclose(f);
+        return lua_openbundle(L, buff, (size_t)size, filename, freefilebuffer, NULL);
+    }
+    free(buff);
+    fclose(f);
+    lua_pushfstring(L, "cannot read %s", filename);
+    return LUA_ERRFILE;
+}
+
+static BundleEntry *findentry (Bundle *b, const char *name, size_t len) {
+    size_t lo = 0, hi = b->n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        BundleEntry *e = &b->entries[mid];
+        size_t common = e->namelen < len ? e->namelen : len;
+        int res = memcmp(e->name, name, common);
+        if (res == 0)
+            res = (e->namelen > len) - (e->namelen < len);
+        if (res == 0)
+            return e;
+        else if (res < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return NULL;
+}
+
+static int corrupted (lua_State *L, const char *modname) {
+    lua_pushfstring(L, "module '%s' is corrupted", modname);
+    return LUA_ERRSYNTAX;
+}
+
+/* loads the chunk of 'e' with the chunk name on the top of the stack */
+static int loadentry (lua_State *L, Bundle *b, BundleEntry *e, const char *modname) {
+    const char *chunkname = lua_tostring(L, -1);
+    const char *p = b->data->buff + e->offset;
+    void *ud;
+    lua_Alloc allocf;
+    char *raw;
+    int status;
+    b->stats.loads++;
+    if (e->method == LUA_BUNDLE_STORED) {
+        if (!e->verified) {
+            if (fnv1a(p, e->size) != e->hash)
+                return corrupted(L, modname);
+            e->verified = 1;
+        }
+        if (e->size > 0 && *p == LUA_SIGNATURE[0]) {  /* binary chunk? */
+            b->data->refs++;  /* dropped by unrefdata, called once whatever the outcome */
+            b->stats.mapped++;
+            return lua_loadmapped(L, p, e->size, chunkname, unrefdata, b->data);
+        }
+        return luaL_loadbufferx(L, p, e->size, chunkname, "t");
+    }
+    allocf = lua_getallocf(L, &ud);
+    raw = (char *)allocf(ud, NULL, 0, e->rawsize > 0 ? e->rawsize : 1);
+    if (raw == NULL) {  /* like lauxlib.c, try again after a collection */
+        lua_gc(L, LUA_GCCOLLECT, 0);
+        raw = (char *)allocf(ud, NULL, 0, e->rawsize > 0 ? e->rawsize : 1);
+    }
+    if (raw == NULL) {
+        lua_pushliteral(L, "not enough memory");
+        return LUA_ERRMEM;
+    }
+    if (!lz_decompress((const unsigned char *)p, e->size, (unsigned char *)raw, e->rawsize) ||
+        (!e->verified && fnv1a(raw, e->rawsize) != e->hash))
+        status = corrupted(L, modname);
+    else {
+        e->verified = 1;
+        b->stats.decompressed += e->rawsize;
+        status = luaL_loadbufferx(L, raw, e->rawsize, chunkname, "bt");
+    }
+    allocf(ud, raw, e->rawsize > 0 ? e->rawsize : 1, 0);
+    return status;
+}
+
+LUALIB_API int luaL_loadbundled (lua_State *L, int idx, const char *modname) {
+    Bundle *b = (Bundle *)luaL_checkudata(L, idx, LUA_BUNDLE_HANDLE);
+    BundleEntry *e;
+    int status;
+    if (b->data == NULL || (e = findentry(b, modname, strlen(modname))) == NULL)
+        return -1;
+    lua_pushfstring(L, "@%s", modname);
+    status = loadentry(L, b, e, modname);
+    lua_remove(L, -2);  /* chunk name */
+    return status;
+}
+
+LUALIB_API int luaL_bundlestats (lua_State *L, int idx, lua_BundleStats *stats) {
+    Bundle *b = (Bundle *)luaL_testudata(L, idx, LUA_BUNDLE_HANDLE);
+    if (b == NULL)
+        return 0;
+    *stats = b->stats;
+    return 1;
+}
+
+/* }====================================================== */
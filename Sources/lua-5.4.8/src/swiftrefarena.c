@@ -0,0 +1,204 @@
+#define swiftrefarena_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+#include <limits.h>
+#include <string.h>
+
+#include "lua.h"
+
+#include "lapi.h"
+#include "ldebug.h"
+#include "lgc.h"
+#include "lobject.h"
+#include "lstate.h"
+#include "ltable.h"
+
+#include "swiftrefarena.h"
+
+/*
+** {======================================================
+** Reference arenas
+** The arena is a userdata anchored in the registry by its own address.
+** Its user values are the table of values, whose array part holds the
+** slots and is written directly (with the same barrier as lua_rawseti),
+** a buffer with the generation of each slot followed by the stack of
+** free slots, and a buffer logging the references created inside open
+** scopes. Releasing a slot clears it and bumps its generation, so every
+** handle to it goes stale at once. Buffers grow by doubling; the old
+** ones are left to the collector.
+** =======================================================
+*/
+
+#define ARENA_MINSIZE   16
+
+typedef struct ArenaLog {
+    int ref;
+    unsigned int gen;
+} ArenaLog;
+
+struct lua_RefArena {
+    Table *slots;  /* slot 'ref' is slots->array[ref - 1] */
+    unsigned int *gen;  /* generation of each slot */
+    int *freeslots;  /* stack of released slots, after 'gen' */
+    int nfree;
+    int top;  /* slots used so far */
+    int size;  /* slots allocated */
+    ArenaLog *log;  /* references created inside open scopes */
+    size_t nlog, logsize;
+    int scopes;  /* open scopes */
+    lua_RefArenaStats stats;
+};
+
+/* user values of the arena */
+#define ARENA_SLOTS     1
+#define ARENA_GEN       2
+#define ARENA_LOG       3
+
+/* makes a new buffer of 'size' bytes user value 'n' of the arena */
+static void *newbuffer (lua_State *L, lua_RefArena *A, int n, size_t size) {
+    void *b;
+    lua_checkstack(L, 2);
+    lua_rawgetp(L, LUA_REGISTRYINDEX, A);
+    b = lua_newuserdatauv(L, size, 0);
+    lua_setiuservalue(L, -2, n);
+    lua_pop(L, 1);
+    return b;
+}
+
+static void growslots (lua_State *L, lua_RefArena *A) {
+    int size;
+    unsigned int *gen;
+    if (A->size > INT_MAX / 2)
+        luaG_runerror(L, "reference arena overflow");
+    size = A->size * 2;
+    luaH_resizearray(L, A->slots, (unsigned int)size);
+    gen = (unsigned int *)newbuffer(L, A, ARENA_GEN,
+                                    (size_t)size * (sizeof(unsigned int) + sizeof(int)));
+    memcpy(gen, A->gen, (size_t)A->size * sizeof(unsigned int));
+    memset(gen + A->size, 0, (size_t)(size - A->size) * sizeof(unsigned int));
+    memcpy(gen + size, A->freeslots, (size_t)A->nfree * sizeof(int));
+    A->gen = gen;
+    A->freeslots = (int *)(gen + size);
+    A->size = size;
+}
+
+static void growlog (lua_State *L, lua_RefArena *A) {
+    size_t size = (A->logsize > 0) ? A->logsize * 2 : ARENA_MINSIZE;
+    ArenaLog *log = (ArenaLog *)newbuffer(L, A, ARENA_LOG, size * sizeof(ArenaLog));
+    if (A->nlog > 0)
+        memcpy(log, A->log, A->nlog * sizeof(ArenaLog));
+    A->log = log;
+    A->logsize = size;
+}
+
+static int validref (lua_RefArena *A, int ref, unsigned int gen) {
+    return (ref >= 1 && ref <= A->top && A->gen[ref - 1] == gen);
+}
+
+static void release (lua_RefArena *A, int ref) {
+    setnilvalue(&A->slots->array[ref - 1]);
+    A->gen[ref - 1]++;
+    A->freeslots[A->nfree++] = ref;
+    A->stats.live--;
+    A->stats.released++;
+}
+
+LUA_API lua_RefArena *lua_newrefarena (lua_State *L, int capacity) {
+    lua_RefArena *A;
+    if (capacity < ARENA_MINSIZE)
+        capacity = ARENA_MINSIZE;
+    A = (lua_RefArena *)lua_newuserdatauv(L, sizeof(lua_RefArena), 3);
+    memset(A, 0, sizeof(lua_RefArena));
+    lua_createtable(L, capacity, 0);
+    A->slots = (Table *)lua_topointer(L, -1);
+    lua_setiuservalue(L, -2, ARENA_SLOTS);
+    A->gen = (unsigned int *)lua_newuserdatauv(L, (size_t)capacity *
+                                               (sizeof(unsigned int) + sizeof(int)), 0);
+    memset(A->gen, 0, (size_t)capacity * sizeof(unsigned int));
+    A->freeslots = (int *)(A->gen + capacity);
+    A->size = capacity;
+    lua_setiuservalue(L, -2, ARENA_GEN);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, A);
+    return A;
+}
+
+LUA_API void lua_closerefarena (lua_State *L, lua_RefArena *A) {
+    lua_pushnil(L);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, A);  /* the collector frees the rest */
+}
+
+LUA_API int lua_arenaref (lua_State *L, lua_RefArena *A, unsigned int *gen) {
+    int ref;
+    TValue *v;
+    if (A->scopes > 0 && A->nlog == A->logsize)
+        growlog(L, A);
+    if (A->nfree > 0)
+        ref = A->freeslots[--A->nfree];
+    else {
+        if (A->top == A->size)
+            growslots(L, A);
+        ref = ++A->top;
+    }
+    v = s2v(L->top.p - 1);  /* (after growing, which can move the stack) */
+    setobj2t(L, &A->slots->array[ref - 1], v);
+    luaC_barrierback(L, obj2gco(A->slots), v);
+    L->top.p--;
+    *gen = A->gen[ref - 1];
+    if (A->scopes > 0) {
+        A->log[A->nlog].ref = ref;
+        A->log[A->nlog++].gen = *gen;
+    }
+    A->stats.created++;
+    if (++A->stats.live > A->stats.peak)
+        A->stats.peak = A->stats.live;
+    return ref;
+}
+
+LUA_API int lua_arenapush (lua_State *L, lua_RefArena *A, int ref, unsigned int gen) {
+    const TValue *v;
+    if (l_unlikely(!validref(A, ref, gen))) {
+        A->stats.stale++;
+        setnilvalue(s2v(L->top.p));
+        api_incr_top(L);
+        return LUA_TNONE;
+    }
+    v = &A->slots->array[ref - 1];
+    setobj2s(L, L->top.p, v);
+    api_incr_top(L);
+    return ttype(v);
+}
+
+LUA_API int lua_arenaunref (lua_State *L, lua_RefArena *A, int ref, unsigned int gen) {
+    (void)L;
+    if (l_unlikely(!validref(A, ref, gen))) {
+        A->stats.stale++;
+        return 0;
+    }
+    release(A, ref);
+    return 1;
+}
+
+LUA_API size_t lua_arenaopenscope (lua_State *L, lua_RefArena *A) {
+    (void)L;
+    A->scopes++;
+    return A->nlog;
+}
+
+LUA_API void lua_arenaclosescope (lua_State *L, lua_RefArena *A, size_t mark) {
+    (void)L;
+    lua_assert(A->scopes > 0 && mark <= A->nlog);
+    while (A->nlog > mark) {
+        ArenaLog *e = &A->log[--A->nlog];
+        if (validref(A, e->ref, e->gen))  /* not released one by one? */
+            release(A, e->ref);
+    }
+    A->scopes--;
+}
+
+LUA_API void lua_arenastats (lua_RefArena *A, lua_RefArenaStats *stats) {
+    *stats = A->stats;
+}
+
+/* }====================================================== */
@@ -0,0 +1,165 @@
+#define swiftrestore_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+#include "lua.h"
+
+#include "lapi.h"
+#include "lgc.h"
+#include "lobject.h"
+#include "lstate.h"
+#include "ltable.h"
+#include "lvm.h"
+
+#include "swiftrestore.h"
+
+/*
+** {======================================================
+** Table restore
+** Used to reset pooled states from pristine copies of their tables.
+** A first pass over the table removes or replaces what differs from the
+** snapshot, assigning only existing slots (as a traversal may), and a
+** second pass over the snapshot adds back the keys the table lost.
+** Entries are removed the way Lua removes them, by emptying the value
+** and leaving the key for the collector to clear.
+** =======================================================
+*/
+
+/* sets slot 'v' of table 't' to the snapshot value 'sv' */
+static void restoreslot (lua_State *L, Table *t, TValue *v, const TValue *sv) {
+    if (isempty(sv))
+        setempty(v);
+    else {
+        setobj2t(L, v, sv);
+        luaC_barrierback(L, obj2gco(t), sv);
+    }
+}
+
+LUA_API int lua_restoretable (lua_State *L, int idx, int snapshotidx) {
+    Table *t, *s;
+    unsigned int i, size;
+    if (lua_type(L, idx) != LUA_TTABLE || lua_type(L, snapshotidx) != LUA_TTABLE)
+        return 0;
+    t = (Table *)lua_topointer(L, idx);
+    s = (Table *)lua_topointer(L, snapshotidx);
+    /* remove and replace */
+    size = luaH_realasize(t);
+    for (i = 0; i < size; i++) {
+        TValue *v = &t->array[i];
+        if (!isempty(v)) {
+            const TValue *sv = luaH_getint(s, (lua_Integer)i + 1);
+            if (!luaV_rawequalobj(v, sv))
+                restoreslot(L, t, v, sv);
+        }
+    }
+    size = sizenode(t);
+    for (i = 0; i < size; i++) {
+        Node *n = gnode(t, i);
+        if (!isempty(gval(n))) {
+            TValue k;
+            const TValue *sv;
+            getnodekey(L, &k, n);
+            sv = luaH_get(s, &k);
+            if (!luaV_rawequalobj(gval(n), sv))
+                restoreslot(L, t, gval(n), sv);
+        }
+    }
+    /* add back */
+    size = luaH_realasize(s);
+    for (i = 0; i < size; i++) {
+        TValue *sv = &s->array[i];
+        if (!isempty(sv) && isempty(luaH_getint(t, (lua_Integer)i + 1))) {
+            TValue k;
+            setivalue(&k, (lua_Integer)i + 1);
+            luaH_set(L, t, &k, sv);
+            luaC_barrierback(L, obj2gco(t), sv);
+        }
+    }
+    size = sizenode(s);
+    for (i = 0; i < size; i++) {
+        Node *n = gnode(s, i);
+        if (!isempty(gval(n))) {
+            TValue k;
+            getnodekey(L, &k, n);
+            if (isempty(luaH_get(t, &k))) {
+                luaH_set(L, t, &k, gval(n));
+                luaC_barrierback(L, obj2gco(t), gval(n));
+            }
+        }
+    }
+    invalidateTMcache(t);
+    return 1;
+}
+
+/* }====================================================== */
+
+
+/*
+** {======================================================
+** State settings
+** What else a script can change in a state without going through the
+** registry or the globals: the metatables of basic types, which live in
+** the global state, and the settings of the collector.
+** =======================================================
+*/
+
+/* basic types have one metatable for all their values */
+#define isbasictype(t)  ((t) != LUA_TTABLE && (t) != LUA_TUSERDATA)
+
+LUA_API void lua_getbasicmetatables (lua_State *L) {
+    int t;
+    lua_createtable(L, LUA_NUMTYPES, 0);
+    for (t = 0; t < LUA_NUMTYPES; t++) {
+        Table *mt = G(L)->mt[t];
+        if (isbasictype(t) && mt != NULL) {
+            lua_lock(L);
+            sethvalue2s(L, L->top.p, mt);
+            api_incr_top(L);
+            lua_unlock(L);
+            lua_rawseti(L, -2, t + 1);
+        }
+    }
+}
+
+LUA_API void lua_setbasicmetatables (lua_State *L, int idx) {
+    int t;
+    idx = lua_absindex(L, idx);
+    for (t = 0; t < LUA_NUMTYPES; t++) {
+        if (isbasictype(t)) {
+            const TValue *mt;
+            lua_rawgeti(L, idx, t + 1);
+            mt = s2v(L->top.p - 1);
+            G(L)->mt[t] = ttistable(mt) ? hvalue(mt) : NULL;
+            lua_pop(L, 1);
+        }
+    }
+}
+
+LUA_API void lua_getgcsettings (lua_State *L, lua_GCSettings *settings) {
+    global_State *g = G(L);
+    settings->mode = isdecGCmodegen(g) ? LUA_GCGEN : LUA_GCINC;
+    settings->stopped = (g->gcstp & GCSTPUSR) != 0;
+    settings->pause = getgcparam(g->gcpause);
+    settings->stepmul = getgcparam(g->gcstepmul);
+    settings->stepsize = g->gcstepsize;
+    settings->minormul = g->genminormul;
+    settings->majormul = getgcparam(g->genmajormul);
+}
+
+LUA_API void lua_setgcsettings (lua_State *L, const lua_GCSettings *settings) {
+    global_State *g = G(L);
+    setgcparam(g->gcpause, settings->pause);
+    setgcparam(g->gcstepmul, settings->stepmul);
+    g->gcstepsize = cast_byte(settings->stepsize);
+    g->genminormul = cast_byte(settings->minormul);
+    setgcparam(g->genmajormul, settings->majormul);
+    if (settings->mode != (isdecGCmodegen(g) ? LUA_GCGEN : LUA_GCINC))
+        lua_gc(L, settings->mode, 0, 0, 0);  /* zeros keep the parameters */
+    if (settings->stopped)
+        lua_gc(L, LUA_GCSTOP);
+    else if (g->gcstp & GCSTPUSR)
+        lua_gc(L, LUA_GCRESTART);
+}
+
+/* }====================================================== */
@@ -0,0 +1,155 @@
+#define swiftsort_c
+#define LUA_CORE
+
+#include "lprefix.h"
+
+#include <string.h>
+
+#include "lua.h"
+
+#include "lmem.h"
+#include "lobject.h"
+#include "lstate.h"
+#include "ltable.h"
+
+#include "swiftsort.h"
+
+/*
+** {======================================================
+** Array sort
+** Sorts the array part of a table in place with the primitive '<' of
+** integers, floats or strings, without going through the API or calling
+** Lua. The engine is a pattern-defeating quicksort (swiftsortimpl.h),
+** instantiated once per element kind so each comparison is inlined:
+** introsort with median-of-3 (or pseudomedian-of-9) pivots, insertion
+** sort for short ranges and for ranges a partition finds already in
+** order, a separate partition for runs of equal elements, and a heap
+** sort fallback after too many unbalanced partitions.
+** =======================================================
+*/
+
+#define PDQ_INSERTIONSORT   24  /* ranges shorter than this use insertion sort */
+#define PDQ_NINTHER         128  /* ranges longer than this use the pseudomedian of 9 */
+#define PDQ_PARTIALLIMIT    8  /* moves allowed to partial insertion sorts */
+
+/* element kinds */
+#define SORT_NONE       0
+#define SORT_INTEGERS   1
+#define SORT_FLOATS     2
+#define SORT_STRINGS    3
+
+static void swapvalues (TValue *a, TValue *b) {
+    TValue tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+/*
+** Compares two strings as 'l_strcmp' in lvm.c does: with 'strcoll',
+** segment by segment to handle embedded zeros
+*/
+static int strcompare (const TString *ts1, const TString *ts2) {
+    const char *s1 = getstr(ts1);
+    size_t rl1 = tsslen(ts1);
+    const char *s2 = getstr(ts2);
+    size_t rl2 = tsslen(ts2);
+    if (ts1 == ts2)
+        return 0;
+    for (;;) {
+        int temp = strcoll(s1, s2);
+        if (temp != 0)
+            return temp;
+        else {
+            size_t zl1 = strlen(s1);
+            size_t zl2 = strlen(s2);
+            if (zl2 == rl2)
+                return (zl1 == rl1) ? 0 : 1;
+            else if (zl1 == rl1)
+                return -1;
+            zl1++; zl2++;
+            s1 += zl1; rl1 -= zl1; s2 += zl2; rl2 -= zl2;
+        }
+    }
+}
+
+#define SORT_NAME(f)    ints_##f
+#define SORT_LESS(a,b)  (ivalue(a) < ivalue(b))
+#include "swiftsortimpl.h"
+
+/* floats are known not to be NaN; 0.0 and -0.0 are equal but distinct */
+#define SORT_NAME(f)    floats_##f
+#define SORT_LESS(a,b)  luai_numlt(fltvalue(a), fltvalue(b))
+#define SORT_STABLE
+#include "swiftsortimpl.h"
+
+#define SORT_NAME(f)    strings_##f
+#define SORT_LESS(a,b)  (strcompare(tsvalue(a), tsvalue(b)) < 0)
+#include "swiftsortimpl.h"
+
+/* the kind shared by every element of 'a[0 .. n - 1]', or SORT_NONE */
+static int arraykind (const TValue *a, size_t n) {
+    size_t i;
+    if (ttisinteger(&a[0])) {
+        for (i = 1; i < n; i++) {
+            if (!ttisinteger(&a[i]))
+                return SORT_NONE;
+        }
+        return SORT_INTEGERS;
+    }
+    else if (ttisfloat(&a[0])) {
+        for (i = 0; i < n; i++) {
+            /* NaN does not order, so only the generic sort can report it */
+            if (!ttisfloat(&a[i]) || luai_numisnan(fltvalue(&a[i])))
+                return SORT_NONE;
+        }
+        return SORT_FLOATS;
+    }
+    else if (ttisstring(&a[0])) {
+        for (i = 1; i < n; i++) {
+            if (!ttisstring(&a[i]))
+                return SORT_NONE;
+        }
+        return SORT_STRINGS;
+    }
+    return SORT_NONE;
+}
+
+/*
+** The elements only move within the table, so the set of objects it
+** refers to stays the same and no GC barrier is needed. Nothing here
+** allocates except the buffer of the stable float sort, allocated
+** before sorting, so there is no error half-way
+*/
+LUA_API int lua_sortarray (lua_State *L, int idx, lua_Integer n, int flags) {
+    Table *t;
+    TValue *a;
+    if (lua_type(L, idx) != LUA_TTABLE)
+        return 0;
+    t = (Table *)lua_topointer(L, idx);
+    if (t->metatable != NULL || n < 2 ||
+        l_castS2U(n) > luaH_realasize(t))
+        return 0;
+    a = t->array;
+    switch (arraykind(a, (size_t)n)) {
+        case SORT_INTEGERS:
+            ints_sort(a, (size_t)n);  /* equal integers are identical */
+            return 1;
+        case SORT_FLOATS:
+            if (flags & LUA_SORT_STABLE) {
+                size_t half = (size_t)n / 2;
+                TValue *tmp = luaM_newvector(L, half, TValue);
+                floats_mergesort(t->array, (size_t)n, tmp);
+                luaM_freearray(L, tmp, half);
+            }
+            else
+                floats_sort(a, (size_t)n);
+            return 1;
+        case SORT_STRINGS:
+            strings_sort(a, (size_t)n);  /* equal strings are identical */
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/* }====================================================== */
@@ -0,0 +1,319 @@
+/*
+** Pattern-defeating quicksort over an array of TValues, included by
+** swiftsort.c once per element kind with
+**   SORT_NAME(f)  the name of function 'f' for this kind
+**   SORT_NAME(less)(a,b)  whether the value at 'a' sorts before the one at 'b'
+** and, for kinds whose equal elements can be told apart, SORT_STABLE to
+** also define a merge sort.
+*/
+
+/*
+** SORT_LESS goes through accessors that evaluate their argument twice
+** in assert builds (check_exp), so it is only expanded here, where the
+** arguments have no side effects; the sort calls this function
+*/
+l_sinline int SORT_NAME(less) (const TValue *a, const TValue *b) {
+    return SORT_LESS(a, b);
+}
+
+/*
+** Sorts [begin, end) with insertion sort. Moves elements only past
+** greater ones, so it is stable
+*/
+static void SORT_NAME(insertion) (TValue *begin, TValue *end) {
+    TValue *cur;
+    if (begin == end)
+        return;
+    for (cur = begin + 1; cur != end; cur++) {
+        TValue *sift = cur;
+        TValue *sift_1 = cur - 1;
+        if (SORT_NAME(less)(sift, sift_1)) {
+            TValue tmp = *sift;
+            do {
+                *sift-- = *sift_1;
+            } while (sift != begin && SORT_NAME(less)(&tmp, --sift_1));
+            *sift = tmp;
+        }
+    }
+}
+
+/*
+** Insertion sort of [begin, end) when *(begin - 1) is not greater than
+** any of its elements, so no bounds check is needed
+*/
+static void SORT_NAME(unguardedinsertion) (TValue *begin, TValue *end) {
+    TValue *cur;
+    if (begin == end)
+        return;
+    for (cur = begin + 1; cur != end; cur++) {
+        TValue *sift = cur;
+        TValue *sift_1 = cur - 1;
+        if (SORT_NAME(less)(sift, sift_1)) {
+            TValue tmp = *sift;
+            do {
+                *sift-- = *sift_1;
+            } while (SORT_NAME(less)(&tmp, --sift_1));
+            *sift = tmp;
+        }
+    }
+}
+
+/*
+** Insertion sort of [begin, end) that gives up after moving
+** PDQ_PARTIALLIMIT elements; returns whether it sorted the range
+*/
+static int SORT_NAME(partialinsertion) (TValue *begin, TValue *end) {
+    TValue *cur;
+    size_t limit = 0;
+    if (begin == end)
+        return 1;
+    for (cur = begin + 1; cur != end; cur++) {
+        TValue *sift = cur;
+        TValue *sift_1 = cur - 1;
+        if (SORT_NAME(less)(sift, sift_1)) {
+            TValue tmp = *sift;
+            do {
+                *sift-- = *sift_1;
+            } while (sift != begin && SORT_NAME(less)(&tmp, --sift_1));
+            *sift = tmp;
+            limit += (size_t)(cur - sift);
+            if (limit > PDQ_PARTIALLIMIT)
+                return 0;
+        }
+    }
+    return 1;
+}
+
+static void SORT_NAME(sort2) (TValue *a, TValue *b) {
+    if (SORT_NAME(less)(b, a))
+        swapvalues(a, b);
+}
+
+static void SORT_NAME(sort3) (TValue *a, TValue *b, TValue *c) {
+    SORT_NAME(sort2)(a, b);
+    SORT_NAME(sort2)(b, c);
+    SORT_NAME(sort2)(a, b);
+}
+
+/*
+** Partitions [begin, end) around the pivot *begin: elements less than
+** the pivot go to its left and the others to its right. Returns the
+** final position of the pivot and sets '*already' if the range was
+** already partitioned
+*/
+static TValue *SORT_NAME(partitionright) (TValue *begin, TValue *end,
+                                          int *already) {
+    TValue pivot = *begin;
+    TValue *first = begin;
+    TValue *last = end;
+    TValue *pivotpos;
+    /* there is an element not less than the pivot: the median of 3 */
+    while (SORT_NAME(less)(++first, &pivot))
+        ;
+    if (first - 1 == begin) {  /* no element less than the pivot yet? */
+        while (first < last && !SORT_NAME(less)(--last, &pivot))
+            ;
+    }
+    else {  /* an element less than the pivot guards the scan */
+        while (!SORT_NAME(less)(--last, &pivot))
+            ;
+    }
+    *already = (first >= last);
+    while (first < last) {
+        swapvalues(first, last);
+        while (SORT_NAME(less)(++first, &pivot))
+            ;
+        while (!SORT_NAME(less)(--last, &pivot))
+            ;
+    }
+    pivotpos = first - 1;
+    *begin = *pivotpos;
+    *pivotpos = pivot;
+    return pivotpos;
+}
+
+/*
+** Like 'partitionright', but elements equal to the pivot go to its
+** left. Used when the pivot equals the element before the range, so
+** the range holds many copies of it: they all end up in their final
+** place at once
+*/
+static TValue *SORT_NAME(partitionleft) (TValue *begin, TValue *end) {
+    TValue pivot = *begin;
+    TValue *first = begin;
+    TValue *last = end;
+    TValue *pivotpos;
+    while (SORT_NAME(less)(&pivot, --last))
+        ;
+    if (last + 1 == end) {
+        while (first < last && !SORT_NAME(less)(&pivot, ++first))
+            ;
+    }
+    else {
+        while (!SORT_NAME(less)(&pivot, ++first))
+            ;
+    }
+    while (first < last) {
+        swapvalues(first, last);
+        while (SORT_NAME(less)(&pivot, --last))
+            ;
+        while (!SORT_NAME(less)(&pivot, ++first))
+            ;
+    }
+    pivotpos = last;
+    *begin = *pivotpos;
+    *pivotpos = pivot;
+    return pivotpos;
+}
+
+static void SORT_NAME(siftdown) (TValue *a, size_t i, size_t n) {
+    TValue tmp = a[i];
+    size_t child;
+    while ((child = 2 * i + 1) < n) {
+        if (child + 1 < n && SORT_NAME(less)(&a[child], &a[child + 1]))
+            child++;
+        if (!SORT_NAME(less)(&tmp, &a[child]))
+            break;
+        a[i] = a[child];
+        i = child;
+    }
+    a[i] = tmp;
+}
+
+/* heap sort of [begin, end), for when partitions keep being unbalanced */
+static void SORT_NAME(heapsort) (TValue *begin, TValue *end) {
+    size_t n = (size_t)(end - begin);
+    size_t i;
+    for (i = n / 2; i > 0; i--)
+        SORT_NAME(siftdown)(begin, i - 1, n);
+    for (i = n - 1; i > 0; i--) {
+        swapvalues(begin, begin + i);
+        SORT_NAME(siftdown)(begin, 0, i);
+    }
+}
+
+/*
+** Sorts [begin, end). 'leftmost' is false when *(begin - 1) is a former
+** pivot, not greater than any element of the range. After 'badallowed'
+** unbalanced partitions it switches to heap sort, so the worst case is
+** O(n log n); unbalanced partitions also shuffle a few elements to break
+** patterns. Recurses into the smaller side, so the stack depth is at
+** most log2(n)
+*/
+static void SORT_NAME(loop) (TValue *begin, TValue *end, int badallowed,
+                             int leftmost) {
+    for (;;) {
+        size_t size = (size_t)(end - begin);
+        size_t s2 = size / 2;
+        size_t lsize, rsize;
+        TValue *pivotpos;
+        int already;
+        if (size < PDQ_INSERTIONSORT) {
+            if (leftmost)
+                SORT_NAME(insertion)(begin, end);
+            else
+                SORT_NAME(unguardedinsertion)(begin, end);
+            return;
+        }
+        /* move the median of 3 (or the pseudomedian of 9) to *begin */
+        if (size > PDQ_NINTHER) {
+            SORT_NAME(sort3)(begin, begin + s2, end - 1);
+            SORT_NAME(sort3)(begin + 1, begin + (s2 - 1), end - 2);
+            SORT_NAME(sort3)(begin + 2, begin + (s2 + 1), end - 3);
+            SORT_NAME(sort3)(begin + (s2 - 1), begin + s2, begin + (s2 + 1));
+            swapvalues(begin, begin + s2);
+        }
+        else
+            SORT_NAME(sort3)(begin + s2, begin, end - 1);
+        /* pivot equal to the previous pivot? then it is the least element */
+        if (!leftmost && !SORT_NAME(less)(begin - 1, begin)) {
+            begin = SORT_NAME(partitionleft)(begin, end) + 1;
+            continue;
+        }
+        pivotpos = SORT_NAME(partitionright)(begin, end, &already);
+        lsize = (size_t)(pivotpos - begin);
+        rsize = (size_t)(end - (pivotpos + 1));
+        if (lsize < size / 8 || rsize < size / 8) {  /* unbalanced? */
+            if (--badallowed == 0) {
+                SORT_NAME(heapsort)(begin, end);
+                return;
+            }
+            if (lsize >= PDQ_INSERTIONSORT) {
+                swapvalues(begin, begin + lsize / 4);
+                swapvalues(pivotpos - 1, pivotpos - lsize / 4);
+                if (lsize > PDQ_NINTHER) {
+                    swapvalues(begin + 1, begin + (lsize / 4 + 1));
+                    swapvalues(begin + 2, begin + (lsize / 4 + 2));
+                    swapvalues(pivotpos - 2, pivotpos - (lsize / 4 + 1));
+                    swapvalues(pivotpos - 3, pivotpos - (lsize / 4 + 2));
+                }
+            }
+            if (rsize >= PDQ_INSERTIONSORT) {
+                swapvalues(pivotpos + 1, pivotpos + (1 + rsize / 4));
+                swapvalues(end - 1, end - rsize / 4);
+                if (rsize > PDQ_NINTHER) {
+                    swapvalues(pivotpos + 2, pivotpos + (2 + rsize / 4));
+                    swapvalues(pivotpos + 3, pivotpos + (3 + rsize / 4));
+                    swapvalues(end - 2, end - (1 + rsize / 4));
+                    swapvalues(end - 3, end - (2 + rsize / 4));
+                }
+            }
+        }
+        else if (already &&  /* likely sorted already? */
+                 SORT_NAME(partialinsertion)(begin, pivotpos) &&
+                 SORT_NAME(partialinsertion)(pivotpos + 1, end))
+            return;
+        if (lsize < rsize) {
+            SORT_NAME(loop)(begin, pivotpos, badallowed, leftmost);
+            begin = pivotpos + 1;
+            leftmost = 0;
+        }
+        else {
+            SORT_NAME(loop)(pivotpos + 1, end, badallowed, 0);
+            end = pivotpos;
+        }
+    }
+}
+
+static void SORT_NAME(sort) (TValue *a, size_t n) {
+    int log2n = 0;
+    while ((n >> log2n) > 1)
+        log2n++;
+    SORT_NAME(loop)(a, a + n, log2n + 1, 1);
+}
+
+
+#if defined(SORT_STABLE)
+
+/*
+** Stable merge sort of 'a[0 .. n - 1]', with room for n / 2 elements
+** in 'tmp'
+*/
+static void SORT_NAME(mergesort) (TValue *a, size_t n, TValue *tmp) {
+    size_t half, i, j, k;
+    if (n < PDQ_INSERTIONSORT) {
+        SORT_NAME(insertion)(a, a + n);
+        return;
+    }
+    half = n / 2;
+    SORT_NAME(mergesort)(a, half, tmp);
+    SORT_NAME(mergesort)(a + half, n - half, tmp);
+    if (!SORT_NAME(less)(&a[half], &a[half - 1]))  /* halves already in order? */
+        return;
+    memcpy(tmp, a, half * sizeof(TValue));
+    i = 0; j = half; k = 0;
+    while (i < half && j < n) {  /* on ties take from the left half */
+        if (SORT_NAME(less)(&a[j], &tmp[i]))
+            a[k++] = a[j++];
+        else
+            a[k++] = tmp[i++];
+    }
+    while (i < half)
+        a[k++] = tmp[i++];
+}
+
+#endif
+
+#undef SORT_NAME
+#undef SORT_LESS
+#undef SORT_STABLE
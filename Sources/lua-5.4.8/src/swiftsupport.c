@@ -1,4 +1,7 @@
 
+#include <locale.h>
+#include <string.h>
+
 #include "lapi.h"
 #include "lua.h"
 #include "swiftsupport.h"
@@ -42,3 +45,37 @@ LUA_API void (luaL_newlibtable_nonmacro) (lua_State *L, const luaL_Reg l[]) {
 LUA_API int luaL_dostring_nonmacro (lua_State *L, const char *str) {
     luaL_dostring(L, str);
 }
+
+/*
+** Adds the decimal numeral of an integer to the buffer, without going
+** through a Lua string
+*/
+LUALIB_API void luaL_addinteger (luaL_Buffer *B, lua_Integer n) {
+    char digits[24];  /* enough for the 20 digits of LUA_MININTEGER */
+    char *end = digits + sizeof(digits);
+    char *p = end;
+    lua_Unsigned u = (n < 0) ? 0u - (lua_Unsigned)n : (lua_Unsigned)n;
+    do {
+        *--p = (char)('0' + u % 10);
+        u /= 10;
+    } while (u != 0);
+    if (n < 0)
+        *--p = '-';
+    luaL_addlstring(B, p, (size_t)(end - p));
+}
+
+/* maximum length of a float numeral plus '.0', as in lobject.c */
+#define MAXNUMBER2STR	44
+
+/*
+** Adds a float to the buffer, formatted as 'tostring' formats it
+*/
+LUALIB_API void luaL_addnumber (luaL_Buffer *B, lua_Number n) {
+    char *buff = luaL_prepbuffsize(B, MAXNUMBER2STR);
+    int len = lua_number2str(buff, MAXNUMBER2STR - 2, n);
+    if (buff[strspn(buff, "-0123456789")] == '\0') {  /* looks like an int? */
+        buff[len++] = lua_getlocaledecpoint();
+        buff[len++] = '0';  /* adds '.0' to result */
+    }
+    luaL_addsize(B, len);
+}
@@ -0,0 +1,849 @@
+import Testing
+import Foundation
+import Lua
+import LuaHelpers
+
+/// Benchmarks only run when `LUASWIFT_BENCH` is set, e.g. `LUASWIFT_BENCH=1 swift test -c release --filter benchmark`.
+let benchmarksEnabled = ProcessInfo.processInfo.environment["LUASWIFT_BENCH"] != nil
+
+/// Runs `body` `iterations` times, prints the average time per iteration and returns it in seconds.
+@discardableResult
+func benchmark(_ name: String, iterations: Int = 5, _ body: () -> Void) -> Double {
+    let start = DispatchTime.now().uptimeNanoseconds
+    for _ in 0..<iterations {
+        body()
+    }
+    let elapsed = DispatchTime.now().uptimeNanoseconds - start
+    let average = Double(elapsed) / Double(iterations) / 1_000_000_000
+    print("[benchmark] \(name): \(average * 1000) ms")
+    return average
+}
+
+extension LuaTable {
+    /// The conversion `Table(luaTable:)` used to do, going through `forEach` and a registry ref per key and value.
+    borrowing func copyToSwiftThroughRegistry() -> Table {
+        var table = Table()
+        forEach { next in
+            let swiftKey = next.key.copyToSwift()
+            let swiftValue: Value?
+            if next.value.type() == .TABLE, let nested = next.value.copy().asTable()?.copyToSwiftThroughRegistry() {
+                swiftValue = .table(nested)
+            } else {
+                swiftValue = next.value.copyToSwift()
+            }
+            switch swiftKey {
+            case .bool(let bool):
+                table[.dictKey(.bool(bool))] = swiftValue ?? .luaNil
+            case .number(.int(let int)):
+                if int > 0 {
+                    table[.arrayKey(int)] = swiftValue ?? .luaNil
+                } else {
+                    table[.dictKey(.nonIndexNumber(Double(int)))] = swiftValue ?? .luaNil
+                }
+            case .number(.double(let double)):
+                table[.dictKey(.nonIndexNumber(double))] = swiftValue ?? .luaNil
+            case .string(let stringKey):
+                table[.dictKey(.string(stringKey))] = swiftValue ?? .luaNil
+            default:
+                break
+            }
+            return true
+        }
+        return table
+    }
+}
+
+@Test(.enabled(if: benchmarksEnabled)) func benchmarkTableConversion() throws {
+    let L = LuaState.newLuaState()
+    L.openLibs()
+    L.doString("""
+    local t = {}
+    for i = 1, 25000 do t[i] = i * 0.5 end
+    for i = 1, 25000 do t["key" .. i] = { id = i, name = "entry" .. i } end
+    return t
+    """)
+    let value = L.toLuaValue()
+    var throughRegistry = Table()
+    var direct = Table()
+    let registryTime = benchmark("Table conversion through registry refs") {
+        throughRegistry = value.copy().asTable()?.copyToSwiftThroughRegistry() ?? Table()
+    }
+    let directTime = benchmark("Table conversion on the stack") {
+        direct = L.toValue()?.asTable() ?? Table()
+    }
+    print("[benchmark] speedup: \(registryTime / directTime)x")
+    #expect(direct.narr == 25000)
+    #expect(direct.nrec == 25000)
+    #expect(direct.narr == throughRegistry.narr)
+    #expect(direct.nrec == throughRegistry.nrec)
+    #expect(direct[100] == throughRegistry[100])
+    #expect(direct["key42"].asTable()?["name"] == "entry42")
+    #expect(throughRegistry["key42"].asTable()?["name"] == "entry42")
+    L.close()
+}
+
+@Test(.enabled(if: benchmarksEnabled)) func benchmarkSwiftStructUserdataFieldAccess() throws {
+    struct DynamicVec: SwiftStructUserdata {
+        var x: Double = 1
+        func __index(_ L: LuaState) -> Int32 {
+            switch L.toString(2) {
+            case "x":
+                L.pushNumber(x)
+                return 1
+            case "scaled":
+                L.pushCFunction { L in
+                    let vec = L.toUserDataInstancePointer(index: 1, as: DynamicVec.self)!.pointee
+                    L.pushNumber(vec.x * (L.toNumber(2) ?? 1))
+                    return 1
+                }
+                return 1
+            default:
+                return 0
+            }
+        }
+    }
+    struct MemberVec: SwiftStructUserdata {
+        var x: Double = 1
+        static var members: [SwiftStructUserdataMember] {
+            [
+                .field("x", get: { L in
+                    L.pushNumber(L.toUserDataInstancePointer(index: 1, as: MemberVec.self)!.pointee.x)
+                    return 1
+                }),
+                .method("scaled", { L in
+                    let vec = L.toUserDataInstancePointer(index: 1, as: MemberVec.self)!.pointee
+                    L.pushNumber(vec.x * (L.toNumber(2) ?? 1))
+                    return 1
+                }),
+            ]
+        }
+    }
+    let L = LuaState.newLuaState()
+    L.openLibs()
+    _ = L.new(DynamicVec())
+    L.setGlobal("dynamic")
+    _ = L.new(MemberVec())
+    L.setGlobal("member")
+    L.doString("""
+    function bench(v)
+        local s = 0
+        for i = 1, 200000 do s = s + v.x + v:scaled(2) end
+        return s
+    end
+    """)
+    benchmark("Userdata access through __index") {
+        #expect(L.doString("return bench(dynamic)") == false)
+        #expect(L.toNumber() == 600000)
+        L.pop()
+    }
+    benchmark("Userdata access through members") {
+        #expect(L.doString("return bench(member)") == false)
+        #expect(L.toNumber() == 600000)
+        L.pop()
+    }
+    L.close()
+}
+
+@Test(.enabled(if: benchmarksEnabled)) func benchmarkSlabAllocator() throws {
+    let script = """
+    local keep = {}
+    for round = 1, 10 do
+        local t = {}
+        for i = 1, 20000 do
+            t[i] = { i, "s" .. i, function() return i end }
+        end
+        keep[round % 3] = t
+    end
+    return #keep[1]
+    """
+    for allocator in [LuaAllocator.system, .slab] {
+        let L = LuaState.newLuaState(allocator: allocator)
+        L.openLibs()
+        benchmark("Allocation heavy script with \(allocator) allocator") {
+            #expect(L.doString(script) == false)
+            #expect(L.toInteger() == 20000)
+            L.pop()
+        }
+        if let stats = L.slabAllocatorStats() {
+            print("[benchmark] slab peak: \(stats.peakBytes) bytes, chunks: \(stats.chunkBytes) bytes, free lists: \(stats.freeListLengths)")
+        }
+        L.close()
+    }
+}
+
+@Test(.enabled(if: benchmarksEnabled)) func benchmarkInstructionBudgetHook() throws {
+    let L = LuaState.newLuaState()
+    L.openLibs()
+    let script = "local s = 0 for i = 1, 2e6 do s = s + i % 7 end return s"
+    let baseline = benchmark("Loop without budget") {
+        #expect(L.doString(script) == false)
+        L.pop()
+    }
+    for quantum: Int32 in [100, 1000, 10_000, 100_000] {
+        L.setInstructionBudget(.max, quantum: quantum, onExhausted: .error)
+        let time = benchmark("Loop with budget, quantum \(quantum)") {
+            #expect(L.doString(script) == false)
+            L.pop()
+        }
+        print("[benchmark] hook overhead at quantum \(quantum): \(time / baseline)x")
+    }
+    L.clearInstructionBudget()
+    L.close()
+}
+
+@Test(.enabled(if: benchmarksEnabled)) func benchmarkScheduler() throws {
+    let maxWorkers = ProcessInfo.processInfo.activeProcessorCount
+    var workers = 1
+    var baseline = 0.0
+    while true {
+        let scheduler = LuaScheduler(workerCount: workers)
+        var states: [LuaState] = []
+        for _ in 0..<256 {
+            let L = LuaState.newLuaState()
+            L.openLibs()
+            L.setInstructionBudget(10_000, onExhausted: .yield)
+            for _ in 0..<4 {
+                L.doString("return function() local s = 0 for i = 1, 50000 do s = s + i % 3 end return s end")
+                scheduler.spawn(L)
+            }
+            states.append(L)
+        }
+        var stats = LuaScheduler.Statistics()
+        let time = benchmark("Scheduler with \(workers) workers", iterations: 1) {
+            stats = scheduler.run()
+        }
+        #expect(stats.completed == 256 * 4)
+        if workers == 1 {
+            baseline = time
+        }
+        print("[benchmark] \(workers) workers: \(Double(stats.completed) / time) coroutines/s, \(stats.resumes) resumes, \(stats.steals) steals, speedup \(baseline / time)x")
+        for L in states {
+            L.close()
+        }
+        if workers >= maxWorkers {
+            break
+        }
+        workers = min(workers * 2, maxWorkers)
+    }
+}
+
+@Test(.enabled(if: benchmarksEnabled)) func benchmarkBytecodeCache() throws {
+    var source = ""
+    for i in 0..<2000 {
+        source += "local function f\(i)(a, b)\n  local t = { a = a, b = b, n = \(i) }\n  if a > b then return t.a * \(i) else return t.b + #\"s\(i)\" end\nend\n"
+    }
+    source += "return f1999(2, 1)\n"
+    let directory = FileManager.default.temporaryDirectory.appendingPathComponent("LuaBytecodeCacheBenchmark-\(UUID().uuidString)")
+    defer { try? FileManager.default.removeItem(at: directory) }
+    let L = LuaState.newLuaState()
+    L.openLibs()
+    func load(_ body: () -> LuaThreadStatus) {
+        #expect(body() == .LUA_OK)
+        #expect(L.pcall(nargs: 0) == .LUA_OK)
+        #expect(L.toInteger() == 2 * 1999)
+        L.pop()
+    }
+    let compileTime = benchmark("Compile without cache") {
+        load { L.loadBufferX(buffer: source, name: "big") }
+    }
+    let cache = LuaBytecodeCache(directory: directory)
+    benchmark("Cold cache (compile, dump, write)", iterations: 1) {
+        load { L.loadBufferX(buffer: source, name: "big", cache: cache) }
+    }
+    let memoryTime = benchmark("Warm cache from memory") {
+        load { L.loadBufferX(buffer: source, name: "big", cache: cache) }
+    }
+    let diskTime = benchmark("Warm cache from disk (mmap)", iterations: 1) {
+        let fresh = LuaBytecodeCache(directory: directory)
+        load { L.loadBufferX(buffer: source, name: "big", cache: fresh) }
+        #expect(fresh.statistics.diskHits == 1)
+    }
+    print("[benchmark] speedup from memory: \(compileTime / memoryTime)x, from disk: \(compileTime / diskTime)x")
+    #expect(cache.statistics.misses == 1)
+    L.close()
+}
+
+/// Resident set size of the process in bytes, where the system reports it.
+func residentMemory() -> Int? {
+    guard let statm = try? String(contentsOfFile: "/proc/self/statm", encoding: .utf8) else {
+        return nil
+    }
+    let fields = statm.split(separator: " ")
+    guard fields.count > 1, let pages = Int(fields[1]) else {
+        return nil
+    }
+    return pages * Int(getpagesize())
+}
+
+@Test(.enabled(if: benchmarksEnabled)) func benchmarkMappedChunkLoading() throws {
+    var source = ""
+    for i in 0..<2000 {
+        source += "function f\(i)(a, b)\n  local t = { a = a, b = b, n = \(i) }\n  if a > b then return t.a * \(i) else return t.b + #\"s\(i)\" end\nend\n"
+    }
+    let path = FileManager.default.temporaryDirectory.appendingPathComponent("LuaMappedChunkBenchmark-\(UUID().uuidString).luac").path
+    defer { try? FileManager.default.removeItem(atPath: path) }
+    let compiler = LuaState.newLuaState()
+    #expect(compiler.loadBufferX(buffer: source, name: "=big") == .LUA_OK)
+    let bytecode = try #require(compiler.dumpToBytes(aligned: true))
+    compiler.close()
+    #expect(FileManager.default.createFile(atPath: path, contents: Data(bytecode)))
+    
+    let copies = 50
+    func measure(_ name: String, _ load: (LuaState) -> LuaThreadStatus?) {
+        let L = LuaState.newLuaState()
+        L.openLibs()
+        L.newTable()
+        let heapBefore = Int(L.gc(what: LUA_GCCOUNT)) * 1024
+        let rssBefore = residentMemory()
+        benchmark(name, iterations: copies) {
+            #expect(load(L) == .LUA_OK)
+            L.setI(-2, i: Int64(L.rawLen(-2)) + 1)
+        }
+        let heap = Int(L.gc(what: LUA_GCCOUNT)) * 1024 - heapBefore
+        let rss = residentMemory().flatMap { after in rssBefore.map { after - $0 } }
+        print("[benchmark] \(name): Lua heap \(heap / copies) bytes per load, RSS growth \(rss.map { "\($0 / copies) bytes per load" } ?? "unavailable")")
+        L.close()
+    }
+    let bytes = try [UInt8](Data(contentsOf: URL(fileURLWithPath: path)))
+    measure("lua_load of the bytecode") { L in
+        bytes.withUnsafeBytes { L.loadBufferX(bytes: $0, name: "big", mode: "b") }
+    }
+    measure("lua_loadmapped of the bytecode file") { L in
+        L.loadMappedFile(path: path, name: "big")
+    }
+}
+
+@Test(.enabled(if: benchmarksEnabled)) func benchmarkBundleStartup() throws {
+    let directory = FileManager.default.temporaryDirectory.appendingPathComponent("LuaBundleBenchmark-\(UUID().uuidString)")
+    defer { try? FileManager.default.removeItem(at: directory) }
+    try FileManager.default.createDirectory(at: directory, withIntermediateDirectories: true)
+    var modules: [String: String] = [:]
+    for i in 0..<500 {
+        var source = "local M = { id = \(i) }\n"
+        for j in 0..<20 {
+            source += "function M.f\(j)(a, b)\n  local t = { a = a, b = b, n = \(i * j) }\n  if a > b then return t.a * \(j) else return t.b + #\"s\(j)\" end\nend\n"
+        }
+        source += "return M\n"
+        modules["mod\(i)"] = source
+        #expect(FileManager.default.createFile(atPath: directory.appendingPathComponent("mod\(i).lua").path, contents: Data(source.utf8)))
+    }
+    let requireAll = "local n = 0 for i = 0, 499 do n = n + require('mod' .. i).id end return n"
+    func startup(_ name: String, _ setUp: (LuaState) -> Void) -> Double {
+        return benchmark(name) {
+            let L = LuaState.newLuaState()
+            L.openLibs()
+            setUp(L)
+            #expect(L.doString(requireAll) == false)
+            #expect(L.toInteger() == 499 * 500 / 2)
+            L.close()
+        }
+    }
+    let filesTime = startup("Startup requiring 500 modules from package.path") { L in
+        L.getGlobal("package")
+        L.pushString(directory.path + "/?.lua")
+        L.setField(-2, key: "path")
+        L.pop()
+    }
+    let compiler = LuaState.newLuaState()
+    for (name, precompile, compress) in [("source", false, false), ("compressed source", false, true), ("bytecode", true, false), ("compressed bytecode", true, true)] {
+        let bytes = try #require(compiler.makeBundle(modules: modules, precompile: precompile, compress: compress))
+        let path = directory.appendingPathComponent("\(name).luab").path
+        #expect(FileManager.default.createFile(atPath: path, contents: Data(bytes)))
+        let time = startup("Startup requiring 500 modules from a \(name) bundle (\(bytes.count) bytes)") { L in
+            #expect(L.addBundle(path: path) == .LUA_OK)
+        }
+        print("[benchmark] \(name) bundle speedup: \(filesTime / time)x")
+    }
+    compiler.close()
+}
+
+@Test(.enabled(if: benchmarksEnabled)) func benchmarkRequirePathCache() throws {
+    let directory = FileManager.default.temporaryDirectory.appendingPathComponent("LuaPathCacheBenchmark-\(UUID().uuidString)")
+    defer { try? FileManager.default.removeItem(at: directory) }
+    try FileManager.default.createDirectory(at: directory.appendingPathComponent("app"), withIntermediateDirectories: true)
+    for i in 0..<1000 {
+        #expect(FileManager.default.createFile(atPath: directory.appendingPathComponent("app/mod\(i).lua").path, contents: Data("return \(i)".utf8)))
+    }
+    // A boot sequence of 3000 requires: 1000 modules, each probing two optional modules that are not installed
+    let boot = """
+    local n = 0
+    for i = 0, 999 do
+        n = n + require('mod' .. i)
+        pcall(require, 'optional.a' .. i % 10)
+        pcall(require, 'optional.b' .. i % 10)
+    end
+    return n
+    """
+    let path = ["share/?.lua", "share/?/init.lua", "lib/?.lua", "lib/?/init.lua", "app/?.lua", "app/?/init.lua"].map { directory.path + "/" + $0 }.joined(separator: ";")
+    var baseline = 0.0
+    for mode in [LuaPathCacheMode.off, .check, .trust] {
+        var stats: LuaPathCacheStats?
+        let time = benchmark("Boot with 3000 requires, path cache \(mode)") {
+            let L = LuaState.newLuaState()
+            L.openLibs()
+            L.getGlobal("package")
+            L.pushString(path)
+            L.setField(-2, key: "path")
+            L.pop()
+            L.setPathCache(mode)
+            #expect(L.doString(boot) == false)
+            #expect(L.toInteger() == 999 * 1000 / 2)
+            stats = L.pathCacheStats()
+            L.close()
+        }
+        if mode == .off {
+            baseline = time
+        }
+        if let stats {
+            print("[benchmark] path cache \(mode): \(stats.hits) hits, \(stats.misses) misses, \(stats.checks) checks, speedup \(baseline / time)x")
+        }
+    }
+}
+
+@Test(.enabled(if: benchmarksEnabled)) func benchmarkParallelCompilation() throws {
+    var chunks: [(name: String, source: String)] = []
+    for i in 0..<400 {
+        var source = "local M = {}\n"
+        for j in 0..<40 {
+            source += "function M.f\(j)(a, b)\n  local t = { a = a, b = b, n = \(i * j) }\n  for k = 1, #t do t[k] = t[k] * 2 end\n  if a > b then return t.a * \(j) else return t.b + #\"s\(j)\" end\nend\n"
+        }
+        source += "return M\n"
+        chunks.append((name: "@module\(i).lua", source: source))
+    }
+    func loadAll(_ L: LuaState, _ load: (Int) -> LuaThreadStatus) {
+        for i in 0..<chunks.count {
+            #expect(load(i) == .LUA_OK)
+            #expect(L.pcall(nargs: 0, nresults: 0) == .LUA_OK)
+        }
+    }
+    let serialTime = benchmark("Startup compiling 400 modules on the main state", iterations: 3) {
+        let L = LuaState.newLuaState()
+        L.openLibs()
+        loadAll(L) { L.loadBufferX(buffer: chunks[$0].source, name: chunks[$0].name) }
+        L.close()
+    }
+    let maxThreads = ProcessInfo.processInfo.activeProcessorCount
+    var threads = 1
+    while true {
+        let time = benchmark("Startup compiling 400 modules on \(threads) threads", iterations: 3) {
+            let compiled = LuaState.compileInParallel(chunks, threads: threads)
+            let L = LuaState.newLuaState()
+            L.openLibs()
+            loadAll(L) { L.load(compiled[$0]) }
+            L.close()
+        }
+        print("[benchmark] \(threads) threads: speedup \(serialTime / time)x")
+        if threads >= maxThreads {
+            break
+        }
+        threads = min(threads * 2, maxThreads)
+    }
+}
+
+@Test(.enabled(if: benchmarksEnabled)) func benchmarkStringBuilder() throws {
+    // A template rendering about 200 KB: rows of literal text, integers and floats
+    let rows = 4_000
+    let L = LuaState.newLuaState()
+    L.openLibs()
+    var expected: [UInt8]?
+    func check() {
+        let bytes = L.toBytes()
+        L.pop()
+        if expected == nil {
+            expected = bytes
+            #expect((bytes?.count ?? 0) > 180_000)
+        } else {
+            #expect(bytes == expected)
+        }
+    }
+    benchmark("Rendering 200 KB with concat", iterations: 20) {
+        L.pushString("")
+        for i in 0..<rows {
+            L.pushString("<tr><td>")
+            L.pushInteger(lua_Integer(i))
+            L.pushString("</td><td>")
+            L.pushNumber(Double(i) * 0.25)
+            L.pushString("</td><td class=\"name\">item</td></tr>\n")
+            L.concat(6)
+        }
+        check()
+    }
+    benchmark("Rendering 200 KB with a Swift string", iterations: 20) {
+        var s = ""
+        for i in 0..<rows {
+            s += "<tr><td>"
+            s += String(i)
+            s += "</td><td>"
+            L.pushNumber(Double(i) * 0.25)
+            s += L.toString() ?? ""
+            L.pop()
+            s += "</td><td class=\"name\">item</td></tr>\n"
+        }
+        L.pushString(s)
+        check()
+    }
+    benchmark("Rendering 200 KB with LuaStringBuilder", iterations: 20) {
+        let builder = LuaStringBuilder(L)
+        for i in 0..<rows {
+            builder.append("<tr><td>")
+            builder.append(i)
+            builder.append("</td><td>")
+            builder.append(Double(i) * 0.25)
+            builder.append("</td><td class=\"name\">item</td></tr>\n")
+        }
+        builder.finish()
+        check()
+    }
+    benchmark("Rendering 200 KB with LuaStringBuilder and reserve", iterations: 20) {
+        let builder = LuaStringBuilder(L, capacity: 256 * 1024)
+        for i in 0..<rows {
+            builder.append("<tr><td>")
+            builder.append(i)
+            builder.append("</td><td>")
+            builder.append(Double(i) * 0.25)
+            builder.append("</td><td class=\"name\">item</td></tr>\n")
+        }
+        builder.finish()
+        check()
+    }
+    L.close()
+}
+
+@Test(.enabled(if: benchmarksEnabled)) func benchmarkTableConcat() throws {
+    let L = LuaState.newLuaState()
+    L.openLibs()
+    #expect(L.doString("""
+        strings, numbers = {}, {}
+        for i = 1, 1000000 do
+            strings[i] = "s" .. (i % 100)
+            numbers[i] = i
+        end
+        """) == false)
+    // A table with a metatable takes the generic path of table.concat, growing a luaL_Buffer
+    #expect(L.doString("proxy = setmetatable(strings, {})") == false)
+    benchmark("table.concat of 1M short strings with a metatable (generic path)") {
+        #expect(L.doString("assert(#table.concat(proxy, ',') > 3000000)") == false)
+    }
+    #expect(L.doString("setmetatable(strings, nil)") == false)
+    benchmark("table.concat of 1M short strings (single allocation)") {
+        #expect(L.doString("assert(#table.concat(strings, ',') > 3000000)") == false)
+    }
+    benchmark("table.concat of 1M integers (single allocation)") {
+        #expect(L.doString("assert(#table.concat(numbers, ',') > 6000000)") == false)
+    }
+    L.close()
+}
+
+@Test(.enabled(if: benchmarksEnabled)) func benchmarkTableSort() throws {
+    let L = LuaState.newLuaState()
+    L.openLibs()
+    #expect(L.doString("""
+        math.randomseed(1)
+        function fill(kind)
+            local t = {}
+            for i = 1, 1000000 do
+                if kind == "integers" then t[i] = math.random(1, 1 << 40)
+                elseif kind == "floats" then t[i] = math.random()
+                else t[i] = "key" .. math.random(1, 1 << 30) end
+            end
+            return t
+        end
+        lessThan = function(a, b) return a < b end
+        """) == false)
+    // Each iteration fills a fresh table, which takes the same time on every path
+    for kind in ["integers", "floats", "strings"] {
+        benchmark("table.sort of 1M \(kind) with a comparator (generic path)", iterations: 3) {
+            #expect(L.doString("table.sort(fill('\(kind)'), lessThan)") == false)
+        }
+        benchmark("table.sort of 1M \(kind) (array sort)", iterations: 3) {
+            #expect(L.doString("table.sort(fill('\(kind)'))") == false)
+        }
+        benchmark("table.stablesort of 1M \(kind)", iterations: 3) {
+            #expect(L.doString("table.stablesort(fill('\(kind)'))") == false)
+        }
+    }
+    L.close()
+}
+
+@Test(.enabled(if: benchmarksEnabled)) func benchmarkLogScanning() throws {
+    let L = LuaState.newLuaState()
+    L.openLibs()
+    #expect(L.doString("""
+        local lines = {}
+        for i = 1, 200000 do
+            lines[i] = ("2024-01-01 12:00:%02d INFO request id=%d path=/api/items status=200 time=%dms"):format(i % 60, i, i % 500)
+        end
+        lines[150000] = lines[150000] .. " ERROR: disk full"
+        log = table.concat(lines, "\\n")
+        """) == false)
+    benchmark("string.find plain, needle starting with a rare character") {
+        #expect(L.doString("assert(log:find('ERROR: disk', 1, true))") == false)
+    }
+    benchmark("string.find plain, needle starting with a space") {
+        #expect(L.doString("assert(not log:find(' status=500', 1, true))") == false)
+    }
+    benchmark("string.match with a literal prefix") {
+        #expect(L.doString("assert(log:match('ERROR: (%a+)') == 'disk')") == false)
+    }
+    benchmark("string.gmatch with a literal prefix") {
+        #expect(L.doString("local n = 0 for _ in log:gmatch('status=(%d+)') do n = n + 1 end assert(n == 200000)") == false)
+    }
+    L.close()
+}
+
+@Test(.enabled(if: benchmarksEnabled)) func benchmarkPatternCache() throws {
+    let L = LuaState.newLuaState()
+    L.openLibs()
+    #expect(L.doString("""
+        lines = {}
+        for i = 1, 20000 do
+            lines[i] = ("2024-01-%02d 12:00:%02d [%s] worker-%d: request id=%d path=/api/items/%d status=%d took=%dms"):format(i % 28 + 1, i % 60, i % 50 == 0 and "ERROR" or "INFO", i % 16, i, i * 3, 200 + i % 5, i % 500)
+        end
+        function parse()
+            local errors, fields, digits = 0, 0, 0
+            for _, line in ipairs(lines) do
+                local date, level, id = line:match("^(%d+%-%d+%-%d+) %d+:%d+:%d+ %[(%u+)%] [%w%-]+: request id=(%d+)")
+                if level == "ERROR" then errors = errors + 1 end
+                for k, v in line:gmatch("(%w+)=([^%s]+)") do fields = fields + 1 end
+                digits = digits + select(2, line:gsub("%d+", "#"))
+            end
+            assert(errors == 400 and fields == 80000)
+        end
+        """) == false)
+    for (mode, jit) in [("off", -1), ("on", -1), ("on", 16)] {
+        #expect(L.doString("string.patterncache('\(mode)') string.patterncache('jit', \(jit))") == false)
+        benchmark("log parsing with the pattern cache \(mode)\(jit < 0 ? "" : ", specialized")") {
+            #expect(L.doString("parse()") == false)
+        }
+    }
+    L.close()
+}
+
+@Test(.enabled(if: benchmarksEnabled)) func benchmarkRefArena() throws {
+    let L = LuaState.newLuaState()
+    L.openLibs()
+    let arena = LuaRefArena(L, capacity: 1024)
+    let count = 200_000
+    L.pushString("request payload")
+    let registryTime = benchmark("UnsafeLuaRef: ref, push and unref") {
+        for _ in 0..<count {
+            let ref = UnsafeLuaRef(luaState: L)
+            L.pushRef(ref.ref)
+            L.pop()
+            ref.unref()
+        }
+    }
+    let arenaTime = benchmark("LuaRefArena: ref, push and unref") {
+        for _ in 0..<count {
+            let ref = arena.ref()
+            arena.push(ref)
+            L.pop()
+            arena.unref(ref)
+        }
+    }
+    print("[benchmark] speedup: \(registryTime / arenaTime)x")
+    var refs: [UnsafeLuaRef] = []
+    refs.reserveCapacity(1000)
+    let registryBulkTime = benchmark("UnsafeLuaRef: 1000 refs per request, then unref each") {
+        for _ in 0..<(count / 1000) {
+            for _ in 0..<1000 {
+                refs.append(UnsafeLuaRef(luaState: L))
+            }
+            for ref in refs {
+                ref.unref()
+            }
+            refs.removeAll(keepingCapacity: true)
+        }
+    }
+    let arenaBulkTime = benchmark("LuaRefArena: 1000 refs per request, released by a scope") {
+        for _ in 0..<(count / 1000) {
+            arena.withScope {
+                for _ in 0..<1000 {
+                    _ = arena.ref()
+                }
+            }
+        }
+    }
+    print("[benchmark] speedup: \(registryBulkTime / arenaBulkTime)x")
+    #expect(arena.liveCount == 0)
+    #expect(arena.stats.peak == 1000)
+    #expect(arena.stats.stale == 0)
+    L.pop()
+    arena.close()
+    L.close()
+}
+
+@Test(.enabled(if: benchmarksEnabled)) func benchmarkPreparedCall() throws {
+    let L = LuaState.newLuaState()
+    L.openLibs()
+    #expect(L.doString("""
+    function update(id, dt)
+        return id * dt, id + 1
+    end
+    """) == false)
+    let count = 1_000_000
+    _ = L.getGlobal("update")
+    let function = UnsafeLuaRef(luaState: L)
+    L.pop()
+    var sum = 0.0
+    let registryTime = benchmark("Calls through a registry ref, Value arguments and LuaValue results") {
+        for i in 0..<count {
+            L.pushRef(function.ref)
+            L.pushValue(Value.number(.int(lua_Integer(i))))
+            L.pushValue(Value.number(.double(0.5)))
+            _ = L.pcall(nargs: 2, nresults: 2)
+            let first = L.toLuaValue(-2)
+            let second = L.toLuaValue(-1)
+            if case .number(let number) = first.toUnsafeValue(), case .double(let double) = number {
+                sum += double
+            }
+            second.toUnsafeValue().unref()
+            L.pop(2)
+        }
+    }
+    #expect(L.getTop() == 0)
+    _ = L.getGlobal("update")
+    let update = LuaPreparedCall(L, nargs: 2, nresults: 2)
+    var preparedSum = 0.0
+    let preparedTime = benchmark("Calls through LuaPreparedCall") {
+        for i in 0..<count {
+            update.call(lua_Integer(i), 0.5)
+            preparedSum += update.result(0, as: lua_Number.self) ?? 0
+        }
+    }
+    print("[benchmark] speedup: \(registryTime / preparedTime)x")
+    #expect(sum == preparedSum)
+    #expect(update.result(1, as: Int.self) == count)
+    update.close()
+    function.unref()
+    L.close()
+}
+
+@Test(.enabled(if: benchmarksEnabled)) func benchmarkTypedFunction() throws {
+    let L = LuaState.newLuaState()
+    L.openLibs()
+    L.pushCFunction { L in
+        // A binding boxing its arguments into Value, as most handwritten ones do
+        guard case .number(let idNumber) = L.toValue(1), case .int(let id) = idNumber,
+              case .number(let factorNumber) = L.toValue(2),
+              case .string(let label) = L.toValue(3) else {
+            L.pushString("bad arguments")
+            L.error()
+        }
+        let factor: Double
+        switch factorNumber {
+        case .int(let int): factor = Double(int)
+        case .double(let double): factor = double
+        }
+        L.pushValue(Value.number(.double(Double(id) * factor + Double(label.count))))
+        return 1
+    }
+    L.setGlobal("boxed")
+    L.pushCFunction { L in
+        // A binding checking its arguments by hand
+        guard let id = L.toInteger(1), let factor = L.toNumber(2), let label = L.toString(3) else {
+            L.pushString("bad arguments")
+            L.error()
+        }
+        L.pushNumber(Double(id) * factor + Double(label.count))
+        return 1
+    }
+    L.setGlobal("handwritten")
+    L.registerTypedFunction("typed") { (id: lua_Integer, factor: lua_Number, label: String) -> lua_Number in
+        return Double(id) * factor + Double(label.count)
+    }
+    L.doString("""
+    function bench(f)
+        local s = 0
+        for i = 1, 1000000 do s = s + f(i, 0.5, "entity") end
+        return s
+    end
+    """)
+    var times: [Double] = []
+    for name in ["boxed", "handwritten", "typed"] {
+        times.append(benchmark("Calls to a \(name) binding") {
+            #expect(L.doString("return bench(\(name))") == false)
+            #expect(L.toNumber() == 250000250000 + 6000000)
+            L.pop()
+        })
+    }
+    print("[benchmark] speedup over boxed: \(times[0] / times[2])x, over handwritten: \(times[1] / times[2])x")
+    L.close()
+}
+
+@Test(.enabled(if: benchmarksEnabled)) func benchmarkCapturingClosure() throws {
+    final class Context {
+        var total: lua_Integer = 0
+    }
+    let L = LuaState.newLuaState()
+    L.openLibs()
+    L.pushCFunction { L in
+        L.pushInteger((L.toInteger(1) ?? 0) + 1)
+        return 1
+    }
+    L.setGlobal("thin")
+    // The workaround for thin functions needing state: look the context up in the registry on every call
+    let registryContext = Context()
+    L.pushSwiftObject(registryContext)
+    L.setField(LUA_REGISTRYINDEX, key: "benchmark.context")
+    L.pushCFunction { L in
+        _ = L.getField(LUA_REGISTRYINDEX, key: "benchmark.context")
+        let context = L.toSwiftObject(-1) as! Context
+        L.pop()
+        context.total += L.toInteger(1) ?? 0
+        L.pushInteger(context.total)
+        return 1
+    }
+    L.setGlobal("registry")
+    let capturedContext = Context()
+    L.pushClosure { L in
+        capturedContext.total += L.toInteger(1) ?? 0
+        L.pushInteger(capturedContext.total)
+        return 1
+    }
+    L.setGlobal("closure")
+    L.doString("""
+    function bench(f)
+        local s = 0
+        for i = 1, 1000000 do s = f(i) end
+        return s
+    end
+    """)
+    var times: [String: Double] = [:]
+    for name in ["thin", "registry", "closure"] {
+        times[name] = benchmark("Calls to a \(name) function") {
+            #expect(L.doString("return bench(\(name))") == false)
+            L.pop()
+        }
+    }
+    print("[benchmark] closure overhead over thin: \(times["closure"]! / times["thin"]!)x, speedup over registry lookups: \(times["registry"]! / times["closure"]!)x")
+    #expect(registryContext.total == capturedContext.total)
+    L.close()
+}
+
+@Test(.enabled(if: benchmarksEnabled)) func benchmarkStatePool() throws {
+    let requests = 2000
+    let request = "local t = {} for i = 1, 100 do t[i] = tostring(i) end result = table.concat(t, ',')"
+    let freshTime = benchmark("New state per request", iterations: 1) {
+        for _ in 0..<requests {
+            let L = LuaState.newLuaState()
+            L.openLibs()
+            #expect(L.doString(request) == false)
+            L.close()
+        }
+    }
+    let pool = LuaStatePool(capacity: 4, prewarm: 1)
+    let pooledTime = benchmark("Pooled state per request", iterations: 1) {
+        for _ in 0..<requests {
+            pool.withState { L in
+                #expect(L.doString(request) == false)
+            }
+        }
+    }
+    let metrics = pool.metrics
+    print("[benchmark] speedup: \(freshTime / pooledTime)x")
+    print("[benchmark] hit rate: \(metrics.hitRate), checkout: \(metrics.averageCheckoutNanoseconds) ns, reset: \(metrics.averageResetNanoseconds) ns")
+    #expect(metrics.checkouts == requests)
+    #expect(metrics.misses == 0)
+    pool.close()
+}
@@ -1,6 +1,7 @@
 import Testing
 import Lua
 import LuaHelpers
+import Foundation
 
 @Test func simpleRefWithHelper() {
     let L = LuaState.newLuaState()
@@ -271,3 +272,773 @@ import LuaHelpers
     
     L.close()
 }
+
+@Test func stackTableConversion() throws {
+    let L = LuaState.newLuaState()
+    L.openLibs()
+    L.doString(#"return { 10, 20, 30, name = "outer", [false] = "no", [-1] = "neg", [2.5] = "half", inner = { 1, 2, deep = { x = "y" } }, fn = print }"#)
+    let registrySize = L.rawLen(LUA_REGISTRYINDEX)
+    let table = try #require(L.toValue()?.asTable())
+    #expect(L.rawLen(LUA_REGISTRYINDEX) == registrySize)
+    #expect(L.getTop() == 1)
+    #expect(table.array == [10, 20, 30])
+    #expect(table["name"] == "outer")
+    #expect(table[false] == "no")
+    #expect(table[-1] == "neg")
+    #expect(table[2.5] == "half")
+    #expect(table["fn"] == .luaNil)
+    let inner = try #require(table["inner"].asTable())
+    #expect(inner.array == [1, 2])
+    #expect(inner["deep"].asTable()?["x"] == "y")
+    L.close()
+}
+
+@Test func swiftStructUserdataMetatableIsCached() throws {
+    struct Shared: SwiftStructUserdata {}
+    struct CallOnly: SwiftStructUserdata {
+        static var metamethods: SwiftStructUserdataMetamethods { [.call] }
+        func __call(_ L: LuaState) -> Int32 {
+            L.pushString("called")
+            return 1
+        }
+    }
+    let L = LuaState.newLuaState()
+    L.openLibs()
+    L.registerSwiftStructUserdata(CallOnly.self)
+    _ = L.new(Shared())
+    L.setGlobal("a")
+    _ = L.new(Shared())
+    L.setGlobal("b")
+    _ = L.new(CallOnly())
+    L.setGlobal("c")
+    _ = L.new(CallOnly())
+    L.setGlobal("d")
+    #expect(L.doString(#"return getmetatable(a) == getmetatable(b), getmetatable(c) == getmetatable(d), getmetatable(a) ~= getmetatable(c)"#) == false)
+    #expect(L.toBoolean(-3))
+    #expect(L.toBoolean(-2))
+    #expect(L.toBoolean(-1))
+    L.pop(3)
+    #expect(L.doString(#"return rawget(getmetatable(a), "__index") ~= nil, rawget(getmetatable(c), "__index") == nil, c()"#) == false)
+    #expect(L.toBoolean(-3))
+    #expect(L.toBoolean(-2))
+    #expect(L.toString(-1) == "called")
+    L.pop(3)
+    // Without `__index` indexing never reaches Swift and raises the usual Lua error.
+    #expect(L.doString(#"return c.field"#) == true)
+    L.close()
+}
+
+@Test func swiftStructUserdataMembers() throws {
+    struct Vec: SwiftStructUserdata {
+        var x: Double
+        var y: Double
+        static var members: [SwiftStructUserdataMember] {
+            [
+                .field("x", get: { L in
+                    L.pushNumber(L.toUserDataInstancePointer(index: 1, as: Vec.self)!.pointee.x)
+                    return 1
+                }, set: { L in
+                    L.toUserDataInstancePointer(index: 1, as: Vec.self)!.pointee.x = L.toNumber(3) ?? 0
+                    return 0
+                }),
+                .field("y", get: { L in
+                    L.pushNumber(L.toUserDataInstancePointer(index: 1, as: Vec.self)!.pointee.y)
+                    return 1
+                }),
+                .method("length", { L in
+                    let vec = L.toUserDataInstancePointer(index: 1, as: Vec.self)!.pointee
+                    L.pushNumber((vec.x * vec.x + vec.y * vec.y).squareRoot())
+                    return 1
+                }),
+            ]
+        }
+    }
+    struct MethodsOnly: SwiftStructUserdata {
+        static var metamethods: SwiftStructUserdataMetamethods { [] }
+        static var members: [SwiftStructUserdataMember] {
+            [.method("hello", { L in
+                L.pushString("world")
+                return 1
+            })]
+        }
+    }
+    let L = LuaState.newLuaState()
+    L.openLibs()
+    let vec = L.new(Vec(x: 3, y: 4))
+    L.setGlobal("v")
+    _ = L.new(MethodsOnly())
+    L.setGlobal("m")
+    #expect(L.doString(#"return v.x, v.y, v:length(), v.missing"#) == false)
+    #expect(L.toNumber(-4) == 3)
+    #expect(L.toNumber(-3) == 4)
+    #expect(L.toNumber(-2) == 5)
+    #expect(L.type(-1) == .LUA_TNIL)
+    L.pop(4)
+    #expect(L.doString(#"v.x = 6; return v.x"#) == false)
+    #expect(L.toNumber(-1) == 6)
+    #expect(vec.pointee.x == 6)
+    L.pop()
+    // A type with only methods resolves them from a plain __index table.
+    #expect(L.doString(#"return type(getmetatable(m).__index), m:hello()"#) == false)
+    #expect(L.toString(-2) == "table")
+    #expect(L.toString(-1) == "world")
+    L.close()
+}
+
+@Test func schedulerRunsCoroutinesOfManyStates() {
+    final class Results: @unchecked Sendable {
+        let lock = NSLock()
+        var sums: [lua_Integer] = []
+        var errors: [String] = []
+    }
+    let results = Results()
+    let scheduler = LuaScheduler(workerCount: 4)
+    var states: [LuaState] = []
+    for i in 0..<16 {
+        let L = LuaState.newLuaState()
+        L.openLibs()
+        if i % 2 == 0 {
+            // No explicit yields; the budget slices the coroutines instead
+            L.setInstructionBudget(2_000, onExhausted: .yield)
+        }
+        for n in 1...3 {
+            #expect(L.doString("""
+            return function(n, yields)
+                local s = 0
+                for i = 1, n do
+                    s = s + i
+                    if yields and i % 100 == 0 then coroutine.yield(i) end
+                end
+                return s
+            end
+            """) == false)
+            L.pushInteger(lua_Integer(1000 * n))
+            L.pushBoolean(i % 2 == 1)
+            scheduler.spawn(L, nargs: 2)
+        }
+        states.append(L)
+    }
+    #expect(states[0].doString("return function() error('boom') end") == false)
+    scheduler.spawn(states[0])
+    let stats = scheduler.run { _, thread, status in
+        results.lock.lock()
+        if status == .LUA_OK {
+            results.sums.append(thread.toInteger()!)
+        } else {
+            results.errors.append(thread.toString() ?? "")
+        }
+        results.lock.unlock()
+    }
+    #expect(stats.completed == 16 * 3 + 1)
+    #expect(stats.resumes > stats.completed)
+    #expect(results.sums.count == 16 * 3)
+    #expect(results.sums.reduce(0, +) == 16 * (500500 + 2001000 + 4501500))
+    #expect(results.errors.count == 1)
+    #expect(results.errors.first?.hasSuffix("boom") == true)
+    for L in states {
+        #expect(L.getTop() == 0)
+        L.close()
+    }
+}
+
+/// A local stand-in for an I/O source: answers after a short delay without blocking a thread.
+@available(macOS 10.15, iOS 13.0, watchOS 6.0, tvOS 13.0, *)
+actor FakeKeyValueStore {
+    struct MissingKey: Error, CustomStringConvertible {
+        let key: String
+        var description: String { "missing key \(key)" }
+    }
+    private var values: [String: Value] = ["answer": 42, "greeting": "hello"]
+    private(set) var reads = 0
+    
+    func read(_ key: String) async throws -> Value {
+        try await Task.sleep(nanoseconds: 1_000_000)
+        reads += 1
+        guard let value = values[key] else {
+            throw MissingKey(key: key)
+        }
+        return value
+    }
+}
+
+@available(macOS 10.15, iOS 13.0, watchOS 6.0, tvOS 13.0, *)
+@Test func asyncFunctionsYieldWhileAwaiting() async throws {
+    let store = FakeKeyValueStore()
+    let states = (0..<50).map { _ in
+        let L = LuaState.newLuaState()
+        L.openLibs()
+        L.registerAsyncFunction("read") { arguments in
+            [try await store.read(arguments.first?.asString ?? "")]
+        }
+        return L
+    }
+    let sums = await withTaskGroup(of: lua_Integer?.self) { group in
+        for (i, L) in states.enumerated() {
+            group.addTask {
+                #expect(L.doString("""
+                return function(i)
+                    local ok, err = pcall(read, "nope")
+                    assert(not ok and err:find("missing key nope"))
+                    return read("answer") + i, read("greeting")
+                end
+                """) == false)
+                L.pushInteger(lua_Integer(i))
+                guard await L.callAwaiting(nargs: 1) == .LUA_OK else {
+                    return nil
+                }
+                #expect(L.toString(-1) == "hello")
+                defer { L.pop(2) }
+                return L.toInteger(-2)
+            }
+        }
+        var sums: [lua_Integer?] = []
+        for await sum in group {
+            sums.append(sum)
+        }
+        return sums
+    }
+    #expect(sums.compactMap { $0 }.reduce(0, +) == 50 * 42 + (0..<50).reduce(0, +))
+    #expect(await store.reads == 50 * 3)
+    for L in states {
+        #expect(L.getTop() == 0)
+        // Not in an awaiting coroutine
+        #expect(L.doString(#"return read("answer")"#) == true)
+        #expect(L.toString()?.hasSuffix("outside of an awaiting coroutine") == true)
+        L.close()
+    }
+}
+
+@Test func bytecodeCache() throws {
+    let directory = FileManager.default.temporaryDirectory.appendingPathComponent("LuaBytecodeCacheTests-\(UUID().uuidString)")
+    defer { try? FileManager.default.removeItem(at: directory) }
+    let source = #"local a = ... return (a or 1) + 2, debug.getinfo(1, "S").source"#
+    let L = LuaState.newLuaState()
+    L.openLibs()
+    func run(_ cache: LuaBytecodeCache, name: String = "script") {
+        #expect(L.loadBufferX(buffer: source, name: name, cache: cache) == .LUA_OK)
+        L.pushInteger(40)
+        #expect(L.pcall(nargs: 1) == .LUA_OK)
+        #expect(L.toInteger(-2) == 42)
+        #expect(L.toString(-1) == name)
+        L.pop(2)
+    }
+    let cache = LuaBytecodeCache(directory: directory)
+    run(cache)
+    #expect(cache.statistics == LuaBytecodeCache.Statistics(memoryHits: 0, diskHits: 0, misses: 1))
+    run(cache)
+    #expect(cache.statistics == LuaBytecodeCache.Statistics(memoryHits: 1, diskHits: 0, misses: 1))
+    // The chunk name is part of the key
+    run(cache, name: "other")
+    #expect(cache.statistics.misses == 2)
+    // Hits compare the source itself, and files are named after a SHA-256 digest
+    #expect(L.loadBufferX(buffer: "return 1", name: "same", cache: cache) == .LUA_OK)
+    #expect(L.loadBufferX(buffer: "return 2", name: "same", cache: cache) == .LUA_OK)
+    #expect(L.pcall(nargs: 0, nresults: 1) == .LUA_OK)
+    #expect(L.toInteger() == 2)
+    L.pop(2)
+    #expect(cache.statistics.misses == 4)
+    let files = try FileManager.default.contentsOfDirectory(atPath: directory.path)
+    #expect(files.count == 4)
+    #expect(files.allSatisfy { $0.count == 64 + ".luac".count && $0.hasSuffix(".luac") })
+    
+    // A new cache finds the bytecode on disk, uses it in place and keeps it in memory for the next loads
+    let reloaded = LuaBytecodeCache(directory: directory)
+    run(reloaded)
+    run(reloaded)
+    #expect(reloaded.statistics == LuaBytecodeCache.Statistics(memoryHits: 1, diskHits: 1, misses: 0))
+    
+    // Errors are not cached
+    #expect(L.loadBufferX(buffer: "return +", name: "broken", cache: reloaded) == .LUA_ERRSYNTAX)
+    L.pop()
+    #expect(L.loadBufferX(buffer: "return +", name: "broken", cache: reloaded) == .LUA_ERRSYNTAX)
+    L.pop()
+    #expect(reloaded.statistics.misses == 2)
+    #expect(L.getTop() == 0)
+    L.close()
+}
+
+@Test func loadMappedChunk() throws {
+    let path = FileManager.default.temporaryDirectory.appendingPathComponent("LuaMappedChunk-\(UUID().uuidString).luac").path
+    defer { try? FileManager.default.removeItem(atPath: path) }
+    let L = LuaState.newLuaState()
+    L.openLibs()
+    #expect(L.loadBufferX(buffer: """
+    local long = "a long string constant, longer than the forty bytes of a short string"
+    return function(n)
+        if n < 0 then error("negative") end
+        return #long + n
+    end
+    """, name: "=mapped") == .LUA_OK)
+    let aligned = try #require(L.dumpToBytes(aligned: true))
+    let plain = try #require(L.dumpToBytes())
+    L.pop()
+    #expect(aligned.count >= plain.count)
+    #expect(FileManager.default.createFile(atPath: path, contents: Data(aligned)))
+    
+    #expect(L.loadMappedFile(path: path, name: "mapped") == .LUA_OK)
+    #expect(L.pcall(nargs: 0) == .LUA_OK)
+    L.setGlobal("f")
+    #expect(L.doString("return f(2), select(2, pcall(f, -1))") == false)
+    #expect(L.toInteger(-2) == 71)
+    #expect(L.toString(-1) == "mapped:3: negative")
+    L.pop(2)
+    // Both formats also load through the copying loader
+    for bytes in [aligned, plain] {
+        #expect(bytes.withUnsafeBytes { L.loadBufferX(bytes: $0, name: "copy", mode: "b") } == .LUA_OK)
+        #expect(L.pcall(nargs: 0) == .LUA_OK)
+        L.pushInteger(1)
+        #expect(L.pcall(nargs: 1) == .LUA_OK)
+        #expect(L.toInteger() == 70)
+        L.pop()
+    }
+    // A truncated chunk fails without keeping the mapping
+    let truncatedPath = path + ".truncated"
+    defer { try? FileManager.default.removeItem(atPath: truncatedPath) }
+    #expect(FileManager.default.createFile(atPath: truncatedPath, contents: Data(aligned.prefix(20))))
+    #expect(L.loadMappedFile(path: truncatedPath, name: "truncated") == .LUA_ERRSYNTAX)
+    L.pop()
+    #expect(L.loadMappedFile(path: path + ".missing", name: "missing") == nil)
+    L.close()
+}
+
+@Test func moduleBundle() throws {
+    let path = FileManager.default.temporaryDirectory.appendingPathComponent("LuaModuleBundle-\(UUID().uuidString).luab").path
+    defer { try? FileManager.default.removeItem(atPath: path) }
+    let modules = [
+        "config": "return { scale = 10, name = '\(String(repeating: "padding ", count: 50))' }",
+        "util.math": "local config = require('config') return { scale = function(x) return x * config.scale end }",
+        "app": "local name = ... return require('util.math').scale(4) + #name - 1",
+    ]
+    let L = LuaState.newLuaState()
+    L.openLibs()
+    for (precompile, compress) in [(true, false), (true, true), (false, true)] {
+        let bytes = try #require(L.makeBundle(modules: modules, precompile: precompile, compress: compress))
+        #expect(FileManager.default.createFile(atPath: path, contents: Data(bytes)))
+        L.doString("package.bundles = {} for k in pairs(package.loaded) do if k == 'app' or k == 'config' or k == 'util.math' then package.loaded[k] = nil end end")
+        #expect(L.addBundle(path: path) == .LUA_OK)
+        #expect(L.doString("return require('app')") == false)
+        #expect(L.toInteger(-2) == 42)
+        #expect(L.toString(-1) == path)
+        L.pop(2)
+        L.getGlobal("package")
+        L.getField(-1, key: "bundles")
+        L.rawGetI(-1, n: 1)
+        let stats = try #require(L.bundleStats())
+        #expect(stats.modules == 3)
+        #expect(stats.loads == 3)
+        if compress {
+            #expect(stats.decompressedBytes > 0)
+        } else {
+            #expect(stats.mappedLoads == 3)
+        }
+        // Loading a module directly, and a module the bundle does not have
+        #expect(L.loadBundled(-1, module: "config") == .LUA_OK)
+        #expect(L.loadBundled(-2, module: "missing") == nil)
+        L.pop(4)
+    }
+    
+    // A module that does not compile fails the whole bundle
+    #expect(L.makeBundle(modules: ["broken": "return +"]) == nil)
+    L.pop()
+    // Corrupted modules are detected by their hash
+    var bytes = try #require(L.makeBundle(modules: ["m": "return 1"], precompile: false))
+    bytes[bytes.count - 1] = UInt8(ascii: "2")
+    #expect(FileManager.default.createFile(atPath: path, contents: Data(bytes)))
+    #expect(L.addBundle(path: path) == .LUA_OK)
+    #expect(L.doString("return require('m')") == true)
+    #expect(L.toString()?.contains("corrupted") == true)
+    L.pop()
+    #expect(L.addBundle(path: "/nonexistent.luab") != .LUA_OK)
+    L.pop()
+    #expect(L.getTop() == 0)
+    L.close()
+}
+
+@Test func compileInParallel() throws {
+    var chunks: [(name: String, source: String)] = []
+    for i in 0..<50 {
+        chunks.append((name: "=chunk\(i)", source: "local x = ... return (x or 0) + \(i), debug.getinfo(1, 'S').source"))
+    }
+    chunks.append((name: "=broken", source: "return +"))
+    let compiled = LuaState.compileInParallel(chunks, threads: 4)
+    #expect(compiled.count == 51)
+    let L = LuaState.newLuaState()
+    L.openLibs()
+    for i in 0..<50 {
+        #expect(compiled[i].name == "=chunk\(i)")
+        #expect(compiled[i].error == nil)
+        #expect(L.load(compiled[i]) == .LUA_OK)
+        L.pushInteger(100)
+        #expect(L.pcall(nargs: 1) == .LUA_OK)
+        #expect(L.toInteger(-2) == Int64(100 + i))
+        #expect(L.toString(-1) == "=chunk\(i)")
+        L.pop(2)
+    }
+    #expect(compiled[50].bytecode == nil)
+    #expect(compiled[50].error?.contains("broken") == true)
+    #expect(L.load(compiled[50]) == .LUA_ERRSYNTAX)
+    L.pop()
+    #expect(LuaState.compileInParallel([]).isEmpty)
+    #expect(L.getTop() == 0)
+    L.close()
+}
+
+@Test func refArena() throws {
+    let L = LuaState.newLuaState()
+    L.openLibs()
+    let arena = LuaRefArena(L, capacity: 4)
+    // References keep their values through growth and collections
+    var refs: [LuaArenaRef] = []
+    for i in 0..<1000 {
+        L.pushString("value \(i)")
+        refs.append(arena.refPopping())
+    }
+    L.gcCollect()
+    for (i, ref) in refs.enumerated() {
+        #expect(arena.push(ref) == .LUA_TSTRING)
+        #expect(L.toString() == "value \(i)")
+        L.pop()
+    }
+    #expect(arena.liveCount == 1000)
+    
+    // Released references are caught, also after their slot is reused
+    let released = refs[10]
+    #expect(arena.unref(released))
+    #expect(!arena.unref(released))
+    L.pushString("reused")
+    let reused = arena.refPopping()
+    #expect(reused.index == released.index && reused.generation != released.generation)
+    #expect(arena.push(released) == .LUA_TNONE)
+    #expect(L.type(-1) == .LUA_TNIL)
+    L.pop()
+    #expect(arena.copy(released) == nil)
+    let copy = try #require(arena.copy(reused))
+    #expect(arena.unref(reused))
+    #expect(arena.push(copy) == .LUA_TSTRING && L.toString() == "reused")
+    L.pop()
+    #expect(arena.stats.stale == 3)
+    
+    // Scopes release what was created inside them, except what was released already
+    let before = arena.liveCount
+    var inner: LuaArenaRef?
+    var outer: LuaArenaRef?
+    arena.withScope {
+        L.newTable()
+        outer = arena.refPopping()
+        arena.withScope {
+            L.pushNil()
+            inner = arena.refPopping()
+            #expect(arena.push(inner!) == .LUA_TNIL)
+            L.pop()
+        }
+        #expect(arena.push(inner!) == .LUA_TNONE)
+        L.pop()
+        for _ in 0..<100 {
+            L.pushString("temporary")
+            arena.unref(arena.refPopping())
+        }
+        #expect(arena.liveCount == before + 1)
+    }
+    #expect(arena.push(outer!) == .LUA_TNONE)
+    L.pop()
+    #expect(arena.liveCount == before)
+    
+    // Released values can be collected
+    #expect(L.doString("weak = setmetatable({}, {__mode = 'v'}) weak[1] = {}") == false)
+    _ = L.getGlobal("weak")
+    _ = L.rawGetI(-1, n: 1)
+    let table = arena.refPopping()
+    L.pop()
+    L.gcCollect()
+    #expect(L.doString("assert(weak[1] ~= nil)") == false)
+    arena.unref(table)
+    L.gcCollect()
+    #expect(L.doString("assert(weak[1] == nil)") == false)
+    #expect(L.getTop() == 0)
+    arena.close()
+    L.close()
+}
+
+@Test func preparedCall() throws {
+    let L = LuaState.newLuaState()
+    L.openLibs()
+    #expect(L.doString("""
+    calls = 0
+    return function(id, dt, name)
+        calls = calls + 1
+        if name == "fail" then error("failed on " .. id) end
+        return id * 2, dt / 2, name and name:upper(), { id = id }
+    end
+    """) == false)
+    let update = LuaPreparedCall(L, nargs: 3, nresults: 4)
+    #expect(L.getTop() == 0)
+    
+    // Typed arguments and results, read in place
+    for id in 1...1000 {
+        #expect(update.call(lua_Integer(id), 0.5, "entity") == .LUA_OK)
+        #expect(update.resultCount == 4)
+        #expect(update.result(0, as: lua_Integer.self) == lua_Integer(id * 2))
+        #expect(update.result(1, as: lua_Number.self) == 0.25)
+    }
+    #expect(update.result(2, as: String.self) == "ENTITY")
+    #expect(update.withUnsafeResultString(2) { Array($0) } == Array("ENTITY".utf8))
+    #expect(update.result(3, as: lua_Number.self) == nil)
+    #expect(update.result(4, as: Bool.self) == nil)
+    update.pushResult(3)
+    #expect(L.getField(-1, key: "id") == .LUA_TNUMBER && L.toInteger() == 1000)
+    L.pop(2)
+    update.pushResult(4)
+    #expect(L.getTop() == 1 && L.type(-1) == .LUA_TNIL)
+    L.pop()
+    
+    // Fewer arguments, and arguments pushed one by one
+    #expect(update.call(7) == .LUA_OK)
+    #expect(update.result(0, as: Int.self) == 14)
+    #expect(update.result(2, as: Bool.self) == false)
+    update.begin()
+    update.push(3)
+    update.push(1.0)
+    #expect(update.invoke() == .LUA_OK)
+    #expect(update.result(0, as: Int.self) == 6)
+    #expect(update.result(1, as: lua_Number.self) == 0.5)
+    
+    // Errors leave the prepared call usable
+    #expect(update.call(5, 1.0, "fail") == .LUA_ERRRUN)
+    #expect(update.resultCount == 1)
+    #expect(update.errorMessage?.hasSuffix("failed on 5") == true)
+    #expect(update.call(5, 1.0) == .LUA_OK)
+    #expect(update.result(0, as: Int.self) == 10)
+    
+    // The function stays alive only through the prepared call
+    #expect(L.doString("weak = setmetatable({}, {__mode = 'k'})") == false)
+    _ = L.getGlobal("weak")
+    update.thread.pushValue(copiedFromIdx: 1)
+    update.thread.xmove(to: L, n: 1)
+    L.pushBoolean(true)
+    L.setTable(-3)
+    L.pop()
+    L.gcCollect()
+    #expect(L.doString("assert(next(weak) ~= nil) assert(calls == 1004)") == false)
+    update.close()
+    L.gcCollect()
+    #expect(L.doString("assert(next(weak) == nil)") == false)
+    #expect(L.getTop() == 0)
+    L.close()
+}
+
+@Test func typedFunction() throws {
+    struct Overheated: Error, CustomStringConvertible {
+        var description: String { "overheated" }
+    }
+    let L = LuaState.newLuaState()
+    L.openLibs()
+    L.registerTypedFunction("scale") { (id: lua_Integer, factor: lua_Number, label: String) -> lua_Number in
+        return Double(id) * factor + Double(label.count)
+    }
+    L.registerTypedFunction("greet") { (name: String?, loud: Bool) -> String in
+        let greeting = "hello \(name ?? "nobody")"
+        return loud ? greeting.uppercased() : greeting
+    }
+    L.registerTypedFunction("find") { (key: String) -> lua_Integer? in
+        return key == "answer" ? 42 : nil
+    }
+    var total = 0
+    L.registerTypedFunction("add") { (n: Int) in
+        total += n
+    }
+    L.registerTypedFunction("check") { (temperature: lua_Number) -> Bool in
+        if temperature > 100 {
+            throw Overheated()
+        }
+        return true
+    }
+    #expect(L.doString("""
+    assert(scale(3, 0.5, "ab") == 3.5)
+    assert(scale("4", "2", 10) == 10)  -- numeric strings and numbers convert, like luaL_check*
+    assert(scale(2.0, 1, "", "ignored") == 2)
+    assert(greet("lua", false) == "hello lua")
+    assert(greet(nil, true) == "HELLO NOBODY")
+    assert(greet() == "hello nobody")
+    assert(find("answer") == 42 and find("question") == nil)
+    assert(select("#", add(1)) == 0)
+    for i = 2, 10 do add(i) end
+    assert(check(20) == true)
+    """) == false)
+    #expect(total == 55)
+    
+    // Bad arguments raise the errors of luaL_check*
+    func failure(_ chunk: String) -> String? {
+        #expect(L.doString("local ok, err = pcall(function() \(chunk) end) return err") == false)
+        defer { L.pop() }
+        return L.toString()
+    }
+    #expect(failure("scale(1, {}, 'x')")?.hasSuffix("bad argument #2 to 'scale' (number expected, got table)") == true)
+    #expect(failure("scale(1.5, 1, 'x')")?.hasSuffix("bad argument #1 to 'scale' (integer expected, got number)") == true)
+    #expect(failure("scale(1, 1)")?.hasSuffix("bad argument #3 to 'scale' (string expected, got no value)") == true)
+    #expect(failure("greet(true)")?.hasSuffix("bad argument #1 to 'greet' (string expected, got boolean)") == true)
+    #expect(failure("check(200)") == "overheated")
+    #expect(L.doString("assert(check(50))") == false)
+    
+    // The functions are collected with their closures
+    weak var box: AnyObject?
+    do {
+        let tracker = NSObject()
+        box = tracker
+        L.pushTypedFunction { (x: lua_Number) -> lua_Number in
+            _ = tracker
+            return x
+        }
+        L.setGlobal("tracked")
+    }
+    #expect(L.doString("assert(tracked(1.5) == 1.5) tracked = nil") == false)
+    L.gcCollect()
+    #expect(box == nil)
+    #expect(L.getTop() == 0)
+    L.close()
+}
+
+@Test func capturingClosure() throws {
+    final class Counter {
+        var count: lua_Integer = 0
+    }
+    let L = LuaState.newLuaState()
+    L.openLibs()
+    let counter = Counter()
+    L.pushClosure { L in
+        counter.count += L.toInteger(1) ?? 1
+        L.pushInteger(counter.count)
+        return 1
+    }
+    L.setGlobal("increment")
+    #expect(L.doString("for i = 1, 10 do increment(i) end assert(increment() == 56)") == false)
+    #expect(counter.count == 56)
+    
+    // Extra upvalues follow the closure's own
+    L.pushString("prefix")
+    L.pushInteger(7)
+    L.pushClosure(n: 2) { L in
+        L.pushValue(copiedFromIdx: lua_upvalueindex(2))
+        L.pushValue(copiedFromIdx: lua_upvalueindex(3))
+        return 2
+    }
+    L.setGlobal("upvalues")
+    #expect(L.doString("local s, n = upvalues() assert(s == 'prefix' and n == 7)") == false)
+    #expect(L.getTop() == 0)
+    
+    // The closure and what it captures are released with the Lua function
+    weak var captured: Counter?
+    do {
+        let temporary = Counter()
+        captured = temporary
+        L.pushClosure { L in
+            temporary.count += 1
+            return 0
+        }
+        L.setGlobal("temporary")
+    }
+    #expect(L.doString("temporary() temporary = nil") == false)
+    #expect(captured?.count == 1)
+    L.gcCollect()
+    #expect(captured == nil)
+    L.close()
+}
+
+@Test func statePool() throws {
+    let pool = LuaStatePool(capacity: 2, prewarm: 1) { L in
+        L.openLibs()
+        L.doString("config = { name = 'pristine' } package.preload.helper = function() return { loaded = true } end")
+    }
+    #expect(pool.idleCount == 1)
+    
+    // A request dirties globals, libraries, modules and the registry
+    let L = pool.checkout()
+    #expect(L.doString("""
+    leaked = 1
+    config = nil
+    print = nil
+    string.leaked = true
+    string.upper = string.lower
+    package.loaded.helper = nil
+    helper = require("helper")
+    assert(helper.loaded)
+    """) == false)
+    L.newTable()
+    _ = UnsafeLuaRef(luaState: L)  // never released: the reset drops it
+    _ = L.newMetatable(typeName: "RequestType")
+    L.pop()
+    L.pushString("left on the stack")
+    pool.checkin(L)
+    #expect(pool.idleCount == 1)
+    
+    // The next request gets the same state back, as it was after preparation
+    let M = pool.checkout()
+    #expect(M.state == L.state)
+    #expect(M.getTop() == 0)
+    #expect(M.doString("""
+    assert(leaked == nil)
+    assert(config.name == "pristine" and print ~= nil)
+    assert(string.leaked == nil and ("a"):upper() == "A")
+    assert(package.loaded.helper == nil and helper == nil)
+    assert(require("helper").loaded)
+    assert(debug.getregistry().RequestType == nil)
+    """) == false)
+    
+    // Refs made by one request do not disturb the next one's
+    M.pushString("first")
+    let first = UnsafeLuaRef(luaState: M)
+    M.pop()
+    _ = M.pushRef(first.ref)
+    #expect(M.toString() == "first")
+    M.pop()
+    
+    // Checkouts beyond the idle states create new ones, and checkins beyond the capacity close them
+    let extra = (0..<2).map { _ in pool.checkout() }
+    pool.checkin(M)
+    for state in extra {
+        pool.checkin(state)
+    }
+    #expect(pool.idleCount == 2)
+    let metrics = pool.metrics
+    #expect(metrics.checkouts == 4)
+    #expect(metrics.hits == 2)
+    #expect(metrics.misses == 2)
+    #expect(metrics.hitRate == 0.5)
+    #expect(metrics.resets == 3)
+    #expect(metrics.discarded == 1)
+    #expect(metrics.averageResetNanoseconds > 0)
+    pool.withState { L in
+        #expect(L.doString("assert(config.name == 'pristine')") == false)
+    }
+
+    // Metatables, collector settings and hooks do not outlive a request either
+    pool.withState { L in
+        #expect(L.doString("""
+        setmetatable(_G, { __index = function() return "leaked" end })
+        getmetatable("").__index = function() return function() return "leaked" end end
+        debug.setmetatable(nil, { __index = function() return "leaked" end })
+        collectgarbage("stop")
+        collectgarbage("generational")
+        debug.sethook(function() end, "l")
+        """) == false)
+    }
+    pool.withState { L in
+        #expect(L.doString("""
+        assert(getmetatable(_G) == nil and undefined == nil)
+        assert(("a"):upper() == "A")
+        assert(getmetatable(nil) == nil)
+        assert(collectgarbage("isrunning"))
+        assert(collectgarbage("incremental") == "incremental")
+        assert(debug.gethook() == nil)
+        """) == false)
+    }
+    
+    // Concurrent checkins never keep more than `capacity` idle states
+    DispatchQueue.concurrentPerform(iterations: 8) { _ in
+        let states = (0..<3).map { _ in pool.checkout() }
+        for state in states {
+            pool.checkin(state)
+        }
+    }
+    #expect(pool.idleCount <= pool.capacity)
+    pool.close()
+}
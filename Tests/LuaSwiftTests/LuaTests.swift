@@ -251,3 +251,455 @@ import Lua
     
     L.close()
 }
+
+@Test func byteExactStrings() throws {
+    let L = LuaState.newLuaState()
+    L.openLibs()
+    let payload: [UInt8] = [0x82, 0xa3, 0x00, 0xff, 0x00, 0x41]
+    L.pushLString(payload)
+    #expect(L.rawLen(-1) == 6)
+    #expect(L.toBytes() == payload)
+    let firstByte = L.withUnsafeLString { bytes in
+        bytes.first
+    }
+    #expect(firstByte == 0x82)
+    L.pop()
+    L.pushString("a\0b")
+    #expect(L.rawLen(-1) == 3)
+    #expect(L.toString() == "a\0b")
+    L.pop()
+    payload.withUnsafeBytes { bytes in
+        L.pushLString(UnsafeRawBufferPointer(rebasing: bytes[2..<4]))
+    }
+    #expect(L.toBytes() == [0x00, 0xff])
+    L.pop()
+    #expect(L.loadBufferX(buffer: #"return #"héllo", "héllo""#, name: "utf8") == .LUA_OK)
+    #expect(L.pcall(nargs: 0) == .LUA_OK)
+    #expect(L.toInteger(-2) == 6)
+    #expect(L.toString(-1) == "héllo")
+    L.pop(2)
+    for count in [0, 3, 100] {
+        L.pushLString(count: count) { bytes in
+            for i in 0..<count {
+                bytes[i] = UInt8(i % 256)
+            }
+        }
+        #expect(L.toBytes() == (0..<count).map { UInt8($0 % 256) })
+        L.pop()
+    }
+    L.pushNil()
+    #expect(L.withUnsafeLString { $0.count } == nil)
+    L.close()
+}
+
+@Test func slabAllocator() throws {
+    let L = LuaState.newLuaState(allocator: .slab)
+    L.openLibs()
+    #expect(L.doString(#"local t = {} for i = 1, 1000 do t[i] = { i, tostring(i) } end return #t"#) == false)
+    #expect(L.toInteger() == 1000)
+    L.pop()
+    let stats = try #require(L.slabAllocatorStats())
+    #expect(stats.classBytes.count == Int(LUA_SLAB_NUMCLASSES))
+    #expect(stats.totalBytes == Int(L.gc(what: LUA_GCCOUNT)) * 1024 + Int(L.gc(what: LUA_GCCOUNTB)))
+    #expect(stats.peakBytes >= stats.totalBytes)
+    #expect(stats.classBytes.reduce(0, +) + stats.largeBytes == stats.totalBytes)
+    #expect(stats.chunkBytes > 0)
+    L.close()
+    
+    let systemL = LuaState.newLuaState(allocator: .system)
+    #expect(systemL.slabAllocatorStats() == nil)
+    systemL.close()
+}
+
+@Test func memoryLimit() throws {
+    for allocator in [LuaAllocator.system, .slab] {
+        let L = LuaState.newLuaState(allocator: allocator)
+        L.openLibs()
+        #expect(L.memoryUsage() == nil)
+        L.setMemoryLimit(hard: 1 << 20)
+        #expect(L.doString(#"local t = {} for i = 1, 1e7 do t[i] = "x" .. i end"#) == true)
+        #expect(L.toString() == "not enough memory")
+        L.pop()
+        #expect(L.doString(#"return select(2, pcall(function() local t = {} for i = 1, 1e7 do t[i] = {} end end))"#) == false)
+        #expect(L.toString() == "not enough memory")
+        L.pop()
+        var usage = try #require(L.memoryUsage())
+        #expect(usage.hardLimit == 1 << 20)
+        #expect(usage.softLimit == nil)
+        #expect(usage.failedAllocations > 0)
+        #expect(usage.peakBytes <= 1 << 20)
+        #expect(usage.bytesInUse == Int(L.gc(what: LUA_GCCOUNT)) * 1024 + Int(L.gc(what: LUA_GCCOUNTB)))
+        
+        // With the collector stopped, only the soft limit keeps garbage in check
+        _ = L.gc(what: LUA_GCSTOP)
+        L.setMemoryLimit(soft: 256 * 1024)
+        #expect(L.doString(#"local s = 0 for i = 1, 200000 do local t = { i, "y" .. i } s = s + #t end return s"#) == false)
+        #expect(L.toInteger() == 400000)
+        L.pop()
+        usage = try #require(L.memoryUsage())
+        #expect(usage.softCollections > 0)
+        #expect(usage.hardLimit == nil)
+        #expect(usage.bytesInUse < 512 * 1024)
+        #expect((L.slabAllocatorStats() != nil) == (allocator == .slab))
+        
+        // A soft limit alone never fails, also for buffers lauxlib allocates directly (table.concat, gsub, string.format)
+        _ = L.gc(what: LUA_GCRESTART)
+        #expect(L.doString(#"""
+            for i = 1, 200 do
+                local parts = {}
+                for j = 1, 200 do parts[j] = ("x"):rep(j) end
+                local s = table.concat(parts, ",") .. ("y"):rep(i * 100)
+                local f = string.format("%s%s", s, (s:gsub("x", "ab")))
+                assert(#f > #s)
+            end
+            """#) == false)
+        usage = try #require(L.memoryUsage())
+        #expect(usage.softCollections > 0)
+        L.close()
+    }
+}
+
+@Test func instructionBudget() throws {
+    let L = LuaState.newLuaState()
+    L.openLibs()
+    #expect(L.remainingInstructionBudget() == nil)
+    L.setInstructionBudget(100_000, onExhausted: .error)
+    #expect(L.doString("while true do end") == true)
+    #expect(L.toString() == "instruction budget exhausted")
+    L.pop()
+    
+    // Each coroutine gets its own budget
+    L.setInstructionBudget(50_000, onExhausted: .error)
+    #expect(L.doString("""
+    local n = 0
+    for c = 1, 5 do
+        n = n + coroutine.wrap(function() local s = 0 for i = 1, 5000 do s = s + i end return s end)()
+    end
+    return n
+    """) == false)
+    #expect(L.toInteger() == 5 * 12502500)
+    L.pop()
+    #expect(L.remainingInstructionBudget() == 50_000)
+    
+    // Time slicing
+    let co = L.newThread()
+    co.setInstructionBudget(10_000, quantum: 500, onExhausted: .yield)
+    #expect(co.loadBufferX(buffer: "local s = 0 for i = 1, 1e6 do s = s + i end return s", name: "slice") == .LUA_OK)
+    var slices = 0
+    var nresults: Int32 = 0
+    var status = co.resume(from: L, nargs: 0, nresults: &nresults)
+    while status == .LUA_YIELD {
+        #expect(nresults == 0)
+        slices += 1
+        status = co.resume(from: L, nargs: 0, nresults: &nresults)
+    }
+    #expect(status == .LUA_OK)
+    #expect(slices > 10)
+    #expect(co.toInteger() == 500000500000)
+    
+    // The main thread cannot yield, so it gets an error instead
+    #expect(L.doString("while true do end") == true)
+    #expect(L.toString() == "instruction budget exhausted")
+    L.pop(2)
+    
+    L.clearInstructionBudget()
+    #expect(L.remainingInstructionBudget() == nil)
+    #expect(L.doString("local s = 0 for i = 1, 1e6 do s = s + i end return s") == false)
+    #expect(L.toInteger() == 500000500000)
+    L.close()
+}
+
+@Test func pathCache() throws {
+    let directory = FileManager.default.temporaryDirectory.appendingPathComponent("LuaPathCache-\(UUID().uuidString)")
+    defer { try? FileManager.default.removeItem(at: directory) }
+    try FileManager.default.createDirectory(at: directory.appendingPathComponent("lib/sub"), withIntermediateDirectories: true)
+    func write(_ file: String, _ contents: String) {
+        #expect(FileManager.default.createFile(atPath: directory.appendingPathComponent(file).path, contents: Data(contents.utf8)))
+    }
+    write("lib/a.lua", "return 'a'")
+    write("lib/sub/init.lua", "return 'sub'")
+    let L = LuaState.newLuaState()
+    L.openLibs()
+    L.getGlobal("package")
+    L.pushString("\(directory.path)/missing/?.lua;\(directory.path)/missing/?/init.lua;\(directory.path)/lib/?.lua;\(directory.path)/lib/?/init.lua")
+    L.setField(-2, key: "path")
+    L.pushString("")
+    L.setField(-2, key: "cpath")
+    L.pop()
+    #expect(L.pathCacheStats().hits == 0)
+    
+    L.setPathCache(.trust)
+    #expect(L.doString("return require('a') .. require('sub')") == false)
+    #expect(L.toString() == "asub")
+    L.pop()
+    let first = L.pathCacheStats()
+    #expect(first.hits + first.misses == 3 + 4)
+    // Missing modules are answered from the snapshots
+    #expect(L.doString("for i = 1, 100 do assert(not pcall(require, 'optional')) end") == false)
+    let second = L.pathCacheStats()
+    #expect(second.hits == first.hits + 100 * 4)
+    #expect(second.misses == first.misses)
+    // New files are not seen until the cache is invalidated
+    write("lib/optional.lua", "return 'optional'")
+    #expect(L.doString("return require('optional')") == true)
+    L.pop()
+    L.invalidatePathCache()
+    #expect(L.doString("return require('optional')") == false)
+    #expect(L.toString() == "optional")
+    L.pop()
+    #expect(L.pathCacheStats().invalidations == 1)
+    
+    // With mtime checks, new files are found right away
+    L.setPathCache(.check)
+    write("lib/later.lua", "return 'later'")
+    #expect(L.doString("return require('later')") == false)
+    #expect(L.toString() == "later")
+    L.pop()
+    #expect(L.pathCacheStats().checks > 0)
+    L.setPathCache(.off)
+    #expect(L.doString("return require('missing.module')") == true)
+    L.pop()
+    L.close()
+}
+
+@Test func stringBuilder() throws {
+    let L = LuaState.newLuaState()
+    L.openLibs()
+    L.pushString("below")
+    let builder = LuaStringBuilder(L)
+    builder.append("x = ")
+    builder.append(42)
+    builder.append(byte: UInt8(ascii: ","))
+    builder.append(Int.min)
+    builder.append(byte: UInt8(ascii: ","))
+    builder.append(2.5)
+    builder.append(byte: UInt8(ascii: ","))
+    builder.append(3.0)
+    builder.append(byte: UInt8(ascii: ","))
+    builder.append(1.0 / 3.0)
+    builder.append([0, 0xFF])
+    L.pushString(" value")
+    builder.appendValue()
+    builder.append(reserving: 8) { bytes in
+        bytes.copyBytes(from: "!?".utf8)
+        return 2
+    }
+    #expect(builder.count == 62)
+    builder.finish()
+    #expect(L.toBytes() == Array("x = 42,-9223372036854775808,2.5,3.0,0.33333333333333".utf8) + [0, 0xFF] + Array(" value!?".utf8))
+    #expect(L.doString("return tostring(math.mininteger) .. ',' .. 2.5 .. ',' .. 3.0 .. ',' .. 1/3") == false)
+    #expect(L.toString() == "-9223372036854775808,2.5,3.0,0.33333333333333")
+    L.pop(2)
+    #expect(L.toString() == "below")
+    L.pop()
+    #expect(L.getTop() == 0)
+    
+    // Strings larger than the initial buffer move to a box on the stack
+    let large = LuaStringBuilder(L, capacity: 200_000)
+    for i in 0..<20_000 {
+        large.append(i)
+        large.append(byte: UInt8(ascii: "\n"))
+    }
+    large.finish()
+    #expect(L.getTop() == 1)
+    L.getGlobal("load")
+    L.pushString("local s = ... local n = 0 for line in s:gmatch('[^\\n]+') do assert(tonumber(line) == n) n = n + 1 end return n")
+    #expect(L.pcall(nargs: 1, nresults: 1) == .LUA_OK)
+    L.insert(-2)
+    #expect(L.pcall(nargs: 1, nresults: 1) == .LUA_OK)
+    #expect(L.toInteger() == 20_000)
+    L.close()
+}
+
+@Test func tableSort() throws {
+    let L = LuaState.newLuaState()
+    L.openLibs()
+    #expect(L.doString("""
+        local function check(t, lt)
+            for i = 2, #t do assert(not lt(t[i], t[i - 1])) end
+        end
+        local lt = function(a, b) return a < b end
+        math.randomseed(7)
+        for _, n in ipairs({1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 100, 5000}) do
+            local ints, floats, strings = {}, {}, {}
+            for i = 1, n do
+                ints[i] = math.random(-100, 100)
+                floats[i] = math.random() - 0.5
+                strings[i] = "s" .. math.random(1, 50) .. "\\0" .. math.random(1, 3)
+            end
+            for _, t in ipairs({ints, floats, strings}) do
+                local copy = table.move(t, 1, n, 1, {})
+                table.sort(t)
+                check(t, lt)
+                table.sort(copy, lt)
+                for i = 1, n do assert(t[i] == copy[i]) end
+            end
+        end
+        -- small arrays in every order (run under LUASWIFT_ASSERT=1 too, see Package.swift)
+        local t = {3, 2, 1}
+        table.sort(t)
+        assert(t[1] == 1 and t[2] == 2 and t[3] == 3)
+        local s = {"c", "b", "a"}
+        table.sort(s)
+        assert(s[1] == "a" and s[3] == "c")
+        -- mixed kinds, metatables and errors keep the generic behavior
+        local mixed = {3, 1.5, 2}
+        table.sort(mixed)
+        assert(mixed[1] == 1.5 and mixed[3] == 3)
+        assert(not pcall(table.sort, {1, "x", 2}))
+        """) == false)
+    
+    // Equal elements keep their order with table.stablesort, with or without a comparator
+    #expect(L.doString("""
+        local records = {}
+        for i = 1, 3000 do records[i] = {score = i % 17, id = i} end
+        table.stablesort(records, function(a, b) return a.score > b.score end)
+        for i = 2, #records do
+            local a, b = records[i - 1], records[i]
+            assert(a.score > b.score or (a.score == b.score and a.id < b.id))
+        end
+        local zeros = {}
+        for i = 1, 100 do zeros[i] = (i % 2 == 0) and 0.0 or -0.0 end
+        zeros[101] = -1.0
+        table.stablesort(zeros)
+        assert(zeros[1] == -1.0)
+        for i = 2, 101 do assert(1 / zeros[i] == ((i % 2 == 0) and -math.huge or math.huge)) end
+        """) == false)
+    L.close()
+}
+
+@Test func stringFind() throws {
+    let L = LuaState.newLuaState()
+    L.openLibs()
+    // Plain finds agree with a naive search, including needles whose first character is common
+    #expect(L.doString("""
+        local function naive(s, p, init)
+            for i = init, #s - #p + 1 do
+                if s:sub(i, i + #p - 1) == p then return i, i + #p - 1 end
+            end
+        end
+        math.randomseed(11)
+        local alphabet = {"a", "b", " ", "\\0"}
+        for _ = 1, 3000 do
+            local s, p = {}, {}
+            for i = 1, math.random(0, 200) do s[i] = alphabet[math.random(#alphabet)] end
+            for i = 1, math.random(1, 6) do p[i] = alphabet[math.random(#alphabet)] end
+            s, p = table.concat(s), table.concat(p)
+            local init = math.random(1, #s + 1)
+            local a1, b1 = s:find(p, init, true)
+            local a2, b2 = naive(s, p, init)
+            assert(a1 == a2 and b1 == b2)
+        end
+        """) == false)
+    
+    // Patterns with a literal prefix find the same matches as without one
+    #expect(L.doString("""
+        local log = ("x=1 ERROR: disk y=2 ERROR: net "):rep(20)
+        local cases = {
+            {"ERROR: (%a+)", "[E]RROR: (%a+)"}, {"y=%d", "[y]=%d"}, {"ERRORS?:", "[E]RRORS?:"},
+            {"x=1 E*", "[x]=1 E*"}, {"ab[", "[a]b["},
+        }
+        for _, p in ipairs(cases) do
+            for init = 1, #log, 37 do
+                local r1 = table.pack(pcall(string.find, log, p[1], init))
+                local r2 = table.pack(pcall(string.find, log, p[2], init))
+                for i = 1, math.max(r1.n, r2.n) do assert(r1[i] == r2[i]) end
+            end
+            local n1, n2 = 0, 0
+            if p[1] ~= "ab[" then
+                for _ in log:gmatch(p[1]) do n1 = n1 + 1 end
+                for _ in log:gmatch(p[2]) do n2 = n2 + 1 end
+            end
+            assert(n1 == n2)
+        end
+        assert(select("#", log:find("ERROR: (%a+)")) == 3)
+        """) == false)
+    L.close()
+}
+
+@Test func patternCache() throws {
+    let L = LuaState.newLuaState()
+    L.openLibs()
+    // Compiled patterns give the same results and errors as interpreted ones, also after evictions
+    #expect(L.doString("""
+        local items = {"a", "%a", "%d", "%s", "%W", "[ab]", "[^a-c]", "[%d_]", ".", "(", ")", "()",
+            "*", "+", "-", "?", "$", "^", "%b()", "%f[%w]", "%1", "%", "[", "]", "%.", "\\0"}
+        local subjects = {"", "abc", "a1 b2 c3", "(a(b)c)", "aaa", "a\\0b", "x = 10; y = 20"}
+        local function run(p, s)
+            local r = {}
+            local function add(...)
+                local t = table.pack(...)
+                for i = 1, t.n do r[#r + 1] = tostring(t[i]) end
+                r[#r + 1] = ";"
+            end
+            add(pcall(string.find, s, p))
+            add(pcall(string.match, s, p, 2))
+            add(pcall(string.gsub, s, p, "<%0>"))
+            add(pcall(function() local n = 0 for _ in s:gmatch(p) do n = n + 1 if n > 20 then break end end return n end))
+            return table.concat(r, "|")
+        end
+        math.randomseed(19)
+        local patterns = {}
+        for i = 1, 400 do
+            local p = {}
+            for j = 1, math.random(1, 6) do p[j] = items[math.random(#items)] end
+            patterns[i] = table.concat(p)
+        end
+        string.patterncache("off")
+        local expected = {}
+        for i, p in ipairs(patterns) do expected[i] = run(p, subjects[i % #subjects + 1]) end
+        string.patterncache("on")
+        for _ = 1, 2 do
+            for i, p in ipairs(patterns) do assert(run(p, subjects[i % #subjects + 1]) == expected[i], p) end
+        end
+        local hits, misses, evictions, count, mode = string.patterncache()
+        assert(hits > 0 and misses > 0 and evictions > 0 and count > 0 and mode == "on")
+        string.patterncache("clear")
+        assert(select(4, string.patterncache()) == 0)
+        """) == false)
+    L.close()
+}
+
+@Test func patternSpecialization() throws {
+    let L = LuaState.newLuaState()
+    L.openLibs()
+    // Differential fuzz: specialized patterns match exactly as 'match' interprets them
+    #expect(L.doString("""
+        local items = {"a", "b", "ab", "abc", ",", "=", " ", "%d+", "%a*", "%w+", "%s+", "[^,]*", "a+", "b*", "[ab]+",
+            "x?", "c-", ".", "(", ")", "()", "%b()", "%f[%w]", "%1", "$", "^", "[", "%"}
+        local alphabet = {"a", "b", "c", ",", "=", " ", "1", "2", "(", ")", "x"}
+        local function run(p, s)
+            local r = {}
+            local function add(...)
+                local t = table.pack(...)
+                for i = 1, t.n do r[#r + 1] = tostring(t[i]) end
+                r[#r + 1] = ";"
+            end
+            add(pcall(string.find, s, p))
+            add(pcall(string.find, s, p, 3))
+            add(pcall(string.match, s, p))
+            add(pcall(string.gsub, s, p, "<%0>"))
+            add(pcall(string.gsub, s, p, function(...) return select("#", ...) end, 2))
+            add(pcall(function() local t = {} for a, b in s:gmatch(p) do t[#t + 1] = tostring(a) .. tostring(b) if #t > 20 then break end end return table.concat(t, ",") end))
+            return table.concat(r, " ")
+        end
+        math.randomseed(20)
+        for _ = 1, 1500 do
+            local p, s = {}, {}
+            for i = 1, math.random(1, 6) do p[i] = items[math.random(#items)] end
+            for i = 1, math.random(0, 30) do s[i] = alphabet[math.random(#alphabet)] end
+            p, s = table.concat(p), table.concat(s)
+            string.patterncache("off")
+            local expected = run(p, s)
+            string.patterncache("on")
+            string.patterncache("jit", 0)
+            assert(run(p, s) == expected, p)
+            string.patterncache("clear")
+            string.patterncache("jit", 2)
+            for _ = 1, 3 do assert(run(p, s) == expected, p) end
+        end
+        assert(select(6, string.patterncache()) > 0)
+        string.patterncache("jit")
+        """) == false)
+    L.close()
+}